@@ -80,11 +80,20 @@
  */
 
 /* Base64 encoder/decoder. Originally Apache file ap_base64.c
+ *
+ * Whole blocks are encoded/decoded with avx2 or ssse3 when the cpu has
+ * them (see ws_cpu.h), the tables below handle the rest.
  */
 
 #include <string.h>
+#include <stdint.h>
 
 #include "base64.h"
+#include "ws_cpu.h"
+
+#if defined(WS_ARCH_X86)
+#include <immintrin.h>
+#endif
 
 /* aaaack but it's fast and const should make it shared text page. */
 static const unsigned char pr2six[256] =
@@ -108,81 +117,364 @@ static const unsigned char pr2six[256] =
     64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64
 };
 
-int Base64decode_len(const char *bufcoded)
+static const char basis_64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/*
+ * a block kernel converts as many whole blocks as it can and returns the
+ * number of input bytes it consumed. a decode kernel also stops in front
+ * of a block holding a byte out of the alphabet.
+ */
+typedef int (*encode_blocks_func)(unsigned char *dst, const unsigned char *src, int len);
+typedef int (*decode_blocks_func)(unsigned char *dst, const unsigned char *src, int len);
+
+static int encode_blocks_none(unsigned char *, const unsigned char *, int)
+{
+    return 0;
+}
+
+static int decode_blocks_none(unsigned char *, const unsigned char *, int)
+{
+    return 0;
+}
+
+#if defined(WS_ARCH_X86)
+/*
+ * the kernels follow W. Mula and D. Lemire, "Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions".
+ */
+
+/* 12 bytes in the low bytes of each 16 byte lane -> 16 six bit indices */
+WS_TARGET("ssse3")
+static inline __m128i enc_reshuffle_ssse3(__m128i in)
 {
-    int nbytesdecoded;
-    register const unsigned char *bufin;
-    register int nprbytes;
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
 
-    bufin = (const unsigned char *) bufcoded;
-    while (pr2six[*(bufin++)] <= 63);
+/* six bit indices -> ascii, by adding a per range offset */
+WS_TARGET("ssse3")
+static inline __m128i enc_translate_ssse3(__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                      '/' - 63, 'A', 0, 0);
+    __m128i r = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, r));
+}
+
+/* ascii -> six bit indices, *bad gets a non zero byte for a char out of
+   the alphabet */
+WS_TARGET("ssse3")
+static inline __m128i dec_translate_ssse3(__m128i in, __m128i *bad)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
 
-    nprbytes = (bufin - (const unsigned char *) bufcoded) - 1;
-    nbytesdecoded = ((nprbytes + 3) / 4) * 3;
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    __m128i lo_nibbles = _mm_and_si128(in, nibble);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    *bad = _mm_and_si128(lo, hi);
 
-    return nbytesdecoded + 1;
+    __m128i eq_slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_slash, hi_nibbles));
+    return _mm_add_epi8(in, roll);
 }
 
-int Base64decode(char *bufplain, const char *bufcoded)
+/* 16 six bit indices -> 12 bytes in the low bytes of the lane */
+WS_TARGET("ssse3")
+static inline __m128i dec_reshuffle_ssse3(__m128i in)
+{
+    __m128i merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                                  8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+WS_TARGET("ssse3")
+static int encode_blocks_ssse3(unsigned char *dst, const unsigned char *src, int len)
+{
+    int i = 0;
+
+    /* each load reads 16 bytes but consumes 12 */
+    for (; i + 16 <= len; i += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i out = enc_translate_ssse3(enc_reshuffle_ssse3(in));
+        _mm_storeu_si128((__m128i *) dst, out);
+        dst += 16;
+    }
+    return i;
+}
+
+WS_TARGET("ssse3")
+static int decode_blocks_ssse3(unsigned char *dst, const unsigned char *src, int len)
+{
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i bad;
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i values = dec_translate_ssse3(in, &bad);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(bad, _mm_setzero_si128())) != 0) {
+            break;
+        }
+
+        /* store exactly 12 bytes, dst is only as large as the output */
+        __m128i out = dec_reshuffle_ssse3(values);
+        _mm_storel_epi64((__m128i *) dst, out);
+        uint32_t tail = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+        memcpy(dst + 8, &tail, 4);
+        dst += 12;
+    }
+    return i;
+}
+
+WS_TARGET("avx2")
+static int encode_blocks_avx2(unsigned char *dst, const unsigned char *src, int len)
+{
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0,
+                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                         '/' - 63, 'A', 0, 0);
+    int i = 0;
+
+    /* 24 bytes as two 12 byte lanes, the upper load reads up to src + 28 */
+    for (; i + 28 <= len; i += 24) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        in = _mm256_shuffle_epi8(in, shuf);
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+
+        __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+        r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        __m256i out = _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, r));
+
+        _mm256_storeu_si256((__m256i *) dst, out);
+        dst += 32;
+    }
+
+    /* less than 28 bytes left for the wide loop, finish with 16 byte loads */
+    return i + encode_blocks_ssse3(dst, src + i, len - i);
+}
+
+WS_TARGET("avx2")
+static int decode_blocks_avx2(unsigned char *dst, const unsigned char *src, int len)
 {
-    int nbytesdecoded;
-    register const unsigned char *bufin;
-    register unsigned char *bufout;
-    register int nprbytes;
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+        __m256i lo_nibbles = _mm256_and_si256(in, nibble);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
 
-    bufin = (const unsigned char *) bufcoded;
-    while (pr2six[*(bufin++)] <= 63);
-    nprbytes = (bufin - (const unsigned char *) bufcoded) - 1;
-    nbytesdecoded = ((nprbytes + 3) / 4) * 3;
+        __m256i eq_slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_slash, hi_nibbles));
+        __m256i values = _mm256_add_epi8(in, roll);
 
-    bufout = (unsigned char *) bufplain;
-    bufin = (const unsigned char *) bufcoded;
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        /* 12 bytes in each lane -> 24 contiguous bytes */
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
 
-    while (nprbytes > 4) {
-    *(bufout++) =
-        (unsigned char) (pr2six[*bufin] << 2 | pr2six[bufin[1]] >> 4);
-    *(bufout++) =
-        (unsigned char) (pr2six[bufin[1]] << 4 | pr2six[bufin[2]] >> 2);
-    *(bufout++) =
-        (unsigned char) (pr2six[bufin[2]] << 6 | pr2six[bufin[3]]);
-    bufin += 4;
-    nprbytes -= 4;
+        __m128i lo_out = _mm256_castsi256_si128(merged);
+        __m128i hi_out = _mm256_extracti128_si256(merged, 1);
+        _mm_storeu_si128((__m128i *) dst, lo_out);
+        _mm_storel_epi64((__m128i *) (dst + 16), hi_out);
+        dst += 24;
     }
 
-    /* Note: (nprbytes == 1) would be an error, so just ingore that case */
+    return i + decode_blocks_ssse3(dst, src + i, len - i);
+}
+#endif
+
+static encode_blocks_func select_encode_blocks()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_AVX2 | WS_CPU_SSSE3)) {
+        return encode_blocks_avx2;
+    }
+    if (ws_cpu_has(WS_CPU_SSSE3)) {
+        return encode_blocks_ssse3;
+    }
+#endif
+    return encode_blocks_none;
+}
+
+static decode_blocks_func select_decode_blocks()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_AVX2 | WS_CPU_SSSE3)) {
+        return decode_blocks_avx2;
+    }
+    if (ws_cpu_has(WS_CPU_SSSE3)) {
+        return decode_blocks_ssse3;
+    }
+#endif
+    return decode_blocks_none;
+}
+
+static int encode_blocks(unsigned char *dst, const unsigned char *src, int len)
+{
+    static encode_blocks_func func = select_encode_blocks();
+    return func(dst, src, len);
+}
+
+static int decode_blocks(unsigned char *dst, const unsigned char *src, int len)
+{
+    static decode_blocks_func func = select_decode_blocks();
+    return func(dst, src, len);
+}
+
+/*
+ * decode src[0, len) up to the first char out of the alphabet, a padding
+ * '=' included. returns the number of decoded bytes, *used gets the
+ * number of chars used.
+ */
+static int decode_prefix(unsigned char *bufout, const unsigned char *bufin, int len, int *used)
+{
+    int i = decode_blocks(bufout, bufin, len);
+    unsigned char *out = bufout + i / 4 * 3;
+
+    for (; i + 4 <= len; i += 4) {
+        unsigned char a = pr2six[bufin[i]];
+        unsigned char b = pr2six[bufin[i + 1]];
+        unsigned char c = pr2six[bufin[i + 2]];
+        unsigned char d = pr2six[bufin[i + 3]];
+        if ((a | b | c | d) > 63) {
+            break;
+        }
+        *(out++) = (unsigned char) (a << 2 | b >> 4);
+        *(out++) = (unsigned char) (b << 4 | c >> 2);
+        *(out++) = (unsigned char) (c << 6 | d);
+    }
+
+    /* a last group of 2 or 3 chars, a single char carries no whole byte */
+    int nprbytes = 0;
+    while (nprbytes < 3 && i + nprbytes < len && pr2six[bufin[i + nprbytes]] <= 63) {
+        nprbytes++;
+    }
     if (nprbytes > 1) {
-    *(bufout++) =
-        (unsigned char) (pr2six[*bufin] << 2 | pr2six[bufin[1]] >> 4);
+        *(out++) =
+            (unsigned char) (pr2six[bufin[i]] << 2 | pr2six[bufin[i + 1]] >> 4);
     }
     if (nprbytes > 2) {
-    *(bufout++) =
-        (unsigned char) (pr2six[bufin[1]] << 4 | pr2six[bufin[2]] >> 2);
-    }
-    if (nprbytes > 3) {
-    *(bufout++) =
-        (unsigned char) (pr2six[bufin[2]] << 6 | pr2six[bufin[3]]);
+        *(out++) =
+            (unsigned char) (pr2six[bufin[i + 1]] << 4 | pr2six[bufin[i + 2]] >> 2);
     }
 
-    *(bufout++) = '\0';
-    nbytesdecoded -= (4 - nprbytes) & 3;
+    *used = i + nprbytes;
+    return (int) (out - bufout);
+}
+
+int Base64decode_len(const char *bufcoded)
+{
+    /* every char counts, so this is an upper bound when the input has
+       padding or junk after the encoded data */
+    int nprbytes = (int) strlen(bufcoded);
+    return ((nprbytes + 3) / 4) * 3 + 1;
+}
+
+int Base64decode(char *bufplain, const char *bufcoded)
+{
+    int used;
+    int nbytesdecoded = decode_prefix((unsigned char *) bufplain,
+                                      (const unsigned char *) bufcoded,
+                                      (int) strlen(bufcoded), &used);
+    bufplain[nbytesdecoded] = '\0';
     return nbytesdecoded;
 }
 
-static const char basis_64[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+int Base64decode_n(char *plain_dst, int plain_dst_size, const char *coded_src, int len_coded_src)
+{
+    if (len_coded_src < 0) {
+        return -1;
+    }
+
+    /* padding is optional, but only as much as completes the last group */
+    int len = len_coded_src;
+    if (len > 0 && (len & 3) == 0 && coded_src[len - 1] == '=') {
+        len--;
+        if (coded_src[len - 1] == '=') {
+            len--;
+        }
+    }
+    if ((len & 3) == 1) {
+        return -1;
+    }
+
+    int ndecoded = len / 4 * 3 + ((len & 3) == 0 ? 0 : (len & 3) - 1);
+    if (ndecoded > plain_dst_size) {
+        return -1;
+    }
+
+    int used;
+    if (decode_prefix((unsigned char *) plain_dst, (const unsigned char *) coded_src,
+                      len, &used) != ndecoded || used != len) {
+        return -1;
+    }
+    return ndecoded;
+}
 
 int Base64encode_len(int len)
 {
     return ((len + 2) / 3 * 4) + 1;
 }
 
-int Base64encode(char *encoded, const char *string, int len)
+/* encode len bytes without the terminating '\0', returns the chars written */
+static int encode_chars(char *encoded, const unsigned char *string, int len)
 {
-    int i;
-    char *p;
+    int i = encode_blocks((unsigned char *) encoded, string, len);
+    char *p = encoded + i / 3 * 4;
 
-    p = encoded;
-    for (i = 0; i < len - 2; i += 3) {
+    for (; i < len - 2; i += 3) {
     *p++ = basis_64[(string[i] >> 2) & 0x3F];
     *p++ = basis_64[((string[i] & 0x3) << 4) |
                     ((int) (string[i + 1] & 0xF0) >> 4)];
@@ -204,6 +496,22 @@ int Base64encode(char *encoded, const char *string, int len)
     *p++ = '=';
     }
 
-    *p++ = '\0';
-    return p - encoded;
+    return (int) (p - encoded);
+}
+
+int Base64encode(char *encoded, const char *string, int len)
+{
+    int n = encode_chars(encoded, (const unsigned char *) string, len);
+    encoded[n] = '\0';
+    return n + 1;
+}
+
+int Base64encode_n(char *coded_dst, int coded_dst_size, const char *plain_src, int len_plain_src)
+{
+    if (len_plain_src < 0 || coded_dst_size < Base64encode_len(len_plain_src)) {
+        return -1;
+    }
+    int n = encode_chars(coded_dst, (const unsigned char *) plain_src, len_plain_src);
+    coded_dst[n] = '\0';
+    return n;
 }
@@ -94,6 +94,21 @@ int Base64encode(char * coded_dst, const char *plain_src,int len_plain_src);
 int Base64decode_len(const char * coded_src);
 int Base64decode(char * plain_dst, const char *coded_src);
 
+/*
+ * length checked variants for binary data that is not '\0' terminated.
+ *
+ * Base64encode_n writes the encoded chars and a terminating '\0', it
+ * needs coded_dst_size >= Base64encode_len(len_plain_src). returns the
+ * number of chars without the '\0', or -1 if coded_dst is too small.
+ *
+ * Base64decode_n decodes exactly len_coded_src chars, the trailing '='
+ * padding is optional. returns the number of decoded bytes, or -1 if the
+ * input is not valid base64 or does not fit in plain_dst_size bytes.
+ * nothing is written after the decoded bytes.
+ */
+int Base64encode_n(char * coded_dst, int coded_dst_size, const char *plain_src, int len_plain_src);
+int Base64decode_n(char * plain_dst, int plain_dst_size, const char *coded_src, int len_coded_src);
+
 #ifdef __cplusplus
 }
 #endif
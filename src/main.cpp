@@ -22,12 +22,21 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 /*
 * demostrate an asychronize websocket server base on websocketfiles 
-* only use one working threadth
 *
+* usage: wsfiles_main_uv [-m inline|pool] [-t loops] [-w workers] [-z] [-d dict] [-b|-p] [-s policy] [-q low,high,max] [-k ping,pong] [-i idle] [port]
+*   -m inline  process reads on the event loop thread(default). endpoints
+*              marked blocking are still processed on the working thread.
+*   -m pool    process every read on the working thread
+*   -t loops   number of event loop threads(default 1), each one with its
+*              own uv_loop_t
+*   -w workers number of working threads(UV_THREADPOOL_SIZE). reads of one
+*              connection are still processed one at a time and in order.
+* the other options are those of every demo server, see ws_demo.h
 */
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -35,26 +44,150 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include "uv.h"
 #include "ws_endpoint.h"
+#include "ws_buffer_pool.h"
+#include "ws_demo.h"
+#include "ws_pubsub.h"
+#include "ws_send_queue.h"
+#include "ws_timer_wheel.h"
+#include "ws_log.h"
 
 #define DEFAULT_BACKLOG 128
-// for each connected client.
+// receive buffers: 64K blocks carved from 1M slabs
+#define RECV_BLOCK_SIZE (64 * 1024)
+#define RECV_BLOCKS_PER_SLAB 16
+// most pieces of the send queue written by one uv_write
+#define PEER_WRITE_MAX_BUFS 256
+// keepalive timers of the peers are rounded to it
+#define KEEPALIVE_TICK_MS 100
+
+enum ProcessMode
+{
+  PROCESS_INLINE = 0,
+  PROCESS_POOL = 1
+};
+
+static int process_mode = PROCESS_INLINE;
+// the command line, and the endpoints of the peers
+static WSDemo demo;
+
+struct peer_state_s;
+
+// a slab of receive buffers shared by a loop thread and the working
+// threads: pool mode receives on the loop thread, but the endpoint gives
+// the block back on the working thread that consumed it
+class LockedSlabAllocator : public BufferAllocator
+{
+public:
+  LockedSlabAllocator(int block_size, int blocks_per_slab) : slab_(block_size, blocks_per_slab)
+  {
+    uv_mutex_init(&mutex_);
+  }
+  virtual ~LockedSlabAllocator() { uv_mutex_destroy(&mutex_); }
+
+  virtual char *allocate(int size, int *capacity)
+  {
+    uv_mutex_lock(&mutex_);
+    char *block = slab_.allocate(size, capacity);
+    uv_mutex_unlock(&mutex_);
+    return block;
+  }
+  virtual void deallocate(char *block, int capacity)
+  {
+    uv_mutex_lock(&mutex_);
+    slab_.deallocate(block, capacity);
+    uv_mutex_unlock(&mutex_);
+  }
+
+private:
+  SlabAllocator slab_;
+  uv_mutex_t mutex_;
+};
+
+// an event loop thread and its listener. loop 0 is the default loop
+// and runs on the main thread. loop->data points to it.
 typedef struct
 {
-  uv_tcp_t *uvclient;
-  WebSocketEndpoint *endpoint;
-} peer_state_t;
+  // index in the loops array, also the pub/sub shard of the loop
+  int index;
+  uv_loop_t *loop;
+  uv_loop_t own_loop;
+  uv_tcp_t server;
+  uv_thread_t thread;
+  // receive buffers of the connections on this loop, only used by
+  // the loop thread
+  SlabAllocator *recv_pool;
+  // receive buffers of its connections processed by working threads
+  LockedSlabAllocator *work_recv_pool;
+  // peers given shared frames since the last flush_check, which writes
+  // each of them once per loop iteration however many frames it got
+  struct peer_state_s *dirty_peers;
+  uv_check_t flush_check;
+  // woken when another loop publishes to a subscriber of this one
+  uv_async_t pubsub_async;
+  // keepalive timers of the peers, advanced by one uv timer per tick
+  WSTimerWheel *timers;
+  uv_timer_t tick_timer;
+} server_loop_t;
 
+// frames produced by a working thread during one processing pass
+// (handshake, echo, pong, close...). the loop thread moves them to the
+// send queue of the peer when the pass is completed.
 typedef struct
+{
+  uv_buf_t *bufs;
+  unsigned int nbufs;
+  unsigned int capacity;
+} peer_outbox_t;
+
+typedef struct peer_work_data_s
 {
   uv_tcp_t *uvclient;
   WebSocketEndpoint *endpoint;
   uv_buf_t request;
-  uv_buf_t response;
+  peer_outbox_t response;
   int type;
+  struct peer_work_data_s *next;
 } peer_work_data_t;
 
+// for each connected client.
+typedef struct peer_state_s
+{
+  uv_tcp_t *uvclient;
+  WebSocketEndpoint *endpoint;
+  // mailbox of reads waiting for a working thread, in arrival order.
+  // only the loop thread touches it, and at most one entry is in work.
+  peer_work_data_t *mbox_head;
+  peer_work_data_t *mbox_tail;
+  bool busy;
+  // frames waiting for the peer. one uv_write at a time takes the front
+  // of the queue, so what comes meanwhile waits here, where the limits
+  // apply, and goes out with the next write
+  WSSendQueue *sendq;
+  uv_write_t write_req;
+  uv_buf_t *write_bufs;
+  unsigned int write_capacity;
+  int64_t write_size;
+  bool writing;
+  // reads stopped above the high watermark of the send queue
+  bool read_paused;
+  // the send queue refused a frame, the peer is failed by peer_flush
+  bool overflow;
+  // failed, the handle is closed once the close frame is written
+  bool closing;
+  // the handle is closed, or its close waits in the mailbox
+  bool closed;
+  // link of server_loop_t.dirty_peers
+  struct peer_state_s *next_dirty;
+  // from peer_list_add until the peer is gone
+  bool listed;
+  bool dirty;
+  // on the timer wheel of the loop, see on_peer_keepalive
+  WSTimer keepalive;
+} peer_state_t;
+
 void fail(char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
@@ -72,11 +205,32 @@ void* xmalloc(size_t size) {
   return ptr;
 }
 
+bool use_work_queue(peer_state_t *peerstate);
+
+SlabAllocator *get_recv_pool(uv_loop_t *loop)
+{
+  return ((server_loop_t *)loop->data)->recv_pool;
+}
+
+// reads go straight into the endpoint, whose receive buffer is backed by
+// the recv pool of the loop, or its locked one in pool mode. a peer in pool
+// mode only reads while no working thread has the endpoint, see
+// peer_read_resume. either way a read costs neither malloc nor copy.
 void on_alloc_buffer(uv_handle_t *handle, size_t suggested_size,
                      uv_buf_t *buf)
 {
-  buf->base = (char *)xmalloc(suggested_size);
-  buf->len = suggested_size;
+  peer_state_t *peerstate = (peer_state_t *)handle->data;
+
+  // a read is capped at the room left in the block of the endpoint
+  int32_t room = 0;
+  buf->base = peerstate->endpoint->wire_buffer(RECV_BLOCK_SIZE, &room);
+  buf->len = room;
+}
+
+// give back the room of a read that received nothing
+void free_read_buffer(uv_stream_t *client, peer_state_t *peerstate, const uv_buf_t *buf)
+{
+  peerstate->endpoint->process_received(0, NULL, NULL);
 }
 
 void on_alloc_buffer_v2(char *buf, uint64_t suggested_size)
@@ -88,13 +242,13 @@ int uv_buf_alloc_cpy(uv_buf_t *dst, const uv_buf_t *src, int size)
 {
   if (src == NULL || dst == NULL)
   {
-    printf("main - uv buffer alloc and copy failed[src prt is NULL]!\r\n");
+    WS_ERROR("main - uv buffer alloc and copy failed[src prt is NULL]!");
     return -1;
   }
 
   if (src->len < size)
   {
-    printf("main - uv buffer alloc and copy failed[src-len < size]!\r\n");
+    WS_ERROR("main - uv buffer alloc and copy failed[src-len < size]!");
     return -2;
   }
 
@@ -102,47 +256,305 @@ int uv_buf_alloc_cpy(uv_buf_t *dst, const uv_buf_t *src, int size)
   dst->len = size;
 
   memcpy(dst->base, src->base, size);
+  return 0;
 }
 
-void set_thread_pool_size()
+// each peer has its own mailbox, so the pool may use any number of
+// threads. libuv reads the size before the first work is queued.
+void set_thread_pool_size(int nthread)
 {
-  int nthread = 0;
   const char *val = getenv("UV_THREADPOOL_SIZE");
   if (val != NULL)
   {
-    nthread = atoi(val);
-    printf("dafault thread pool size:%d\n", nthread);
+    WS_INFO("dafault thread pool size:%d", atoi(val));
+  }
+  if (nthread > 0)
+  {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", nthread);
+    setenv("UV_THREADPOOL_SIZE", buf, 1);
   }
-  setenv("UV_THREADPOOL_SIZE", "1", 1);
 
   val = getenv("UV_THREADPOOL_SIZE");
-  nthread = atoi(val);
-  printf("set thread pool size:%d\n", nthread);
+  if (val != NULL)
+  {
+    WS_INFO("set thread pool size:%d", atoi(val));
+  }
+}
+
+void outbox_init(peer_outbox_t *out)
+{
+  out->bufs = NULL;
+  out->nbufs = 0;
+  out->capacity = 0;
+}
+
+void outbox_free(peer_outbox_t *out)
+{
+  for (unsigned int i = 0; i < out->nbufs; i++)
+  {
+    free(out->bufs[i].base);
+  }
+  free(out->bufs);
+  outbox_init(out);
+}
+
+// keep a copy of a frame, the endpoint reuses its buffer after the call
+void outbox_append(peer_outbox_t *out, const char *buf, int64_t size)
+{
+  if (out->nbufs == out->capacity)
+  {
+    out->capacity = out->capacity ? out->capacity * 2 : 8;
+    out->bufs = (uv_buf_t *)realloc(out->bufs, out->capacity * sizeof(uv_buf_t));
+    if (out->bufs == NULL)
+    {
+      fail("realloc failed");
+    }
+  }
+  char *base = (char *)xmalloc(size);
+  memcpy(base, buf, size);
+  out->bufs[out->nbufs++] = uv_buf_init(base, size);
+}
+
+void on_client_closed(uv_handle_t *handle);
+void on_peer_read(uv_stream_t *client, ssize_t nread, const uv_buf_t *buf);
+void on_alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+void peer_fail(peer_state_t *peerstate);
+void peer_close(peer_state_t *peerstate);
+void peer_read_resume(peer_state_t *peerstate);
+void peer_fail_close(peer_state_t *peerstate);
+void peer_close_handle(peer_state_t *peerstate);
+
+// a frame for the peer was queued, dropped by the slow consumer policy,
+// or refused: the peer is then failed by the next peer_flush
+void peer_queued(peer_state_t *peerstate, WSSendResult result)
+{
+  if (result == WS_SEND_OVERFLOW)
+  {
+    peerstate->overflow = true;
+  }
+}
+
+void on_peer_sent(uv_write_t *req, int status);
+
+// write the front of the send queue unless a write is in flight, and stop
+// reading from the peer above the high watermark. runs in the loop thread.
+void peer_flush(peer_state_t *peerstate)
+{
+  if (peerstate->overflow)
+  {
+    peer_fail(peerstate);
+    return;
+  }
+
+  if (!peerstate->writing && !peerstate->sendq->empty())
+  {
+    WSSendBuf pieces[PEER_WRITE_MAX_BUFS];
+    int32_t n = peerstate->sendq->peek(pieces, PEER_WRITE_MAX_BUFS);
+    if (n > (int32_t)peerstate->write_capacity)
+    {
+      unsigned int capacity = peerstate->write_capacity ? peerstate->write_capacity : 4;
+      while (capacity < (unsigned int)n)
+      {
+        capacity *= 2;
+      }
+      peerstate->write_bufs = (uv_buf_t *)realloc(peerstate->write_bufs, capacity * sizeof(uv_buf_t));
+      if (peerstate->write_bufs == NULL)
+      {
+        fail("realloc failed");
+      }
+      peerstate->write_capacity = capacity;
+    }
+    peerstate->write_size = 0;
+    for (int32_t i = 0; i < n; i++)
+    {
+      peerstate->write_bufs[i] = uv_buf_init((char *)pieces[i].data, pieces[i].size);
+      peerstate->write_size += pieces[i].size;
+    }
+
+    int rc;
+    peerstate->write_req.data = peerstate;
+    if ((rc = uv_write(&peerstate->write_req, (uv_stream_t *)peerstate->uvclient,
+                       peerstate->write_bufs, n, on_peer_sent)) < 0)
+    {
+      WS_WARN("main - uv_write failed: %s", uv_strerror(rc));
+      peerstate->sendq->consume(peerstate->write_size);
+    }
+    else
+    {
+      peerstate->writing = true;
+    }
+  }
+
+  if (peerstate->sendq->is_paused() && !peerstate->read_paused && !peerstate->closing)
+  {
+    uv_read_stop((uv_stream_t *)peerstate->uvclient);
+    peerstate->read_paused = true;
+  }
 }
 
+void on_peer_sent(uv_write_t *req, int status)
+{
+  peer_state_t *peerstate = (peer_state_t *)req->data;
+  peerstate->writing = false;
+  peerstate->sendq->consume(peerstate->write_size);
+
+  uv_handle_t *client = (uv_handle_t *)peerstate->uvclient;
+  if (uv_is_closing(client))
+  {
+    // closed with the write pending
+    return;
+  }
+  if (status)
+  {
+    // the peer is gone. a closing or paused peer has no read to fail on
+    // it, so it is closed here
+    WS_WARN("main - write error: %s", uv_strerror(status));
+    peer_close(peerstate);
+    return;
+  }
+
+  if (peerstate->closing && peerstate->sendq->empty() && peerstate->mbox_head == NULL &&
+      !peerstate->busy)
+  {
+    // the close frame is out. in pool mode it is only queued once the
+    // mailbox is drained
+    peer_close_handle(peerstate);
+    return;
+  }
+
+  peer_flush(peerstate);
+  if (peerstate->read_paused && !peerstate->sendq->is_paused() && !peerstate->closing)
+  {
+    peerstate->read_paused = false;
+    peer_read_resume(peerstate);
+  }
+}
+
+// read from the peer again, unless it is closing, paused by its send queue
+// or a working thread has its endpoint, which then resumes when done
+void peer_read_resume(peer_state_t *peerstate)
+{
+  if (peerstate->closing || peerstate->read_paused || peerstate->busy ||
+      peerstate->mbox_head != NULL)
+  {
+    return;
+  }
+  int rc;
+  if ((rc = uv_read_start((uv_stream_t *)peerstate->uvclient, on_alloc_buffer,
+                          on_peer_read)) < 0)
+  {
+    fail("uv_read_start failed: %s", uv_strerror(rc));
+  }
+}
+
+// runs in the loop thread
 void free_work_data(peer_work_data_t *workdata)
 {
   //not free endpoint
   workdata->uvclient = NULL;
   workdata->endpoint = NULL;
-  free(workdata->request.base);
-  workdata->request.base = NULL;
-  free(workdata->response.base);
-  workdata->response.base = NULL;
+  outbox_free(&workdata->response);
   free(workdata);
 }
 
+// write callback of pool mode, runs in the working thread
 void on_write_response(char *buf, int64_t size, void *wd)
 {
   peer_work_data_t *work_data = (peer_work_data_t *)wd;
-  if (work_data->response.base != NULL)
+  outbox_append(&work_data->response, buf, size);
+}
+
+// write callback of inline mode
+void on_write_response_inline(char *buf, int64_t size, void *wd)
+{
+  peer_state_t *peerstate = (peer_state_t *)wd;
+  peer_queued(peerstate, peerstate->sendq->push(buf, size));
+}
+
+// frame writer of inline mode: the queue takes the packed frame's memory
+void on_write_frame_inline(ByteBuffer &frame, void *wd)
+{
+  peer_state_t *peerstate = (peer_state_t *)wd;
+  peer_queued(peerstate, peerstate->sendq->push(frame));
+}
+
+// use the working thread for this peer
+bool use_work_queue(peer_state_t *peerstate)
+{
+  return process_mode == PROCESS_POOL || peerstate->endpoint->is_blocking();
+}
+
+void peer_list_add(server_loop_t *sl, peer_state_t *peerstate)
+{
+  peerstate->listed = true;
+  peerstate->next_dirty = NULL;
+  peerstate->dirty = false;
+}
+
+// the peer is gone, no more flushes for it
+void peer_list_remove(server_loop_t *sl, peer_state_t *peerstate)
+{
+  if (!peerstate->listed)
+  {
+    return;
+  }
+  peerstate->listed = false;
+
+  if (peerstate->dirty)
   {
-    fail("Work data response is not NULL!");
+    peer_state_t **link = &sl->dirty_peers;
+    while (*link != peerstate)
+    {
+      link = &(*link)->next_dirty;
+    }
+    *link = peerstate->next_dirty;
+    peerstate->dirty = false;
   }
+}
 
-  uv_buf_t src = uv_buf_init(buf, size);
-  work_data->response = uv_buf_init(NULL, 0);
-  uv_buf_alloc_cpy(&(work_data->response), &src, src.len);
+// shared writer of every endpoint, runs in the loop thread. the frame is
+// written by flush_check at the end of this loop iteration, which also
+// fails the peer if it was refused: the broadcast or publication calling
+// this is still walking its peers.
+void on_write_shared(WSSharedFrame *frame, void *wd)
+{
+  peer_state_t *peerstate = (peer_state_t *)wd;
+  peer_queued(peerstate, peerstate->sendq->push_shared(frame));
+  if (!peerstate->dirty)
+  {
+    server_loop_t *sl = (server_loop_t *)peerstate->uvclient->loop->data;
+    peerstate->dirty = true;
+    peerstate->next_dirty = sl->dirty_peers;
+    sl->dirty_peers = peerstate;
+  }
+}
+
+// runs after the callbacks of each loop iteration
+void on_flush_check(uv_check_t *handle)
+{
+  server_loop_t *sl = (server_loop_t *)handle->data;
+  while (sl->dirty_peers != NULL)
+  {
+    peer_state_t *peerstate = sl->dirty_peers;
+    sl->dirty_peers = peerstate->next_dirty;
+    peerstate->dirty = false;
+    peer_flush(peerstate);
+  }
+}
+
+// another loop published to subscribers of this one
+void on_pubsub_async(uv_async_t *handle)
+{
+  server_loop_t *sl = (server_loop_t *)handle->data;
+  // the frames are written by flush_check of this iteration
+  demo.get_pubsub()->dispatch(sl->index);
+}
+
+// wakeup of a pub/sub shard, runs in the publishing thread
+void wake_pubsub_loop(void *data)
+{
+  uv_async_send((uv_async_t *)data);
 }
 
 void on_client_closed(uv_handle_t *handle)
@@ -153,57 +565,94 @@ void on_client_closed(uv_handle_t *handle)
   if (client->data)
   {
     peer_state_t *peerstate = (peer_state_t *)client->data;
+    server_loop_t *sl = (server_loop_t *)client->loop->data;
+    peer_list_remove(sl, peerstate);
+    sl->timers->stop(&peerstate->keepalive);
     delete peerstate->endpoint;
     peerstate->endpoint = NULL;
+    delete peerstate->sendq;
+    free(peerstate->write_bufs);
     free(client->data);
   }
   free(client);
 }
 
-void on_work_client_closed(uv_work_t *req)
+// Runs in a separate thread, can do blocking/time-consuming operations.
+void on_work_submitted(uv_work_t *req)
 {
-  if (req == NULL)
-  {
-    printf("main - on_client_close: req is null\r\n");
-    return;
-  }
-
   peer_work_data_t *work_data = (peer_work_data_t *)req->data;
-  peer_state_t *peerstate = (peer_state_t *)work_data->uvclient->data;
 
-  delete work_data->endpoint;
-  work_data->endpoint = NULL;
-  free((peer_state_t *)work_data->uvclient->data);
-  free(work_data->uvclient);
-  free(work_data->request.base);
-  free(work_data->response.base);
-  free(work_data);
-  free(req);
+  // the read is in the endpoint already, the request only has its size
+  int nrc = work_data->endpoint->process_received(work_data->request.len, on_write_response,
+                                                  work_data);
+  if (nrc < 0)
+  {
+    WS_WARN("main - process read buf failed with[err:%d].", nrc);
+  }
 }
 
-void on_sent_response(uv_write_t *req, int status)
+void on_work_completed(uv_work_t *req, int status);
+
+// hand the next mailbox entry of a peer to the working threads, unless
+// one is in work already. reads of a peer are so processed one at a time
+// and in order, while different peers use all working threads.
+void peer_dispatch_work(peer_state_t *peerstate)
 {
-  if (status)
+  while (!peerstate->busy && peerstate->mbox_head != NULL)
   {
-    fail("Write error: %s\n", uv_strerror(status));
-  }
+    peer_work_data_t *work_data = peerstate->mbox_head;
+    peerstate->mbox_head = work_data->next;
+    if (peerstate->mbox_head == NULL)
+    {
+      peerstate->mbox_tail = NULL;
+    }
+    work_data->next = NULL;
 
-  peer_work_data_t *work_data = (peer_work_data_t *)req->data;
-  free_work_data(work_data);
-  free(req);
+    if (work_data->type == 0)
+    {
+      // the peer is gone and none of its reads is in work any more.
+      // the handle belongs to the loop until its close callback has run.
+      uv_close((uv_handle_t *)work_data->uvclient, on_client_closed);
+      free_work_data(work_data);
+      return;
+    }
+    if (work_data->type == 2)
+    {
+      // the peer failed and no working thread has the endpoint any more,
+      // its close frame is sent from here
+      free_work_data(work_data);
+      peer_fail_close(peerstate);
+      continue;
+    }
+
+    uv_work_t *work_req = (uv_work_t *)xmalloc(sizeof(*work_req));
+    work_req->data = work_data;
+    peerstate->busy = true;
+
+    int rc;
+    if ((rc = uv_queue_work(work_data->uvclient->loop, work_req, on_work_submitted,
+                            on_work_completed)) < 0)
+    {
+      fail("uv_queue_work failed: %s", uv_strerror(rc));
+    }
+  }
 }
 
-// Runs in a separate thread, can do blocking/time-consuming operations.
-void on_work_submitted(uv_work_t *req)
+// add a read(type 1), the close frame of a failed peer(type 2) or the
+// close(type 0) of a peer to its mailbox
+void peer_post_work(peer_state_t *peerstate, peer_work_data_t *work_data)
 {
-  peer_work_data_t *work_data = (peer_work_data_t *)req->data;
-
-  int nrc = work_data->endpoint->process(work_data->request.base, work_data->request.len,
-                                         on_write_response, work_data);
-  if (nrc < 0)
+  if (peerstate->mbox_tail != NULL)
   {
-    printf("main - process read buf failed with[err:%d].\r\n", nrc);
+    peerstate->mbox_tail->next = work_data;
   }
+  else
+  {
+    peerstate->mbox_head = work_data;
+  }
+  peerstate->mbox_tail = work_data;
+
+  peer_dispatch_work(peerstate);
 }
 
 void on_work_completed(uv_work_t *req, int status)
@@ -214,77 +663,188 @@ void on_work_completed(uv_work_t *req, int status)
   }
 
   peer_work_data_t *work_data = (peer_work_data_t *)req->data;
+  peer_state_t *peerstate = (peer_state_t *)work_data->uvclient->data;
 
-  if (work_data->response.base == NULL)
+  // the endpoint is free for the next read of this peer
+  peerstate->busy = false;
+
+  if (work_data->response.nbufs == 0)
   {
-    printf("main - no response data! we will free work data and return directly!\r\n");
-    work_data->endpoint = NULL;
-    work_data->uvclient = NULL;
-    free_work_data(work_data);
-    free(req);
-    return;
+    WS_TRACE("main - no response data! we will free work data and return directly!");
   }
 
-  //printf("main - on_work_completed client adr:0x%x \r\n",work_data->uvclient);
-  uv_write_t *writereq = (uv_write_t *)xmalloc(sizeof(*writereq));
-  writereq->data = req->data;
-  req->data = NULL;
-
-  int rc;
-  if ((rc = uv_write(writereq, (uv_stream_t *)work_data->uvclient, &(work_data->response), 1,
-                     on_sent_response)) < 0)
+  // the responses now belong to the send queue
+  peer_outbox_t *out = &work_data->response;
+  for (unsigned int i = 0; i < out->nbufs && !peerstate->closing; i++)
+  {
+    peer_queued(peerstate, peerstate->sendq->push_owned(out->bufs[i].base, out->bufs[i].len));
+    out->bufs[i].base = NULL;
+  }
+  if (!peerstate->closing)
   {
-    fail("uv_write failed: %s", uv_strerror(rc));
+    peer_flush(peerstate);
   }
+  free_work_data(work_data);
   free(req);
+
+  peer_dispatch_work(peerstate);
+  peer_read_resume(peerstate);
 }
 
-uv_work_t *alloc_work_req(peer_state_t *peerstate, ssize_t nread, const uv_buf_t *buf, int type)
+peer_work_data_t *alloc_work_data(peer_state_t *peerstate, ssize_t nread, int type)
 {
-  uv_work_t *work_req = (uv_work_t *)xmalloc(sizeof(*work_req));
   peer_work_data_t *work_data = (peer_work_data_t *)xmalloc(sizeof(*work_data));
   work_data->uvclient = peerstate->uvclient;
   work_data->endpoint = peerstate->endpoint;
   work_data->request = uv_buf_init(NULL, 0);
+  outbox_init(&work_data->response);
   work_data->type = type;
+  work_data->next = NULL;
   if (work_data->type == 1)
   {
-    if (uv_buf_alloc_cpy(&(work_data->request), buf, nread) < 0)
-    {
-      free_work_data(work_data);
-      free(buf->base);
-      return NULL;
-    }
+    // the bytes read are in the endpoint already
+    work_data->request = uv_buf_init(NULL, nread);
+  }
+  return work_data;
+}
+
+// the send queue of a slow consumer went over its limit: drop what the
+// peer has not got yet, stop reading from it and close it with 1008
+void peer_fail(peer_state_t *peerstate)
+{
+  peerstate->overflow = false;
+  if (peerstate->closing || peerstate->closed)
+  {
+    return;
+  }
+  peerstate->closing = true;
+  WS_WARN("main - slow consumer, %" PRId64 " bytes queued", peerstate->sendq->queued_bytes());
+
+  uv_tcp_t *client = peerstate->uvclient;
+  uv_read_stop((uv_stream_t *)client);
+  peer_list_remove((server_loop_t *)client->loop->data, peerstate);
+  peerstate->sendq->discard();
+  if (use_work_queue(peerstate))
+  {
+    // a working thread may have the endpoint, send the close frame
+    // after the reads in the mailbox
+    peer_post_work(peerstate, alloc_work_data(peerstate, 0, 2));
+    return;
+  }
+  peer_fail_close(peerstate);
+}
+
+// queue the close frame of a failed peer, on the loop thread while no
+// working thread has the endpoint. the handle is closed once it is written
+void peer_fail_close(peer_state_t *peerstate)
+{
+  if (peerstate->closed)
+  {
+    return;
+  }
+  peerstate->endpoint->set_writer(on_write_response_inline, peerstate);
+  peerstate->endpoint->send_close(WS_CLOSE_POLICY_VIOLATION);
+  peer_flush(peerstate);
+  if (!peerstate->writing)
+  {
+    peer_close_handle(peerstate);
+  }
+}
+
+// close the handle of the peer, once however many paths fail it. in
+// pool mode the close waits behind the reads still in the mailbox
+void peer_close_handle(peer_state_t *peerstate)
+{
+  if (peerstate->closed)
+  {
+    return;
+  }
+  peerstate->closed = true;
+  if (use_work_queue(peerstate))
+  {
+    peer_post_work(peerstate, alloc_work_data(peerstate, 0, 0));
+  }
+  else
+  {
+    uv_close((uv_handle_t *)peerstate->uvclient, on_client_closed);
+  }
+}
+
+// the peer is gone or timed out, close it without a closing handshake
+void peer_close(peer_state_t *peerstate)
+{
+  if (peerstate->closed)
+  {
+    return;
+  }
+  uv_stream_t *client = (uv_stream_t *)peerstate->uvclient;
+  uv_read_stop(client);
+  peer_list_remove((server_loop_t *)client->loop->data, peerstate);
+  // what the reads still in the mailbox answer is not sent
+  peerstate->closing = true;
+  peer_close_handle(peerstate);
+}
+
+// the keepalive timer of a peer expired. the endpoint pings the peer or
+// times it out, on the loop thread while no working thread has it
+void on_peer_keepalive(WSTimer *timer, void *data)
+{
+  peer_state_t *peerstate = (peer_state_t *)data;
+  uv_handle_t *client = (uv_handle_t *)peerstate->uvclient;
+  WSTimerWheel *timers = ((server_loop_t *)client->loop->data)->timers;
+  if (peerstate->closed)
+  {
+    return;
+  }
+  if (peerstate->busy || peerstate->mbox_head != NULL)
+  {
+    // try again on the next tick
+    timers->start(timer, timers->get_tick());
+    return;
+  }
+  int64_t delay = peerstate->endpoint->on_keepalive_timer(on_write_response_inline, peerstate,
+                                                          peerstate->read_paused);
+  if (delay < 0)
+  {
+    WS_INFO("main - peer timed out");
+    peer_close(peerstate);
+    return;
+  }
+  peer_flush(peerstate);
+  if (delay > 0 && !uv_is_closing(client))
+  {
+    timers->start(timer, delay);
   }
-  work_data->response = uv_buf_init(NULL, 0);
-  work_req->data = work_data;
-  return work_req;
+}
+
+// runs every KEEPALIVE_TICK_MS
+void on_keepalive_tick(uv_timer_t *handle)
+{
+  server_loop_t *sl = (server_loop_t *)handle->data;
+  sl->timers->advance(uv_now(sl->loop));
 }
 
 void on_peer_read(uv_stream_t *client, ssize_t nread, const uv_buf_t *buf)
 {
-  int rc = 0;
   if (nread < 0)
   {
     if (nread != UV_EOF)
     {
-      fprintf(stderr, "Read error: %s\n", uv_strerror(nread));
+      WS_WARN("Read error: %s", uv_strerror(nread));
     }
 
     peer_state_t *peerstate = (peer_state_t *)client->data;
     peerstate->uvclient = (uv_tcp_t *)client;
-    uv_work_t *work_req = alloc_work_req(peerstate, nread, buf, 0);
-    if ((rc = uv_queue_work(uv_default_loop(), work_req, on_work_client_closed, NULL)) < 0)
-    {
-      fail("uv_queue_work failed: %s", uv_strerror(rc));
-    }
+    free_read_buffer(client, peerstate, buf);
+    peer_close(peerstate);
   }
   else if (nread == 0)
   {
     // From the documentation of uv_read_cb: nread might be 0, which does not
     // indicate an error or EOF. This is equivalent to EAGAIN or EWOULDBLOCK
     // under read(2).
-    printf("main - on_peer_read: nread==0 !\r\n");
+    WS_TRACE("main - on_peer_read: nread==0 !");
+    free_read_buffer(client, (peer_state_t *)client->data, buf);
   }
   else
   {
@@ -296,26 +856,54 @@ void on_peer_read(uv_stream_t *client, ssize_t nread, const uv_buf_t *buf)
      //      peerstate->uvclient, client, peerstate->uvclient->data,client->data);
     peerstate->uvclient = (uv_tcp_t *)client;
 
-    // add work reqs on the work queue, without blocking the
-    // callback.
-    uv_work_t *work_req = alloc_work_req(peerstate, nread, buf, 1);
-    if ((rc = uv_queue_work(uv_default_loop(), work_req, on_work_submitted,
-                            on_work_completed)) < 0)
+    if (!use_work_queue(peerstate))
     {
-      fail("uv_queue_work failed: %s", uv_strerror(rc));
+      // the data is already in the endpoint. parse and answer on the
+      // loop thread, all responses of this read are written together
+      int nrc = peerstate->endpoint->process_received(nread, on_write_response_inline,
+                                                      peerstate);
+      if (nrc < 0)
+      {
+        WS_WARN("main - process read buf failed with[err:%d].", nrc);
+      }
+      peer_flush(peerstate);
+    }
+    else
+    {
+      // add work reqs on the work queue, without blocking the
+      // callback. the endpoint is the working thread's until it is
+      // done, so nothing is read meanwhile
+      uv_read_stop(client);
+      peer_work_data_t *work_data = alloc_work_data(peerstate, nread, 1);
+      if (work_data != NULL)
+      {
+        peer_post_work(peerstate, work_data);
+      }
     }
   }
-  free(buf->base);
 }
 
+#ifdef SIGUSR1
+void on_dump_log(uv_signal_t *handle, int signum)
+{
+  WSSendQueueStats stats;
+  WSSendQueue::get_totals(stats);
+  WS_INFO("send queues: %" PRId64 " bytes in %" PRId64 " frames, dropped %" PRId64
+          " frames(%" PRId64 " bytes), %" PRId64 " overflows, %" PRId64 " pauses",
+          stats.queued_bytes, stats.queued_frames, stats.dropped_frames,
+          stats.dropped_bytes, stats.overflows, stats.pauses);
+  ws_log_dump(stderr);
+}
+#endif
+
 void report_peer_connected(const struct sockaddr_in* sa, socklen_t salen) {
   char hostbuf[NI_MAXHOST];
   char portbuf[NI_MAXSERV];
   if (getnameinfo((struct sockaddr*)sa, salen, hostbuf, NI_MAXHOST, portbuf,
                   NI_MAXSERV, 0) == 0) {
-    printf("peer (%s, %s) connected\n", hostbuf, portbuf);
+    WS_INFO("peer (%s, %s) connected", hostbuf, portbuf);
   } else {
-    printf("peer (unknonwn) connected\n");
+    WS_INFO("peer (unknonwn) connected");
   }
 }
 
@@ -323,7 +911,7 @@ void on_peer_connected(uv_stream_t *server, int status)
 {
   if (status < 0)
   {
-    fprintf(stderr, "Peer connection error: %s\n", uv_strerror(status));
+    WS_WARN("Peer connection error: %s", uv_strerror(status));
     return;
   }
 
@@ -331,7 +919,9 @@ void on_peer_connected(uv_stream_t *server, int status)
   // release it when the client disconnects. 
   uv_tcp_t *client = (uv_tcp_t *)xmalloc(sizeof(*client));
   int rc;
-  if ((rc = uv_tcp_init(uv_default_loop(), client)) < 0)
+  // the peer is served by the loop that accepted it for its whole life,
+  // so its endpoint is never touched by two loop threads
+  if ((rc = uv_tcp_init(server->loop, client)) < 0)
   {
     fail("uv_tcp_init failed: %s", uv_strerror(rc));
   }
@@ -348,10 +938,41 @@ void on_peer_connected(uv_stream_t *server, int status)
     }
     report_peer_connected((const struct sockaddr_in *)&peername, namelen);
 
+    server_loop_t *sl = (server_loop_t *)server->loop->data;
     peer_state_t *peerstate = (peer_state_t *)xmalloc(sizeof(*peerstate));
-    peerstate->endpoint = new WebSocketEndpoint();
+    peerstate->endpoint = demo.create_endpoint(sl->index);
+    peerstate->endpoint->set_shared_writer(on_write_shared, peerstate);
+    peerstate->endpoint->set_frame_writer(on_write_response_inline, on_write_frame_inline);
+    if (!use_work_queue(peerstate))
+    {
+      // the endpoint is only used on this loop thread
+      peerstate->endpoint->set_recv_allocator(get_recv_pool(client->loop));
+    }
+    else
+    {
+      peerstate->endpoint->set_recv_allocator(sl->work_recv_pool);
+    }
     peerstate->uvclient = client;
+    peerstate->mbox_head = NULL;
+    peerstate->mbox_tail = NULL;
+    peerstate->busy = false;
+    peerstate->sendq = new WSSendQueue(&demo.options().send_limits);
+    peerstate->write_bufs = NULL;
+    peerstate->write_capacity = 0;
+    peerstate->write_size = 0;
+    peerstate->writing = false;
+    peerstate->read_paused = false;
+    peerstate->overflow = false;
+    peerstate->closing = false;
+    peerstate->closed = false;
+    peer_list_add(sl, peerstate);
     client->data = peerstate;
+    WSTimerWheel::init(&peerstate->keepalive, on_peer_keepalive, peerstate);
+    uint32_t delay = peerstate->endpoint->keepalive_start();
+    if (delay > 0)
+    {
+      sl->timers->start(&peerstate->keepalive, delay);
+    }
 
     if ((rc = uv_read_start((uv_stream_t *)client, on_alloc_buffer,
                             on_peer_read)) < 0)
@@ -365,48 +986,142 @@ void on_peer_connected(uv_stream_t *server, int status)
   }
 }
 
-int main(int argc, const char **argv)
+void start_listener(server_loop_t *sl, const struct sockaddr_in *addr)
 {
-  setvbuf(stdout, NULL, _IONBF, 0);
-
-  int portnum = 9000;
-  if (argc >= 2)
-  {
-    portnum = atoi(argv[1]);
-  }
-  printf("Serving on port %d\n", portnum);
-
   int rc;
-  uv_tcp_t server;
-  if ((rc = uv_tcp_init(uv_default_loop(), &server)) < 0)
+  if ((rc = uv_tcp_init(sl->loop, &sl->server)) < 0)
   {
     fail("uv_tcp_init failed: %s", uv_strerror(rc));
   }
 
-  struct sockaddr_in addr;
-  if ((rc = uv_ip4_addr("0.0.0.0", portnum, &addr)) < 0)
+  if (demo.options().num_loops > 1)
   {
-    fail("uv_ip4_addr failed: %s", uv_strerror(rc));
+#ifdef SO_REUSEPORT
+    // every loop binds the same port, the kernel spreads new
+    // connections over the listeners
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+      fail("socket failed: %s", strerror(errno));
+    }
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+      fail("setsockopt SO_REUSEPORT failed: %s", strerror(errno));
+    }
+    if ((rc = uv_tcp_open(&sl->server, fd)) < 0)
+    {
+      fail("uv_tcp_open failed: %s", uv_strerror(rc));
+    }
+#else
+    fail("more than one event loop needs SO_REUSEPORT");
+#endif
   }
 
-  if ((rc = uv_tcp_bind(&server, (const struct sockaddr *)&addr, 0)) < 0)
+  if ((rc = uv_tcp_bind(&sl->server, (const struct sockaddr *)addr, 0)) < 0)
   {
     fail("uv_tcp_bind failed: %s", uv_strerror(rc));
   }
 
   // Listen on the socket for new peers to connect. When a new peer connects,
   // the on_peer_connected callback will be invoked.
-  if ((rc = uv_listen((uv_stream_t *)&server, DEFAULT_BACKLOG, on_peer_connected)) <
+  if ((rc = uv_listen((uv_stream_t *)&sl->server, DEFAULT_BACKLOG, on_peer_connected)) <
       0)
   {
     fail("uv_listen failed: %s", uv_strerror(rc));
   }
+}
+
+void run_server_loop(void *arg)
+{
+  server_loop_t *sl = (server_loop_t *)arg;
+  uv_run(sl->loop, UV_RUN_DEFAULT);
+}
+
+int main(int argc, char **argv)
+{
+  demo.parse(argc, argv, "libuv", WS_DEMO_WORKERS);
+  const WSDemoOptions &options = demo.options();
+  int num_loops = options.num_loops;
+  WSPubSub *pubsub = demo.get_pubsub();
+  process_mode = options.pool_mode ? PROCESS_POOL : PROCESS_INLINE;
+
+  int rc;
+  struct sockaddr_in addr;
+  if ((rc = uv_ip4_addr("0.0.0.0", options.port, &addr)) < 0)
+  {
+    fail("uv_ip4_addr failed: %s", uv_strerror(rc));
+  }
+
+  server_loop_t *loops = (server_loop_t *)xmalloc(num_loops * sizeof(server_loop_t));
+  for (int i = 0; i < num_loops; i++)
+  {
+    if (i == 0)
+    {
+      loops[i].loop = uv_default_loop();
+    }
+    else
+    {
+      if ((rc = uv_loop_init(&loops[i].own_loop)) < 0)
+      {
+        fail("uv_loop_init failed: %s", uv_strerror(rc));
+      }
+      loops[i].loop = &loops[i].own_loop;
+    }
+    loops[i].index = i;
+    loops[i].loop->data = &loops[i];
+    loops[i].recv_pool = new SlabAllocator(RECV_BLOCK_SIZE, RECV_BLOCKS_PER_SLAB);
+    loops[i].work_recv_pool = new LockedSlabAllocator(RECV_BLOCK_SIZE, RECV_BLOCKS_PER_SLAB);
+    loops[i].dirty_peers = NULL;
+    uv_check_init(loops[i].loop, &loops[i].flush_check);
+    loops[i].flush_check.data = &loops[i];
+    uv_check_start(&loops[i].flush_check, on_flush_check);
+    // the listener keeps the loop alive, not the flusher
+    uv_unref((uv_handle_t *)&loops[i].flush_check);
+    loops[i].timers = new WSTimerWheel(KEEPALIVE_TICK_MS, uv_now(loops[i].loop));
+    uv_timer_init(loops[i].loop, &loops[i].tick_timer);
+    loops[i].tick_timer.data = &loops[i];
+    uv_timer_start(&loops[i].tick_timer, on_keepalive_tick, KEEPALIVE_TICK_MS, KEEPALIVE_TICK_MS);
+    uv_unref((uv_handle_t *)&loops[i].tick_timer);
+    if (pubsub != NULL)
+    {
+      uv_async_init(loops[i].loop, &loops[i].pubsub_async, on_pubsub_async);
+      loops[i].pubsub_async.data = &loops[i];
+      uv_unref((uv_handle_t *)&loops[i].pubsub_async);
+      pubsub->set_wakeup(i, wake_pubsub_loop, &loops[i].pubsub_async);
+    }
+    start_listener(&loops[i], &addr);
+  }
 
   //printf("main - main: set thread pool size.\r\n");
-  set_thread_pool_size();
+  set_thread_pool_size(options.num_workers);
+
+#ifdef SIGUSR1
+  // kill -USR1 <pid> dumps the recent log records to stderr
+  uv_signal_t dump_signal;
+  uv_signal_init(uv_default_loop(), &dump_signal);
+  uv_signal_start(&dump_signal, on_dump_log, SIGUSR1);
+  uv_unref((uv_handle_t *)&dump_signal);
+#endif
+
+  for (int i = 1; i < num_loops; i++)
+  {
+    if ((rc = uv_thread_create(&loops[i].thread, run_server_loop, &loops[i])) < 0)
+    {
+      fail("uv_thread_create failed: %s", uv_strerror(rc));
+    }
+  }
+
   // Run the libuv event loop.
   uv_run(uv_default_loop(), UV_RUN_DEFAULT);
 
+  for (int i = 1; i < num_loops; i++)
+  {
+    uv_thread_join(&loops[i].thread);
+    uv_loop_close(loops[i].loop);
+  }
+  free(loops);
+
   // If uv_run returned, close the default loop before exiting.
   return uv_loop_close(uv_default_loop());
 }
@@ -0,0 +1,254 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* the websocket server of main.cpp on WSEpollReactor(ws_epoll_reactor.h),
+* without libuv. it shows how to embed the endpoints in a program with
+* nothing but epoll, and takes the same command line as main.cpp
+* (ws_demo.h):
+*
+* usage: wsfiles_main_epoll [-m inline] [-t loops] [-z] [-d dict] [-b|-p] [-s policy] [-q low,high,max] [-k ping,pong] [-i idle] [port]
+*
+* every read is processed on the loop thread, so -m pool and -w are not
+* supported. each loop thread runs a reactor with its own SO_REUSEPORT
+* listener.
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "ws_demo.h"
+#include "ws_epoll_reactor.h"
+#include "ws_pubsub.h"
+#include "ws_log.h"
+
+void fail(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+#ifdef __linux__
+
+#define DEFAULT_BACKLOG 128
+
+// the command line, and the endpoints of the peers
+static WSDemo demo;
+// SIGUSR1 was caught, loop 0 dumps the log
+static volatile int32_t dump_requested = 0;
+
+class ServerReactor;
+static ServerReactor **reactors = NULL;
+
+void report_peer_connected(int fd)
+{
+  struct sockaddr_storage sa;
+  socklen_t salen = sizeof(sa);
+  char hostbuf[NI_MAXHOST];
+  char portbuf[NI_MAXSERV];
+  if (getpeername(fd, (struct sockaddr *)&sa, &salen) == 0 &&
+      getnameinfo((struct sockaddr *)&sa, salen, hostbuf, NI_MAXHOST, portbuf,
+                  NI_MAXSERV, 0) == 0)
+  {
+    WS_INFO("peer (%s, %s) connected", hostbuf, portbuf);
+  }
+  else
+  {
+    WS_INFO("peer (unknonwn) connected");
+  }
+}
+
+// ------------------------------------------------------------ the loop
+
+// an event loop thread, index is also its pub/sub shard. loop 0 runs on
+// the main thread.
+class ServerReactor : public WSEpollReactor
+{
+public:
+  explicit ServerReactor(int index) : WSEpollReactor(&demo.options().send_limits), index_(index) {}
+  virtual ~ServerReactor() { close_all(); }
+
+  pthread_t thread;
+
+protected:
+  virtual WebSocketEndpoint *on_accept(int fd)
+  {
+    report_peer_connected(fd);
+    // deleted by the reactor on this loop thread
+    return demo.create_endpoint(index_);
+  }
+
+  virtual void on_wakeup()
+  {
+    // another loop published to subscribers of this one, the frames are
+    // written by the flush of this iteration
+    if (demo.get_pubsub() != NULL)
+    {
+      demo.get_pubsub()->dispatch(index_);
+    }
+#ifdef SIGUSR1
+    if (index_ == 0 && ws_atomic_swap(&dump_requested, 0) != 0)
+    {
+      dump_log();
+    }
+#endif
+  }
+
+private:
+#ifdef SIGUSR1
+  void dump_log()
+  {
+    WSSendQueueStats stats;
+    WSSendQueue::get_totals(stats);
+    WS_INFO("send queues: %" PRId64 " bytes in %" PRId64 " frames, dropped %" PRId64
+            " frames(%" PRId64 " bytes), %" PRId64 " overflows, %" PRId64 " pauses",
+            stats.queued_bytes, stats.queued_frames, stats.dropped_frames,
+            stats.dropped_bytes, stats.overflows, stats.pauses);
+    ws_log_dump(stderr);
+  }
+#endif
+
+  int index_;
+};
+
+// wakeup of a pub/sub shard, runs in the publishing thread
+void wake_pubsub_loop(void *data)
+{
+  ((ServerReactor *)data)->wakeup();
+}
+
+#ifdef SIGUSR1
+// kill -USR1 <pid>: an eventfd write is safe in a signal handler
+void on_sigusr1(int signum)
+{
+  (void)signum;
+  ws_atomic_swap(&dump_requested, 1);
+  reactors[0]->wakeup();
+}
+#endif
+
+void *run_server_loop(void *arg)
+{
+  ((ServerReactor *)arg)->run();
+  return NULL;
+}
+
+int open_listener(const struct sockaddr_in *addr)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    fail("socket failed: %s", strerror(errno));
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (demo.options().num_loops > 1)
+  {
+    // every loop binds the same port, the kernel spreads new
+    // connections over the listeners
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+      fail("setsockopt SO_REUSEPORT failed: %s", strerror(errno));
+    }
+  }
+  if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+  {
+    fail("bind failed: %s", strerror(errno));
+  }
+  if (listen(fd, DEFAULT_BACKLOG) < 0)
+  {
+    fail("listen failed: %s", strerror(errno));
+  }
+  return fd;
+}
+
+int main(int argc, char **argv)
+{
+  demo.parse(argc, argv, "epoll", 0);
+  const WSDemoOptions &options = demo.options();
+  int num_loops = options.num_loops;
+  WSPubSub *pubsub = demo.get_pubsub();
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  reactors = new ServerReactor *[num_loops];
+  for (int i = 0; i < num_loops; i++)
+  {
+    reactors[i] = new ServerReactor(i);
+    int rc = reactors[i]->init();
+    if (rc < 0)
+    {
+      fail("reactor init failed: %s", strerror(-rc));
+    }
+    rc = reactors[i]->add_listener(open_listener(&addr));
+    if (rc < 0)
+    {
+      fail("add_listener failed: %s", strerror(-rc));
+    }
+    if (pubsub != NULL)
+    {
+      pubsub->set_wakeup(i, wake_pubsub_loop, reactors[i]);
+    }
+  }
+#ifdef SIGUSR1
+  // kill -USR1 <pid> dumps the recent log records to stderr
+  signal(SIGUSR1, on_sigusr1);
+#endif
+
+  for (int i = 1; i < num_loops; i++)
+  {
+    int rc = pthread_create(&reactors[i]->thread, NULL, run_server_loop, reactors[i]);
+    if (rc != 0)
+    {
+      fail("pthread_create failed: %s", strerror(rc));
+    }
+  }
+  reactors[0]->run();
+  return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+  fail("%s needs linux epoll", argv[0]);
+  return EXIT_FAILURE;
+}
+
+#endif // __linux__
@@ -0,0 +1,1160 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* the websocket server of main.cpp on io_uring(linux 6.0 or later), without
+* libuv. it takes the same command line(ws_demo.h), so the two can be
+* compared:
+*
+* usage: wsfiles_main_uring [-m inline] [-t loops] [-z] [-d dict] [-b|-p] [-s policy] [-q low,high,max] [-k ping,pong] [-i idle] [port]
+*
+* every read is processed on the loop thread, so -m pool and -w are not
+* supported. each loop thread has its own ring and SO_REUSEPORT listener:
+*   - connections come from one multishot accept
+*   - each connection has one multishot recv, which picks its buffers from
+*     a ring of provided buffers of the loop. the data is given to
+*     WebSocketEndpoint::process and the buffer goes back to the ring
+*   - the send queue of a connection is copied to one of the registered
+*     buffers of the loop and written with IORING_OP_WRITE_FIXED, or sent
+*     in place with IORING_OP_SENDMSG when it is larger. a failed peer is
+*     shut down by an IORING_OP_SHUTDOWN once its close frame is written
+*   - all of that is submitted, and completions are waited for, by one
+*     io_uring_enter per loop iteration
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+#include "ws_demo.h"
+#include "ws_endpoint.h"
+#include "ws_pubsub.h"
+#include "ws_send_queue.h"
+#include "ws_timer_wheel.h"
+#include "ws_log.h"
+
+void fail(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+// multishot recv and provided buffer rings came with linux 6.0
+#ifdef IORING_RECV_MULTISHOT
+
+#define DEFAULT_BACKLOG 128
+#define RING_ENTRIES 1024
+// provided receive buffers of a loop: 512 x 16K
+#define RECV_BUF_SIZE (16 * 1024)
+#define RECV_BUF_COUNT 512
+#define RECV_BUF_GROUP 0
+// registered send buffers of a loop: 512 x 16K. a send queue that does
+// not fit in one is sent in place
+#define SEND_SLOT_SIZE (16 * 1024)
+#define SEND_SLOT_COUNT 512
+// most pieces of the send queue given to one sendmsg
+#define PEER_WRITE_MAX_BUFS 256
+// keepalive timers of the peers are rounded to it, also the longest
+// wait for completions
+#define KEEPALIVE_TICK_MS 100
+
+// what a completion is for, in the low bits of its user_data. the rest
+// is the peer or the loop
+enum UringOp
+{
+  OP_ACCEPT = 1,
+  OP_RECV = 2,
+  OP_SEND = 3,
+  OP_CANCEL = 4,
+  OP_SHUTDOWN = 5,
+  OP_WAKEUP = 6,
+  OP_SIGNAL = 7
+};
+#define OP_MASK 7
+
+// the command line, and the endpoints of the peers
+static WSDemo demo;
+
+// the rings of an io_uring, mapped from the kernel
+typedef struct
+{
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  // sqes filled and not given to io_uring_enter yet
+  unsigned to_submit;
+} uring_t;
+
+struct uring_peer_s;
+
+// an event loop thread, its ring and its listener. loop 0 runs on the
+// main thread.
+typedef struct
+{
+  // index in the loops array, also the pub/sub shard of the loop
+  int index;
+  pthread_t thread;
+  uring_t ring;
+  int listen_fd;
+  // provided receive buffers
+  struct io_uring_buf_ring *recv_ring;
+  char *recv_bufs;
+  // registered send buffers and a stack of the free ones
+  char *send_bufs;
+  int free_slots[SEND_SLOT_COUNT];
+  int nfree_slots;
+  // peers given frames since the last flush, written once per iteration
+  struct uring_peer_s *dirty_peers;
+  // woken when another loop publishes to a subscriber of this one
+  int wakeup_fd;
+  uint64_t wakeup_count;
+  // loop 0 only: SIGUSR1
+  int signal_fd;
+  struct signalfd_siginfo siginfo;
+  // keepalive timers of the peers
+  WSTimerWheel *timers;
+} server_loop_t;
+
+// for each connected client
+typedef struct uring_peer_s
+{
+  int fd;
+  server_loop_t *sl;
+  WebSocketEndpoint *endpoint;
+  // frames waiting for the peer, one send at a time takes the front
+  WSSendQueue *sendq;
+  // submitted operations not completed yet, the peer is freed once it is
+  // closed and they are all done
+  int inflight;
+  bool recv_armed;
+  bool sending;
+  // the send in flight: a registered buffer, or pieces of the send queue
+  int send_slot;
+  int64_t send_size;
+  int64_t send_done;
+  struct msghdr msg;
+  struct iovec *iov;
+  unsigned int iov_capacity;
+  // reads stopped above the high watermark of the send queue. what the
+  // recv still brings before it is cancelled is held here unparsed
+  bool read_paused;
+  char *held;
+  int64_t held_size;
+  int64_t held_offset;
+  int64_t held_capacity;
+  // the send queue refused a frame, the peer is failed by peer_flush
+  bool overflow;
+  // failed, shut down once the close frame is written
+  bool closing;
+  bool shutdown_queued;
+  bool shut_down;
+  // shut down, no more reads, writes or timers
+  bool closed;
+  // link of server_loop_t.dirty_peers
+  struct uring_peer_s *next_dirty;
+  // from peer_list_add until the peer is gone
+  bool listed;
+  bool dirty;
+  WSTimer keepalive;
+} uring_peer_t;
+
+void *xmalloc(size_t size)
+{
+  void *ptr = malloc(size);
+  if (!ptr)
+  {
+    fail("malloc failed");
+  }
+  return ptr;
+}
+
+uint64_t now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// ------------------------------------------------------------------ ring
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                       const void *arg, size_t argsz)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+void uring_init(uring_t *ring)
+{
+  struct io_uring_params params;
+  // the loop thread is the only one to submit, and completions are
+  // processed when it waits for them
+  unsigned flags[] = {
+#ifdef IORING_SETUP_DEFER_TASKRUN
+    IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+#endif
+    IORING_SETUP_COOP_TASKRUN,
+    0};
+  int fd = -1;
+  for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]) && fd < 0; i++)
+  {
+    memset(&params, 0, sizeof(params));
+    // many multishot completions may come between two waits
+    params.flags = flags[i] | IORING_SETUP_CQSIZE;
+    params.cq_entries = RING_ENTRIES * 8;
+    fd = sys_io_uring_setup(RING_ENTRIES, &params);
+  }
+  if (fd < 0)
+  {
+    fail("io_uring_setup failed: %s", strerror(errno));
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+  {
+    fail("io_uring of this kernel is too old");
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && cq_size > sq_size)
+  {
+    sq_size = cq_size;
+  }
+  char *sq = (char *)mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_SQ_RING);
+  char *cq = sq;
+  if (sq != MAP_FAILED && !single_mmap)
+  {
+    cq = (char *)mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_CQ_RING);
+  }
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    fail("mmap of io_uring failed: %s", strerror(errno));
+  }
+
+  ring->fd = fd;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->to_submit = 0;
+}
+
+// submit what is queued and wait up to timeout_ms for a completion
+void uring_enter(uring_t *ring, uint32_t timeout_ms)
+{
+  struct __kernel_timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (uint64_t)(uintptr_t)&ts;
+
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  unsigned min_complete = 0;
+  if (timeout_ms > 0)
+  {
+    flags |= IORING_ENTER_GETEVENTS;
+    min_complete = 1;
+  }
+  int rc = sys_io_uring_enter(ring->fd, ring->to_submit, min_complete, flags, &arg, sizeof(arg));
+  if (rc >= 0)
+  {
+    ring->to_submit -= (unsigned)rc < ring->to_submit ? (unsigned)rc : ring->to_submit;
+  }
+  else if (errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+  {
+    fail("io_uring_enter failed: %s", strerror(errno));
+  }
+}
+
+// make room for n sqes, e.g. a linked chain that must be submitted at once
+void uring_reserve(uring_t *ring, unsigned n)
+{
+  while (*ring->sq_tail + n - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > ring->sq_entries)
+  {
+    // full, hand the queue to the kernel without waiting
+    uring_enter(ring, 0);
+  }
+}
+
+// a cleared sqe at the tail of the submission queue
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+  uring_reserve(ring, 1);
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+  return sqe;
+}
+
+void uring_prep(struct io_uring_sqe *sqe, uint8_t opcode, int fd, const void *addr,
+                uint32_t len, void *owner, int op)
+{
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)addr;
+  sqe->len = len;
+  sqe->user_data = (uint64_t)(uintptr_t)owner | (uint64_t)op;
+}
+
+// -------------------------------------------------------------- buffers
+
+// give a receive buffer back to the kernel, seen once the tail is stored
+void recv_buf_recycle(server_loop_t *sl, unsigned short bid, unsigned short *tail)
+{
+  // not recv_ring->bufs: compiled as C++, the flexible array of the
+  // kernel header lands at offset 8 instead of 0
+  struct io_uring_buf *buf = (struct io_uring_buf *)sl->recv_ring + (*tail & (RECV_BUF_COUNT - 1));
+  buf->addr = (uint64_t)(uintptr_t)(sl->recv_bufs + (size_t)bid * RECV_BUF_SIZE);
+  buf->len = RECV_BUF_SIZE;
+  buf->bid = bid;
+  (*tail)++;
+}
+
+void recv_buf_ring_init(server_loop_t *sl)
+{
+  size_t ring_size = RECV_BUF_COUNT * sizeof(struct io_uring_buf);
+  sl->recv_ring = (struct io_uring_buf_ring *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  sl->recv_bufs = (char *)mmap(NULL, (size_t)RECV_BUF_COUNT * RECV_BUF_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (sl->recv_ring == MAP_FAILED || sl->recv_bufs == MAP_FAILED)
+  {
+    fail("mmap failed: %s", strerror(errno));
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)sl->recv_ring;
+  reg.ring_entries = RECV_BUF_COUNT;
+  reg.bgid = RECV_BUF_GROUP;
+  if (sys_io_uring_register(sl->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    fail("registering provided buffers failed: %s", strerror(errno));
+  }
+
+  unsigned short tail = 0;
+  for (unsigned short bid = 0; bid < RECV_BUF_COUNT; bid++)
+  {
+    recv_buf_recycle(sl, bid, &tail);
+  }
+  __atomic_store_n(&sl->recv_ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+void send_bufs_init(server_loop_t *sl)
+{
+  sl->send_bufs = (char *)mmap(NULL, (size_t)SEND_SLOT_COUNT * SEND_SLOT_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (sl->send_bufs == MAP_FAILED)
+  {
+    fail("mmap failed: %s", strerror(errno));
+  }
+  struct iovec *iov = (struct iovec *)xmalloc(SEND_SLOT_COUNT * sizeof(struct iovec));
+  for (int i = 0; i < SEND_SLOT_COUNT; i++)
+  {
+    iov[i].iov_base = sl->send_bufs + (size_t)i * SEND_SLOT_SIZE;
+    iov[i].iov_len = SEND_SLOT_SIZE;
+    sl->free_slots[i] = SEND_SLOT_COUNT - 1 - i;
+  }
+  sl->nfree_slots = SEND_SLOT_COUNT;
+  // pinned once, so a fixed write maps no pages
+  if (sys_io_uring_register(sl->ring.fd, IORING_REGISTER_BUFFERS, iov, SEND_SLOT_COUNT) < 0)
+  {
+    fail("registering send buffers failed: %s", strerror(errno));
+  }
+  free(iov);
+}
+
+// ---------------------------------------------------------------- peers
+
+void peer_flush(uring_peer_t *peer);
+void peer_close(uring_peer_t *peer);
+
+void peer_list_add(server_loop_t *sl, uring_peer_t *peer)
+{
+  peer->listed = true;
+  peer->next_dirty = NULL;
+  peer->dirty = false;
+}
+
+// the peer is gone, no more flushes for it. frames its endpoint still
+// gets until peer_release are freed with its send queue
+void peer_list_remove(server_loop_t *sl, uring_peer_t *peer)
+{
+  if (!peer->listed)
+  {
+    return;
+  }
+  peer->listed = false;
+
+  if (peer->dirty)
+  {
+    uring_peer_t **link = &sl->dirty_peers;
+    while (*link != peer)
+    {
+      link = &(*link)->next_dirty;
+    }
+    *link = peer->next_dirty;
+    peer->dirty = false;
+  }
+}
+
+// the peer is written by the flush at the end of this loop iteration
+void peer_mark_dirty(uring_peer_t *peer)
+{
+  if (!peer->dirty && peer->listed)
+  {
+    peer->dirty = true;
+    peer->next_dirty = peer->sl->dirty_peers;
+    peer->sl->dirty_peers = peer;
+  }
+}
+
+// a frame for the peer was queued, dropped by the slow consumer policy,
+// or refused: the peer is then failed by the next peer_flush
+void peer_queued(uring_peer_t *peer, WSSendResult result)
+{
+  if (result == WS_SEND_OVERFLOW)
+  {
+    peer->overflow = true;
+  }
+  peer_mark_dirty(peer);
+}
+
+// write callback of every endpoint
+void on_write_response(char *buf, int64_t size, void *wd)
+{
+  uring_peer_t *peer = (uring_peer_t *)wd;
+  peer_queued(peer, peer->sendq->push(buf, size));
+}
+
+// frame writer of every endpoint: the queue takes the packed frame's memory
+void on_write_frame(ByteBuffer &frame, void *wd)
+{
+  uring_peer_t *peer = (uring_peer_t *)wd;
+  peer_queued(peer, peer->sendq->push(frame));
+}
+
+// shared writer of every endpoint
+void on_write_shared(WSSharedFrame *frame, void *wd)
+{
+  uring_peer_t *peer = (uring_peer_t *)wd;
+  peer_queued(peer, peer->sendq->push_shared(frame));
+}
+
+void peer_arm_recv(uring_peer_t *peer)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&peer->sl->ring);
+  uring_prep(sqe, IORING_OP_RECV, peer->fd, NULL, 0, peer, OP_RECV);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RECV_BUF_GROUP;
+  peer->recv_armed = true;
+  peer->inflight++;
+}
+
+// stop the multishot recv, what it already received still comes
+void peer_cancel_recv(uring_peer_t *peer)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&peer->sl->ring);
+  uring_prep(sqe, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, peer, OP_CANCEL);
+  sqe->addr = (uint64_t)(uintptr_t)peer | OP_RECV;
+  peer->inflight++;
+}
+
+// free the peer once it is closed and the kernel is done with it
+void peer_release(uring_peer_t *peer)
+{
+  if (!peer->closed || peer->inflight > 0)
+  {
+    return;
+  }
+  close(peer->fd);
+  delete peer->endpoint;
+  delete peer->sendq;
+  free(peer->iov);
+  free(peer->held);
+  free(peer);
+}
+
+void peer_pause_reads(uring_peer_t *peer)
+{
+  if (!peer->read_paused && !peer->closing)
+  {
+    peer->read_paused = true;
+    if (peer->recv_armed)
+    {
+      peer_cancel_recv(peer);
+    }
+  }
+}
+
+// parse what was received, or hold it while the reads are paused
+void peer_received(uring_peer_t *peer, const char *buf, int64_t size)
+{
+  if (peer->read_paused)
+  {
+    if (peer->held_size + size > peer->held_capacity)
+    {
+      int64_t capacity = peer->held_capacity ? peer->held_capacity : RECV_BUF_SIZE;
+      while (capacity < peer->held_size + size)
+      {
+        capacity *= 2;
+      }
+      peer->held = (char *)realloc(peer->held, capacity);
+      if (peer->held == NULL)
+      {
+        fail("realloc failed");
+      }
+      peer->held_capacity = capacity;
+    }
+    memcpy(peer->held + peer->held_size, buf, size);
+    peer->held_size += size;
+    return;
+  }
+
+  int nrc = peer->endpoint->process(buf, (int32_t)size, on_write_response, peer);
+  if (nrc < 0)
+  {
+    WS_WARN("main - process read buf failed with[err:%d].", nrc);
+  }
+  if (peer->sendq->is_paused())
+  {
+    peer_pause_reads(peer);
+  }
+}
+
+// the send queue is down to the low watermark: parse the held data a
+// piece at a time while the queue stays below the high one, then receive
+// again
+void peer_resume_reads(uring_peer_t *peer)
+{
+  peer->read_paused = false;
+  while (peer->held_offset < peer->held_size && !peer->read_paused &&
+         !peer->closing && !peer->closed)
+  {
+    int64_t size = peer->held_size - peer->held_offset;
+    if (size > RECV_BUF_SIZE)
+    {
+      size = RECV_BUF_SIZE;
+    }
+    peer->held_offset += size;
+    peer_received(peer, peer->held + peer->held_offset - size, size);
+  }
+  if (peer->held_offset == peer->held_size)
+  {
+    peer->held_offset = 0;
+    peer->held_size = 0;
+  }
+  if (!peer->read_paused && !peer->recv_armed && !peer->closing && !peer->closed)
+  {
+    peer_arm_recv(peer);
+  }
+}
+
+void peer_send_fixed(uring_peer_t *peer)
+{
+  char *base = peer->sl->send_bufs + (size_t)peer->send_slot * SEND_SLOT_SIZE;
+  struct io_uring_sqe *sqe = uring_get_sqe(&peer->sl->ring);
+  uring_prep(sqe, IORING_OP_WRITE_FIXED, peer->fd, base + peer->send_done,
+             (uint32_t)(peer->send_size - peer->send_done), peer, OP_SEND);
+  sqe->buf_index = (uint16_t)peer->send_slot;
+  // a socket has no file position
+  sqe->off = (uint64_t)-1;
+  peer->sending = true;
+  peer->inflight++;
+}
+
+// send the front of the send queue unless a send is in flight, and stop
+// reading from the peer above the high watermark
+void peer_flush(uring_peer_t *peer)
+{
+  server_loop_t *sl = peer->sl;
+  if (peer->closed)
+  {
+    return;
+  }
+  if (peer->overflow)
+  {
+    // the send queue of a slow consumer went over its limit: drop what
+    // the peer has not got yet, stop reading from it and close it with
+    // 1008 once that is written
+    peer->overflow = false;
+    if (!peer->closing)
+    {
+      WS_WARN("main - slow consumer, %" PRId64 " bytes queued", peer->sendq->queued_bytes());
+      peer->closing = true;
+      peer->sendq->discard();
+      peer->endpoint->send_close(WS_CLOSE_POLICY_VIOLATION);
+      if (peer->recv_armed)
+      {
+        peer_cancel_recv(peer);
+      }
+    }
+  }
+
+  if (!peer->sending && !peer->sendq->empty())
+  {
+    WSSendBuf pieces[PEER_WRITE_MAX_BUFS];
+    int32_t n = peer->sendq->peek(pieces, PEER_WRITE_MAX_BUFS);
+    int64_t size = 0;
+    for (int32_t i = 0; i < n; i++)
+    {
+      size += pieces[i].size;
+    }
+
+    peer->send_size = size;
+    peer->send_done = 0;
+    uring_reserve(&sl->ring, 1);
+    if (size <= SEND_SLOT_SIZE && sl->nfree_slots > 0)
+    {
+      // small frames are copied into a registered buffer, and the queue
+      // is free again at once
+      peer->send_slot = sl->free_slots[--sl->nfree_slots];
+      char *base = sl->send_bufs + (size_t)peer->send_slot * SEND_SLOT_SIZE;
+      for (int32_t i = 0; i < n; i++)
+      {
+        memcpy(base, pieces[i].data, pieces[i].size);
+        base += pieces[i].size;
+      }
+      peer->sendq->consume(size);
+      peer_send_fixed(peer);
+    }
+    else
+    {
+      if ((unsigned int)n > peer->iov_capacity)
+      {
+        unsigned int capacity = peer->iov_capacity ? peer->iov_capacity : 4;
+        while (capacity < (unsigned int)n)
+        {
+          capacity *= 2;
+        }
+        peer->iov = (struct iovec *)realloc(peer->iov, capacity * sizeof(struct iovec));
+        if (peer->iov == NULL)
+        {
+          fail("realloc failed");
+        }
+        peer->iov_capacity = capacity;
+      }
+      for (int32_t i = 0; i < n; i++)
+      {
+        peer->iov[i].iov_base = (void *)pieces[i].data;
+        peer->iov[i].iov_len = (size_t)pieces[i].size;
+      }
+      memset(&peer->msg, 0, sizeof(peer->msg));
+      peer->msg.msg_iov = peer->iov;
+      peer->msg.msg_iovlen = n;
+      peer->send_slot = -1;
+
+      struct io_uring_sqe *sqe = uring_get_sqe(&sl->ring);
+      uring_prep(sqe, IORING_OP_SENDMSG, peer->fd, &peer->msg, 1, peer, OP_SEND);
+      sqe->msg_flags = MSG_NOSIGNAL;
+      peer->sending = true;
+      peer->inflight++;
+    }
+  }
+  else if (peer->closing && !peer->sending && peer->sendq->empty() && !peer->shutdown_queued)
+  {
+    // the close frame is written whole, a short send has been finished
+    // by on_sent. it is not linked to the send, which may be short
+    uring_reserve(&sl->ring, 1);
+    struct io_uring_sqe *sqe = uring_get_sqe(&sl->ring);
+    uring_prep(sqe, IORING_OP_SHUTDOWN, peer->fd, NULL, SHUT_RDWR, peer, OP_SHUTDOWN);
+    peer->shutdown_queued = true;
+    peer->inflight++;
+    return;
+  }
+
+  if (peer->sendq->is_paused())
+  {
+    peer_pause_reads(peer);
+  }
+}
+
+// the peer is gone or timed out, shut it down without a closing
+// handshake. it is freed when its operations have completed
+void peer_close(uring_peer_t *peer)
+{
+  if (peer->closed)
+  {
+    return;
+  }
+  peer->closed = true;
+  peer_list_remove(peer->sl, peer);
+  peer->sl->timers->stop(&peer->keepalive);
+  if (!peer->shut_down)
+  {
+    peer->shut_down = true;
+    // ends the recv and the send in flight
+    shutdown(peer->fd, SHUT_RDWR);
+  }
+}
+
+void on_recv(uring_peer_t *peer, struct io_uring_cqe *cqe, unsigned short *buf_tail)
+{
+  server_loop_t *sl = peer->sl;
+  bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+  if (!more)
+  {
+    peer->recv_armed = false;
+    peer->inflight--;
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+  {
+    unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe->res > 0 && !peer->closed && !peer->closing)
+    {
+      peer_received(peer, sl->recv_bufs + (size_t)bid * RECV_BUF_SIZE, cqe->res);
+    }
+    recv_buf_recycle(sl, bid, buf_tail);
+  }
+
+  if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED))
+  {
+    if (cqe->res < 0)
+    {
+      WS_WARN("Read error: %s", strerror(-cqe->res));
+    }
+    peer_close(peer);
+  }
+  else if (!more && !peer->closed && !peer->closing && !peer->read_paused)
+  {
+    // out of provided buffers, or the kernel ended the multishot
+    peer_arm_recv(peer);
+  }
+}
+
+void on_sent(uring_peer_t *peer, int res)
+{
+  server_loop_t *sl = peer->sl;
+  peer->inflight--;
+  peer->sending = false;
+  if (res < 0)
+  {
+    if (res != -ECANCELED && !peer->closed)
+    {
+      // the peer is gone
+      WS_WARN("main - write error: %s", strerror(-res));
+    }
+    peer_close(peer);
+  }
+  else if (peer->send_slot >= 0)
+  {
+    peer->send_done += res;
+    if (peer->send_done < peer->send_size && !peer->closed)
+    {
+      peer_send_fixed(peer);
+      return;
+    }
+  }
+  else
+  {
+    peer->sendq->consume(res);
+  }
+
+  if (peer->send_slot >= 0)
+  {
+    sl->free_slots[sl->nfree_slots++] = peer->send_slot;
+    peer->send_slot = -1;
+  }
+  if (peer->closed)
+  {
+    return;
+  }
+
+  peer_flush(peer);
+  if (peer->read_paused && !peer->sendq->is_paused() && !peer->closing && !peer->closed)
+  {
+    peer_resume_reads(peer);
+  }
+}
+
+// the keepalive timer of a peer expired. the endpoint pings the peer or
+// times it out
+void on_peer_keepalive(WSTimer *timer, void *data)
+{
+  uring_peer_t *peer = (uring_peer_t *)data;
+  WSTimerWheel *timers = peer->sl->timers;
+  int64_t delay = peer->endpoint->on_keepalive_timer(on_write_response, peer, peer->read_paused);
+  if (delay < 0)
+  {
+    WS_INFO("main - peer timed out");
+    peer_close(peer);
+    peer_release(peer);
+    return;
+  }
+  if (delay > 0)
+  {
+    timers->start(timer, delay);
+  }
+}
+
+// ------------------------------------------------------------ the loop
+
+void report_peer_connected(int fd)
+{
+  struct sockaddr_storage sa;
+  socklen_t salen = sizeof(sa);
+  char hostbuf[NI_MAXHOST];
+  char portbuf[NI_MAXSERV];
+  if (getpeername(fd, (struct sockaddr *)&sa, &salen) == 0 &&
+      getnameinfo((struct sockaddr *)&sa, salen, hostbuf, NI_MAXHOST, portbuf,
+                  NI_MAXSERV, 0) == 0)
+  {
+    WS_INFO("peer (%s, %s) connected", hostbuf, portbuf);
+  }
+  else
+  {
+    WS_INFO("peer (unknonwn) connected");
+  }
+}
+
+void arm_accept(server_loop_t *sl)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&sl->ring);
+  uring_prep(sqe, IORING_OP_ACCEPT, sl->listen_fd, NULL, 0, sl, OP_ACCEPT);
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+// read the eventfd or signalfd of the loop
+void arm_read(server_loop_t *sl, int fd, void *buf, uint32_t len, int op)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&sl->ring);
+  uring_prep(sqe, IORING_OP_READ, fd, buf, len, sl, op);
+}
+
+void on_peer_connected(server_loop_t *sl, int fd)
+{
+  report_peer_connected(fd);
+
+  uring_peer_t *peer = (uring_peer_t *)xmalloc(sizeof(*peer));
+  memset(peer, 0, sizeof(*peer));
+  peer->fd = fd;
+  peer->sl = sl;
+  peer->endpoint = demo.create_endpoint(sl->index);
+  peer->endpoint->set_shared_writer(on_write_shared, peer);
+  peer->endpoint->set_frame_writer(on_write_response, on_write_frame);
+  peer->sendq = new WSSendQueue(&demo.options().send_limits);
+  peer->send_slot = -1;
+  peer_list_add(sl, peer);
+
+  WSTimerWheel::init(&peer->keepalive, on_peer_keepalive, peer);
+  uint32_t delay = peer->endpoint->keepalive_start();
+  if (delay > 0)
+  {
+    sl->timers->start(&peer->keepalive, delay);
+  }
+  peer_arm_recv(peer);
+}
+
+#ifdef SIGUSR1
+void dump_log()
+{
+  WSSendQueueStats stats;
+  WSSendQueue::get_totals(stats);
+  WS_INFO("send queues: %" PRId64 " bytes in %" PRId64 " frames, dropped %" PRId64
+          " frames(%" PRId64 " bytes), %" PRId64 " overflows, %" PRId64 " pauses",
+          stats.queued_bytes, stats.queued_frames, stats.dropped_frames,
+          stats.dropped_bytes, stats.overflows, stats.pauses);
+  ws_log_dump(stderr);
+}
+#endif
+
+void on_completion(server_loop_t *sl, struct io_uring_cqe *cqe, unsigned short *buf_tail)
+{
+  int op = (int)(cqe->user_data & OP_MASK);
+  void *owner = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+  uring_peer_t *peer = (uring_peer_t *)owner;
+  switch (op)
+  {
+  case OP_ACCEPT:
+    if (cqe->res >= 0)
+    {
+      on_peer_connected(sl, cqe->res);
+    }
+    else
+    {
+      WS_WARN("Peer connection error: %s", strerror(-cqe->res));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+      arm_accept(sl);
+    }
+    return;
+  case OP_WAKEUP:
+    // another loop published to subscribers of this one, the frames are
+    // written by the flush of this iteration
+    demo.get_pubsub()->dispatch(sl->index);
+    arm_read(sl, sl->wakeup_fd, &sl->wakeup_count, sizeof(sl->wakeup_count), OP_WAKEUP);
+    return;
+  case OP_SIGNAL:
+#ifdef SIGUSR1
+    dump_log();
+#endif
+    arm_read(sl, sl->signal_fd, &sl->siginfo, sizeof(sl->siginfo), OP_SIGNAL);
+    return;
+  case OP_RECV:
+    on_recv(peer, cqe, buf_tail);
+    break;
+  case OP_SEND:
+    on_sent(peer, cqe->res);
+    break;
+  case OP_CANCEL:
+    peer->inflight--;
+    break;
+  case OP_SHUTDOWN:
+    // the close frame is out
+    peer->inflight--;
+    peer->shut_down = peer->shut_down || cqe->res == 0;
+    peer_close(peer);
+    break;
+  default:
+    fail("unknown io_uring completion %d", op);
+  }
+  peer_release(peer);
+}
+
+// wakeup of a pub/sub shard, runs in the publishing thread
+void wake_pubsub_loop(void *data)
+{
+  uint64_t one = 1;
+  ssize_t rc = write(((server_loop_t *)data)->wakeup_fd, &one, sizeof(one));
+  (void)rc;
+}
+
+void *run_server_loop(void *arg)
+{
+  server_loop_t *sl = (server_loop_t *)arg;
+  uring_t *ring = &sl->ring;
+  // the ring belongs to the thread that sets it up
+  uring_init(ring);
+  recv_buf_ring_init(sl);
+  send_bufs_init(sl);
+  uint64_t now = now_ms();
+  uint64_t next_tick = now + KEEPALIVE_TICK_MS;
+
+  arm_accept(sl);
+  if (demo.get_pubsub() != NULL)
+  {
+    arm_read(sl, sl->wakeup_fd, &sl->wakeup_count, sizeof(sl->wakeup_count), OP_WAKEUP);
+  }
+  if (sl->signal_fd >= 0)
+  {
+    arm_read(sl, sl->signal_fd, &sl->siginfo, sizeof(sl->siginfo), OP_SIGNAL);
+  }
+
+  for (;;)
+  {
+    // every peer given frames in the last iteration is written once
+    while (sl->dirty_peers != NULL)
+    {
+      uring_peer_t *peer = sl->dirty_peers;
+      sl->dirty_peers = peer->next_dirty;
+      peer->dirty = false;
+      peer_flush(peer);
+      peer_release(peer);
+    }
+
+    // one syscall submits the iteration and waits for the next one
+    uring_enter(ring, next_tick > now ? (uint32_t)(next_tick - now) : 1);
+
+    unsigned short buf_tail = sl->recv_ring->tail;
+    unsigned head = *ring->cq_head;
+    for (;;)
+    {
+      unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+      if (head == tail)
+      {
+        break;
+      }
+      for (; head != tail; head++)
+      {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        on_completion(sl, cqe, &buf_tail);
+      }
+      __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    // the receive buffers processed are the kernel's again
+    __atomic_store_n(&sl->recv_ring->tail, buf_tail, __ATOMIC_RELEASE);
+
+    now = now_ms();
+    if (now >= next_tick)
+    {
+      sl->timers->advance(now);
+      next_tick = now + KEEPALIVE_TICK_MS;
+    }
+  }
+  return NULL;
+}
+
+int open_listener(const struct sockaddr_in *addr)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    fail("socket failed: %s", strerror(errno));
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (demo.options().num_loops > 1)
+  {
+    // every loop binds the same port, the kernel spreads new
+    // connections over the listeners
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+      fail("setsockopt SO_REUSEPORT failed: %s", strerror(errno));
+    }
+  }
+  if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+  {
+    fail("bind failed: %s", strerror(errno));
+  }
+  if (listen(fd, DEFAULT_BACKLOG) < 0)
+  {
+    fail("listen failed: %s", strerror(errno));
+  }
+  return fd;
+}
+
+int main(int argc, char **argv)
+{
+  demo.parse(argc, argv, "io_uring", 0);
+  const WSDemoOptions &options = demo.options();
+  int num_loops = options.num_loops;
+  WSPubSub *pubsub = demo.get_pubsub();
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  // a write to a peer that is gone fails instead of killing the process,
+  // and SIGUSR1 is read by loop 0 from a signalfd
+  signal(SIGPIPE, SIG_IGN);
+  sigset_t mask;
+  sigemptyset(&mask);
+#ifdef SIGUSR1
+  sigaddset(&mask, SIGUSR1);
+#endif
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  server_loop_t *loops = (server_loop_t *)xmalloc(num_loops * sizeof(server_loop_t));
+  for (int i = 0; i < num_loops; i++)
+  {
+    server_loop_t *sl = &loops[i];
+    memset(sl, 0, sizeof(*sl));
+    sl->index = i;
+    sl->listen_fd = open_listener(&addr);
+    sl->timers = new WSTimerWheel(KEEPALIVE_TICK_MS, now_ms());
+    sl->wakeup_fd = -1;
+    sl->signal_fd = -1;
+    if (pubsub != NULL)
+    {
+      sl->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+      if (sl->wakeup_fd < 0)
+      {
+        fail("eventfd failed: %s", strerror(errno));
+      }
+      pubsub->set_wakeup(i, wake_pubsub_loop, sl);
+    }
+  }
+#ifdef SIGUSR1
+  // kill -USR1 <pid> dumps the recent log records to stderr
+  loops[0].signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+#endif
+
+  for (int i = 1; i < num_loops; i++)
+  {
+    int rc = pthread_create(&loops[i].thread, NULL, run_server_loop, &loops[i]);
+    if (rc != 0)
+    {
+      fail("pthread_create failed: %s", strerror(rc));
+    }
+  }
+  run_server_loop(&loops[0]);
+  return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+  fail("%s needs the io_uring headers of linux 6.0 or later", argv[0]);
+  return EXIT_FAILURE;
+}
+
+#endif // IORING_RECV_MULTISHOT
@@ -6,6 +6,7 @@
 #define BASE_SHA1_H_
 
 #include <string>
+#include <stdint.h>
 
 namespace SHA1 {
 
@@ -22,6 +23,24 @@ std::string SHA1HashString(const std::string& str);
 void SHA1HashBytes(const unsigned char* data, size_t len,
                                unsigned char* hash);
 
+// Length of the Sec-WebSocket-Accept input: the 24 byte base64 key
+// followed by the 36 byte websocket GUID.
+static const size_t kSHA1AcceptInputLength = 60;
+
+// Computes the SHA-1 hash of exactly kSHA1AcceptInputLength bytes in
+// |data|, in one call and without buffering the input byte by byte.
+void SHA1HashAcceptInput(const unsigned char* data, unsigned char* hash);
+
+// Compresses |nblocks| 64 byte blocks of |data| into |state|. Uses the x86
+// SHA extensions, an SSSE3 message schedule or the portable code,
+// whichever the cpu supports (see sha1_x86.cpp).
+void SHA1ProcessBlocks(uint32_t state[5], const unsigned char* data,
+                       size_t nblocks);
+
+// Portable version of SHA1ProcessBlocks, always available.
+void SHA1ProcessBlocksPortable(uint32_t state[5], const unsigned char* data,
+                               size_t nblocks);
+
 }  // namespace base
 
 #endif  // BASE_SHA1_H_
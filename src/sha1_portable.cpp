@@ -48,14 +48,9 @@ class SecureHashAlgorithm {
   void Pad();
   void Process();
 
-  uint32_t A, B, C, D, E;
-
   uint32_t H[5];
 
-  union {
-    uint32_t W[80];
-    uint8_t M[64];
-  };
+  uint8_t M[64];
 
   uint32_t cursor;
   uint32_t l;
@@ -99,11 +94,6 @@ static inline void swapends(uint32_t* t) {
 const int SecureHashAlgorithm::kDigestSizeBytes = 20;
 
 void SecureHashAlgorithm::Init() {
-  A = 0;
-  B = 0;
-  C = 0;
-  D = 0;
-  E = 0;
   cursor = 0;
   l = 0;
   H[0] = 0x67452301;
@@ -123,12 +113,32 @@ void SecureHashAlgorithm::Final() {
 
 void SecureHashAlgorithm::Update(const void* data, size_t nbytes) {
   const uint8_t* d = reinterpret_cast<const uint8_t*>(data);
-  while (nbytes--) {
-    M[cursor++] = *d++;
-    if (cursor >= 64)
-      Process();
-    l += 8;
+  l += (uint32_t)(nbytes * 8);
+
+  // complete a partial block first
+  if (cursor > 0) {
+    size_t n = 64 - cursor;
+    if (n > nbytes)
+      n = nbytes;
+    memcpy(M + cursor, d, n);
+    cursor += n;
+    d += n;
+    nbytes -= n;
+    if (cursor < 64)
+      return;
+    Process();
+  }
+
+  // whole blocks are hashed straight from the input
+  size_t nblocks = nbytes / 64;
+  if (nblocks > 0) {
+    SHA1ProcessBlocks(H, d, nblocks);
+    d += nblocks * 64;
+    nbytes -= nblocks * 64;
   }
+
+  memcpy(M, d, nbytes);
+  cursor = nbytes;
 }
 
 void SecureHashAlgorithm::Pad() {
@@ -152,48 +162,55 @@ void SecureHashAlgorithm::Pad() {
 }
 
 void SecureHashAlgorithm::Process() {
-  uint32_t t;
-
-  // Each a...e corresponds to a section in the FIPS 180-3 algorithm.
-
-  // a.
-  //
-  // W and M are in a union, so no need to memcpy.
-  // memcpy(W, M, sizeof(M));
-  for (t = 0; t < 16; ++t)
-    swapends(&W[t]);
-
-  // b.
-  for (t = 16; t < 80; ++t)
-    W[t] = S(1, W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16]);
-
-  // c.
-  A = H[0];
-  B = H[1];
-  C = H[2];
-  D = H[3];
-  E = H[4];
-
-  // d.
-  for (t = 0; t < 80; ++t) {
-    uint32_t TEMP = S(5, A) + f(t, B, C, D) + E + W[t] + K(t);
-    E = D;
-    D = C;
-    C = S(30, B);
-    B = A;
-    A = TEMP;
-  }
-
-  // e.
-  H[0] += A;
-  H[1] += B;
-  H[2] += C;
-  H[3] += D;
-  H[4] += E;
-
+  SHA1ProcessBlocks(H, M, 1);
   cursor = 0;
 }
 
+void SHA1ProcessBlocksPortable(uint32_t state[5], const unsigned char* data,
+                               size_t nblocks) {
+  uint32_t W[80];
+
+  for (; nblocks > 0; --nblocks, data += 64) {
+    uint32_t t;
+
+    // Each a...e corresponds to a section in the FIPS 180-3 algorithm.
+
+    // a.
+    for (t = 0; t < 16; ++t) {
+      W[t] = ((uint32_t)data[4 * t] << 24) | ((uint32_t)data[4 * t + 1] << 16) |
+             ((uint32_t)data[4 * t + 2] << 8) | (uint32_t)data[4 * t + 3];
+    }
+
+    // b.
+    for (t = 16; t < 80; ++t)
+      W[t] = S(1, W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16]);
+
+    // c.
+    uint32_t A = state[0];
+    uint32_t B = state[1];
+    uint32_t C = state[2];
+    uint32_t D = state[3];
+    uint32_t E = state[4];
+
+    // d.
+    for (t = 0; t < 80; ++t) {
+      uint32_t TEMP = S(5, A) + f(t, B, C, D) + E + W[t] + K(t);
+      E = D;
+      D = C;
+      C = S(30, B);
+      B = A;
+      A = TEMP;
+    }
+
+    // e.
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+  }
+}
+
 std::string SHA1HashString(const std::string& str) {
   char hash[SecureHashAlgorithm::kDigestSizeBytes];
   SHA1HashBytes(reinterpret_cast<const unsigned char*>(str.c_str()),
@@ -210,4 +227,27 @@ void SHA1HashBytes(const unsigned char* data, size_t len,
   memcpy(hash, sha.Digest(), SecureHashAlgorithm::kDigestSizeBytes);
 }
 
+void SHA1HashAcceptInput(const unsigned char* data, unsigned char* hash) {
+  // the input, 0x80, zeros, then the bit length(480) in the last 8 bytes
+  // of the second block
+  unsigned char blocks[128];
+  memcpy(blocks, data, kSHA1AcceptInputLength);
+  memset(blocks + kSHA1AcceptInputLength, 0,
+         sizeof(blocks) - kSHA1AcceptInputLength);
+  blocks[kSHA1AcceptInputLength] = 0x80;
+  blocks[126] = (kSHA1AcceptInputLength * 8) >> 8;
+  blocks[127] = (kSHA1AcceptInputLength * 8) & 0xff;
+
+  uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                       0xc3d2e1f0};
+  SHA1ProcessBlocks(state, blocks, 2);
+
+  for (int t = 0; t < 5; ++t) {
+    hash[4 * t] = (unsigned char)(state[t] >> 24);
+    hash[4 * t + 1] = (unsigned char)(state[t] >> 16);
+    hash[4 * t + 2] = (unsigned char)(state[t] >> 8);
+    hash[4 * t + 3] = (unsigned char)state[t];
+  }
+}
+
 }  // namespace base
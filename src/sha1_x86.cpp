@@ -0,0 +1,260 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* SHA-1 block compression with x86 SHA extensions or an SSSE3 message
+* schedule, picked at runtime. other cpus use SHA1ProcessBlocksPortable.
+*/
+
+#include "sha1.h"
+#include "ws_cpu.h"
+
+#if defined(WS_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+namespace SHA1 {
+
+typedef void (*process_blocks_func)(uint32_t state[5], const unsigned char *data,
+                                    size_t nblocks);
+
+#if defined(WS_ARCH_X86)
+
+static inline uint32_t rol(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+// SSSE3: the message schedule of a block is computed 4 words at a time
+// and K is added in the same pass, the rounds stay scalar.
+WS_TARGET("ssse3")
+static void process_blocks_ssse3(uint32_t state[5], const unsigned char *data,
+                                 size_t nblocks)
+{
+    const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const __m128i k[4] = {_mm_set1_epi32(0x5a827999), _mm_set1_epi32(0x6ed9eba1),
+                          _mm_set1_epi32((int)0x8f1bbcdc), _mm_set1_epi32((int)0xca62c1d6)};
+    union
+    {
+        __m128i v[20];
+        uint32_t u[80];
+    } w;
+    union
+    {
+        __m128i v[20];
+        uint32_t u[80];
+    } wk;
+
+    for (; nblocks > 0; --nblocks, data += 64)
+    {
+        int t;
+        for (t = 0; t < 4; t++)
+        {
+            w.v[t] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * t)), bswap);
+        }
+
+        // W[t] = rol1(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]). lane 3 needs
+        // W[t] from lane 0 of the same vector, so it is fixed up after.
+        for (t = 16; t < 32; t += 4)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(w.u + t - 16)),
+                                      _mm_loadu_si128((const __m128i *)(w.u + t - 14)));
+            x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)(w.u + t - 8)));
+            // W[t-3], W[t-2], W[t-1], 0
+            x = _mm_xor_si128(x, _mm_srli_si128(_mm_loadu_si128((const __m128i *)(w.u + t - 4)), 4));
+            __m128i r = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31));
+            __m128i l0 = _mm_slli_si128(r, 12);
+            r = _mm_xor_si128(r, _mm_or_si128(_mm_slli_epi32(l0, 1), _mm_srli_epi32(l0, 31)));
+            w.v[t / 4] = r;
+        }
+
+        // from t = 32 on the equivalent W[t] = rol2(W[t-6] ^ W[t-16] ^
+        // W[t-28] ^ W[t-32]) has no dependency inside a vector
+        for (t = 32; t < 80; t += 4)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(w.u + t - 6)),
+                                      w.v[(t - 16) / 4]);
+            x = _mm_xor_si128(x, w.v[(t - 28) / 4]);
+            x = _mm_xor_si128(x, w.v[(t - 32) / 4]);
+            w.v[t / 4] = _mm_or_si128(_mm_slli_epi32(x, 2), _mm_srli_epi32(x, 30));
+        }
+
+        for (t = 0; t < 20; t++)
+        {
+            wk.v[t] = _mm_add_epi32(w.v[t], k[t / 5]);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t tmp;
+
+        for (t = 0; t < 20; t++)
+        {
+            tmp = rol(a, 5) + (d ^ (b & (c ^ d))) + e + wk.u[t];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = tmp;
+        }
+        for (; t < 40; t++)
+        {
+            tmp = rol(a, 5) + (b ^ c ^ d) + e + wk.u[t];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = tmp;
+        }
+        for (; t < 60; t++)
+        {
+            tmp = rol(a, 5) + ((b & c) | (d & (b | c))) + e + wk.u[t];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = tmp;
+        }
+        for (; t < 80; t++)
+        {
+            tmp = rol(a, 5) + (b ^ c ^ d) + e + wk.u[t];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = tmp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+// four rounds: e_in collects E and the message words, e_out keeps ABCD
+// for the next four rounds
+#define SHA1_ROUNDS4(e_in, e_out, msg, func)         \
+    e_in = _mm_sha1nexte_epu32(e_in, msg);           \
+    e_out = abcd;                                    \
+    abcd = _mm_sha1rnds4_epu32(abcd, e_in, func);
+
+// four rounds with msg, and the schedule of the next messages
+#define SHA1_ROUNDS4_MSG(e_in, e_out, msg, next1, next2, next3, func) \
+    SHA1_ROUNDS4(e_in, e_out, msg, func)                              \
+    next1 = _mm_sha1msg2_epu32(next1, msg);                           \
+    next3 = _mm_sha1msg1_epu32(next3, msg);                           \
+    next2 = _mm_xor_si128(next2, msg);
+
+// SHA extensions: 4 rounds per sha1rnds4, the schedule by sha1msg1/sha1msg2
+WS_TARGET("sha,sse4.1")
+static void process_blocks_shani(uint32_t state[5], const unsigned char *data,
+                                 size_t nblocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+    __m128i e1, m0, m1, m2, m3;
+
+    for (; nblocks > 0; --nblocks, data += 64)
+    {
+        __m128i abcd_save = abcd;
+        __m128i e_save = e0;
+
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), bswap);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+        // rounds 0-15
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        SHA1_ROUNDS4(e1, e0, m1, 0)
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+        SHA1_ROUNDS4(e0, e1, m2, 0)
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+        SHA1_ROUNDS4_MSG(e1, e0, m3, m0, m1, m2, 0)
+
+        // rounds 16-67
+        SHA1_ROUNDS4_MSG(e0, e1, m0, m1, m2, m3, 0)
+        SHA1_ROUNDS4_MSG(e1, e0, m1, m2, m3, m0, 1)
+        SHA1_ROUNDS4_MSG(e0, e1, m2, m3, m0, m1, 1)
+        SHA1_ROUNDS4_MSG(e1, e0, m3, m0, m1, m2, 1)
+        SHA1_ROUNDS4_MSG(e0, e1, m0, m1, m2, m3, 1)
+        SHA1_ROUNDS4_MSG(e1, e0, m1, m2, m3, m0, 1)
+        SHA1_ROUNDS4_MSG(e0, e1, m2, m3, m0, m1, 2)
+        SHA1_ROUNDS4_MSG(e1, e0, m3, m0, m1, m2, 2)
+        SHA1_ROUNDS4_MSG(e0, e1, m0, m1, m2, m3, 2)
+        SHA1_ROUNDS4_MSG(e1, e0, m1, m2, m3, m0, 2)
+        SHA1_ROUNDS4_MSG(e0, e1, m2, m3, m0, m1, 2)
+        SHA1_ROUNDS4_MSG(e1, e0, m3, m0, m1, m2, 3)
+        SHA1_ROUNDS4_MSG(e0, e1, m0, m1, m2, m3, 3)
+
+        // rounds 68-79, the schedule winds down
+        SHA1_ROUNDS4(e1, e0, m1, 3)
+        m2 = _mm_sha1msg2_epu32(m2, m1);
+        m3 = _mm_xor_si128(m3, m1);
+        SHA1_ROUNDS4(e0, e1, m2, 3)
+        m3 = _mm_sha1msg2_epu32(m3, m2);
+        SHA1_ROUNDS4(e1, e0, m3, 3)
+
+        e0 = _mm_sha1nexte_epu32(e0, e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1_ROUNDS4_MSG
+#undef SHA1_ROUNDS4
+
+#endif
+
+static process_blocks_func select_process_blocks()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_SHA | WS_CPU_SSE41 | WS_CPU_SSSE3))
+    {
+        return process_blocks_shani;
+    }
+    if (ws_cpu_has(WS_CPU_SSSE3))
+    {
+        return process_blocks_ssse3;
+    }
+#endif
+    return SHA1ProcessBlocksPortable;
+}
+
+void SHA1ProcessBlocks(uint32_t state[5], const unsigned char *data, size_t nblocks)
+{
+    static process_blocks_func func = select_process_blocks();
+    func(state, data, nblocks);
+}
+
+} // namespace SHA1
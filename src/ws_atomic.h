@@ -0,0 +1,130 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* minimal atomic helpers, so the library does not need c++11
+*/
+
+#ifndef _WS_ATOMIC_H_
+#define _WS_ATOMIC_H_
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define WS_THREAD_LOCAL __declspec(thread)
+#else
+#define WS_THREAD_LOCAL __thread
+#endif
+
+// add v to *p and return the new value
+inline int64_t ws_atomic_add(volatile int64_t *p, int64_t v)
+{
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd64((volatile __int64 *)p, v) + v;
+#else
+    return __sync_add_and_fetch(p, v);
+#endif
+}
+
+inline int32_t ws_atomic_add(volatile int32_t *p, int32_t v)
+{
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd((volatile long *)p, v) + v;
+#else
+    return __sync_add_and_fetch(p, v);
+#endif
+}
+
+// if *p equals expected, store desired. return the value *p had, the
+// store happened if it is expected. a full barrier like ws_atomic_add.
+inline int32_t ws_atomic_cas(volatile int32_t *p, int32_t expected, int32_t desired)
+{
+#if defined(_MSC_VER)
+    return _InterlockedCompareExchange((volatile long *)p, desired, expected);
+#else
+    return __sync_val_compare_and_swap(p, expected, desired);
+#endif
+}
+
+template <typename T>
+inline T *ws_atomic_cas(T *volatile *p, T *expected, T *desired)
+{
+#if defined(_MSC_VER)
+    return (T *)_InterlockedCompareExchangePointer((void *volatile *)p, desired, expected);
+#else
+    return __sync_val_compare_and_swap(p, expected, desired);
+#endif
+}
+
+// store v to *p and return the value it had, with a full barrier.
+// __sync_lock_test_and_set is only an acquire barrier, so gcc loops on cas.
+inline int32_t ws_atomic_swap(volatile int32_t *p, int32_t v)
+{
+#if defined(_MSC_VER)
+    return _InterlockedExchange((volatile long *)p, v);
+#else
+    int32_t old = *p;
+    int32_t seen;
+    while ((seen = __sync_val_compare_and_swap(p, old, v)) != old)
+    {
+        old = seen;
+    }
+    return old;
+#endif
+}
+
+template <typename T>
+inline T *ws_atomic_swap(T *volatile *p, T *v)
+{
+#if defined(_MSC_VER)
+    return (T *)_InterlockedExchangePointer((void *volatile *)p, v);
+#else
+    T *old = *p;
+    T *seen;
+    while ((seen = __sync_val_compare_and_swap(p, old, v)) != old)
+    {
+        old = seen;
+    }
+    return old;
+#endif
+}
+
+// full memory barrier
+inline void ws_atomic_fence()
+{
+#if defined(_MSC_VER)
+    // interlocked operations are full barriers
+    static volatile long fence = 0;
+    _InterlockedOr(&fence, 0);
+#else
+    __sync_synchronize();
+#endif
+}
+
+// read *p with a full barrier
+inline int64_t ws_atomic_load(volatile int64_t *p)
+{
+    return ws_atomic_add(p, 0);
+}
+
+#endif //_WS_ATOMIC_H_
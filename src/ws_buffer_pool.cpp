@@ -0,0 +1,258 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include "ws_atomic.h"
+#include "ws_buffer_pool.h"
+
+/*
+*  HeapAllocator
+*
+*/
+char *HeapAllocator::allocate(int size, int *capacity)
+{
+    char *block = (char *)malloc(size);
+    *capacity = (block == NULL) ? 0 : size;
+    return block;
+}
+
+void HeapAllocator::deallocate(char *block, int capacity)
+{
+    free(block);
+}
+
+HeapAllocator *HeapAllocator::instance()
+{
+    static HeapAllocator allocator;
+    return &allocator;
+}
+
+/*
+*  BufferPool
+*
+*/
+static const int class_size_[BufferPool::SizeClass_Count] = {4 * 1024, 64 * 1024, 1024 * 1024};
+// at most 1M, 4M and 8M cached per thread
+static const int class_limit_[BufferPool::SizeClass_Count] = {256, 64, 8};
+
+// a free block keeps the link to the next one in its first bytes
+struct FreeBlock
+{
+    FreeBlock *next;
+};
+
+struct FreeList
+{
+    FreeBlock *head;
+    int count;
+};
+
+static WS_THREAD_LOCAL FreeList free_lists_[BufferPool::SizeClass_Count];
+
+static volatile int64_t sys_allocs_ = 0;
+static volatile int64_t sys_frees_ = 0;
+static volatile int64_t pool_hits_ = 0;
+static volatile int64_t pool_puts_ = 0;
+
+static int size_class(int size)
+{
+    for (int i = 0; i < BufferPool::SizeClass_Count; i++)
+    {
+        if (size <= class_size_[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+char *BufferPool::allocate(int size, int *capacity)
+{
+    int sc = size_class(size);
+    if (sc < 0)
+    {
+        ws_atomic_add(&sys_allocs_, 1);
+        return HeapAllocator::instance()->allocate(size, capacity);
+    }
+
+    FreeList &list = free_lists_[sc];
+    if (list.head != NULL)
+    {
+        FreeBlock *block = list.head;
+        list.head = block->next;
+        list.count--;
+        ws_atomic_add(&pool_hits_, 1);
+        *capacity = class_size_[sc];
+        return (char *)block;
+    }
+
+    ws_atomic_add(&sys_allocs_, 1);
+    char *block = (char *)malloc(class_size_[sc]);
+    *capacity = (block == NULL) ? 0 : class_size_[sc];
+    return block;
+}
+
+void BufferPool::deallocate(char *block, int capacity)
+{
+    if (block == NULL)
+    {
+        return;
+    }
+
+    // only exact class sizes come from the free lists
+    int sc = size_class(capacity);
+    if (sc >= 0 && class_size_[sc] == capacity && free_lists_[sc].count < class_limit_[sc])
+    {
+        FreeList &list = free_lists_[sc];
+        FreeBlock *free_block = (FreeBlock *)block;
+        free_block->next = list.head;
+        list.head = free_block;
+        list.count++;
+        ws_atomic_add(&pool_puts_, 1);
+        return;
+    }
+
+    ws_atomic_add(&sys_frees_, 1);
+    free(block);
+}
+
+BufferPool *BufferPool::instance()
+{
+    static BufferPool pool;
+    return &pool;
+}
+
+void BufferPool::get_stats(BufferPoolStats &stats)
+{
+    stats.sys_allocs = ws_atomic_load(&sys_allocs_);
+    stats.sys_frees = ws_atomic_load(&sys_frees_);
+    stats.pool_hits = ws_atomic_load(&pool_hits_);
+    stats.pool_puts = ws_atomic_load(&pool_puts_);
+}
+
+void BufferPool::trim()
+{
+    for (int i = 0; i < SizeClass_Count; i++)
+    {
+        FreeList &list = free_lists_[i];
+        while (list.head != NULL)
+        {
+            FreeBlock *block = list.head;
+            list.head = block->next;
+            free(block);
+            ws_atomic_add(&sys_frees_, 1);
+        }
+        list.count = 0;
+    }
+}
+
+/*
+*  SlabAllocator
+*
+*/
+SlabAllocator::SlabAllocator(int block_size, int blocks_per_slab)
+{
+    // a free block keeps the link to the next one in its first bytes
+    block_size_ = (block_size < (int)sizeof(Block)) ? (int)sizeof(Block) : block_size;
+    blocks_per_slab_ = (blocks_per_slab < 1) ? 1 : blocks_per_slab;
+    slabs_ = NULL;
+    free_list_ = NULL;
+    blocks_in_use_ = 0;
+    slab_count_ = 0;
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    while (slabs_ != NULL)
+    {
+        Slab *slab = slabs_;
+        slabs_ = slab->next;
+        free(slab);
+    }
+}
+
+bool SlabAllocator::add_slab()
+{
+    // the slab header sits before the first block, blocks stay aligned
+    // as long as the block size is
+    const size_t header = 64;
+    char *mem = (char *)malloc(header + (size_t)block_size_ * blocks_per_slab_);
+    if (mem == NULL)
+    {
+        return false;
+    }
+
+    Slab *slab = (Slab *)mem;
+    slab->next = slabs_;
+    slabs_ = slab;
+    slab_count_++;
+
+    // link the blocks so that the lowest address is handed out first
+    char *first = mem + header;
+    for (int i = blocks_per_slab_ - 1; i >= 0; i--)
+    {
+        Block *block = (Block *)(first + (size_t)block_size_ * i);
+        block->next = free_list_;
+        free_list_ = block;
+    }
+    return true;
+}
+
+char *SlabAllocator::allocate(int size, int *capacity)
+{
+    if (size > block_size_)
+    {
+        return HeapAllocator::instance()->allocate(size, capacity);
+    }
+
+    if (free_list_ == NULL && !add_slab())
+    {
+        *capacity = 0;
+        return NULL;
+    }
+
+    Block *block = free_list_;
+    free_list_ = block->next;
+    blocks_in_use_++;
+    *capacity = block_size_;
+    return (char *)block;
+}
+
+void SlabAllocator::deallocate(char *block, int capacity)
+{
+    if (block == NULL)
+    {
+        return;
+    }
+
+    // larger blocks came from malloc
+    if (capacity != block_size_)
+    {
+        HeapAllocator::instance()->deallocate(block, capacity);
+        return;
+    }
+
+    Block *free_block = (Block *)block;
+    free_block->next = free_list_;
+    free_list_ = free_block;
+    blocks_in_use_--;
+}
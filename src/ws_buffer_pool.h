@@ -0,0 +1,172 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* memory for ByteBuffer: an allocator interface and a size class pool
+*/
+
+#ifndef _WS_BUFFER_POOL_H_
+#define _WS_BUFFER_POOL_H_
+
+#include <stdint.h>
+
+/**
+* where a ByteBuffer gets its memory from
+*/
+class BufferAllocator
+{
+public:
+    virtual ~BufferAllocator() {}
+
+public:
+    /**
+	* allocate at least size bytes.
+	* @param capacity receives the usable size of the block
+	* @return the block, NULL if out of memory
+	*/
+    virtual char *allocate(int size, int *capacity) = 0;
+    /**
+	* give back a block got from allocate()
+	* @param capacity the usable size allocate() reported
+	*/
+    virtual void deallocate(char *block, int capacity) = 0;
+};
+
+/**
+* memory handed over by ByteBuffer::detach, given back with
+* allocator->deallocate(memory, capacity)
+*/
+struct BufferBlock
+{
+    char *memory;
+    int capacity;
+    BufferAllocator *allocator;
+};
+
+/**
+* plain malloc/free
+*/
+class HeapAllocator : public BufferAllocator
+{
+public:
+    virtual char *allocate(int size, int *capacity);
+    virtual void deallocate(char *block, int capacity);
+
+    static HeapAllocator *instance();
+};
+
+struct BufferPoolStats
+{
+    // blocks the pool got from / gave back to malloc
+    int64_t sys_allocs;
+    int64_t sys_frees;
+    // allocations served from / blocks put back to a free list
+    int64_t pool_hits;
+    int64_t pool_puts;
+};
+
+/**
+* a size class pool: requests are rounded up to 4K, 64K or 1M and served
+* from free lists kept per thread, so no lock is taken. larger requests go
+* to malloc directly. each free list keeps a bounded number of blocks.
+* @remark blocks freed by another thread than the one that allocated them
+*       simply move to that thread's free list.
+*/
+class BufferPool : public BufferAllocator
+{
+public:
+    enum
+    {
+        SizeClass_4K = 0,
+        SizeClass_64K,
+        SizeClass_1M,
+        SizeClass_Count,
+    };
+
+public:
+    virtual char *allocate(int size, int *capacity);
+    virtual void deallocate(char *block, int capacity);
+
+    // the pool ByteBuffer uses by default
+    static BufferPool *instance();
+
+    /**
+	* get the counters of all threads. 
+	* steady traffic is malloc free when sys_allocs stops moving.
+	*/
+    static void get_stats(BufferPoolStats &stats);
+
+    /**
+	* free the blocks cached by the calling thread, e.g. before it exits
+	*/
+    static void trim();
+};
+
+/**
+* fixed size blocks carved from large slabs, e.g. the receive buffers of
+* an event loop. blocks are kept on a free list and slabs are only freed
+* with the allocator, so a steady load never calls malloc.
+* requests larger than the block size go to malloc.
+* @remark not thread safe: allocate and deallocate from one thread only.
+*       all blocks must be given back before the allocator is destroyed.
+*/
+class SlabAllocator : public BufferAllocator
+{
+public:
+    SlabAllocator(int block_size, int blocks_per_slab);
+    virtual ~SlabAllocator();
+
+public:
+    virtual char *allocate(int size, int *capacity);
+    virtual void deallocate(char *block, int capacity);
+
+    int block_size() { return block_size_; }
+    // blocks handed out and not given back yet
+    int64_t blocks_in_use() { return blocks_in_use_; }
+    int64_t slab_count() { return slab_count_; }
+
+private:
+    SlabAllocator(const SlabAllocator &);
+    SlabAllocator &operator=(const SlabAllocator &);
+
+    // carve a new slab into the free list
+    bool add_slab();
+
+private:
+    struct Slab
+    {
+        Slab *next;
+    };
+    struct Block
+    {
+        Block *next;
+    };
+
+    int block_size_;
+    int blocks_per_slab_;
+    Slab *slabs_;
+    Block *free_list_;
+    int64_t blocks_in_use_;
+    int64_t slab_count_;
+};
+
+#endif //_WS_BUFFER_POOL_H_
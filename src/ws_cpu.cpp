@@ -0,0 +1,135 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include "ws_cpu.h"
+
+#if defined(WS_ARCH_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(WS_ARCH_X86)
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    regs[0] = r[0];
+    regs[1] = r[1];
+    regs[2] = r[2];
+    regs[3] = r[3];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax = 0, edx = 0;
+    __asm__ __volatile__("xgetbv"
+                         : "=a"(eax), "=d"(edx)
+                         : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static uint32_t detect_features()
+{
+    uint32_t features = 0;
+    uint32_t regs[4] = {0};
+
+    cpuid(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+    if (max_leaf < 1)
+    {
+        return 0;
+    }
+
+    cpuid(1, 0, regs);
+    if (regs[3] & (1u << 26))
+    {
+        features |= WS_CPU_SSE2;
+    }
+    if (regs[2] & (1u << 9))
+    {
+        features |= WS_CPU_SSSE3;
+    }
+    if (regs[2] & (1u << 19))
+    {
+        features |= WS_CPU_SSE41;
+    }
+
+    // avx registers are only usable if the os saves them on context switch
+    bool os_avx = false;
+    if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28)))
+    {
+        os_avx = (xgetbv0() & 0x6) == 0x6;
+    }
+
+    if (max_leaf >= 7)
+    {
+        cpuid(7, 0, regs);
+        if (os_avx && (regs[1] & (1u << 5)))
+        {
+            features |= WS_CPU_AVX2;
+        }
+        if (regs[1] & (1u << 29))
+        {
+            features |= WS_CPU_SHA;
+        }
+    }
+
+    return features;
+}
+#else
+static uint32_t detect_features()
+{
+    return 0;
+}
+#endif
+
+static volatile int32_t cpu_features_ = -1;
+
+uint32_t ws_cpu_features()
+{
+    int32_t features = cpu_features_;
+    if (features < 0)
+    {
+        // every thread computes the same value, so racing here is harmless
+        features = (int32_t)detect_features();
+        const char *val = getenv("WSFILES_CPU_MASK");
+        if (val != NULL)
+        {
+            features &= (int32_t)strtoul(val, NULL, 16);
+        }
+        cpu_features_ = features;
+    }
+    return (uint32_t)features;
+}
@@ -0,0 +1,69 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* runtime cpu feature detection used to pick simd kernels
+*/
+
+#ifndef _WS_CPU_H_
+#define _WS_CPU_H_
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WS_ARCH_X86 1
+#endif
+
+// compile a single function for an instruction set the rest of the file
+// is not built for. msvc does not need it to emit intrinsics.
+#if defined(__GNUC__) || defined(__clang__)
+#define WS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define WS_TARGET(isa)
+#endif
+
+enum WSCpuFeature
+{
+    WS_CPU_SSE2 = 1 << 0,
+    WS_CPU_SSSE3 = 1 << 1,
+    WS_CPU_SSE41 = 1 << 2,
+    WS_CPU_AVX2 = 1 << 3,
+    WS_CPU_SHA = 1 << 4,
+};
+
+/**
+* get the features supported by both the cpu and the os.
+* @remark the result is detected once and cached.
+*   set WSFILES_CPU_MASK (a hex bit mask of WSCpuFeature) in the environment
+*   to hide features, e.g. WSFILES_CPU_MASK=0 forces the portable code.
+*/
+uint32_t ws_cpu_features();
+
+/**
+* check if all bits of feature are supported
+*/
+inline bool ws_cpu_has(uint32_t feature)
+{
+    return (ws_cpu_features() & feature) == feature;
+}
+
+#endif //_WS_CPU_H_
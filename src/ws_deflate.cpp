@@ -0,0 +1,891 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+#include "ws_atomic.h"
+#include "ws_deflate.h"
+#include "ws_log.h"
+#include "ws_packet.h"
+
+// a zlib stream and what it was initialized with, so the pool can hand
+// it out again for the same settings
+struct WSDeflateStream
+{
+    z_stream strm;
+    bool compress;
+    int window_bits;
+    int level;
+    int mem_level;
+    WSDeflateStream *next;
+};
+
+// idle streams cached per thread and direction
+static const int max_idle_streams_ = 4;
+
+struct StreamList
+{
+    WSDeflateStream *head;
+    int count;
+};
+
+static WS_THREAD_LOCAL StreamList idle_streams_[2];
+
+static volatile int64_t streams_created_ = 0;
+static volatile int64_t streams_freed_ = 0;
+static volatile int64_t context_streams_ = 0;
+static volatile int64_t dictionary_serial_ = 0;
+
+// the 4 bytes a sync flush ends with, they are not sent (RFC7692 7.2.1)
+static const unsigned char deflate_tail_[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+static void free_stream(WSDeflateStream *s)
+{
+    if (s->compress)
+    {
+        deflateEnd(&s->strm);
+    }
+    else
+    {
+        inflateEnd(&s->strm);
+    }
+    free(s);
+    ws_atomic_add(&streams_freed_, 1);
+}
+
+static WSDeflateStream *get_stream(bool compress, int window_bits, int level, int mem_level)
+{
+    // an inflater is reset to any window size, a deflater is not
+    StreamList &list = idle_streams_[compress ? 1 : 0];
+    WSDeflateStream **link = &list.head;
+    for (WSDeflateStream *s = list.head; s != NULL; link = &s->next, s = s->next)
+    {
+        if (!compress || (s->window_bits == window_bits && s->level == level &&
+                          s->mem_level == mem_level))
+        {
+            *link = s->next;
+            list.count--;
+            s->next = NULL;
+            if (!compress && s->window_bits != window_bits)
+            {
+                inflateReset2(&s->strm, -window_bits);
+                s->window_bits = window_bits;
+            }
+            return s;
+        }
+    }
+
+    WSDeflateStream *s = (WSDeflateStream *)calloc(1, sizeof(WSDeflateStream));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->compress = compress;
+    s->window_bits = window_bits;
+    s->level = level;
+    s->mem_level = mem_level;
+
+    // negative window bits: raw deflate data, no zlib header
+    int rc = compress ? deflateInit2(&s->strm, level, Z_DEFLATED, -window_bits, mem_level,
+                                     Z_DEFAULT_STRATEGY)
+                      : inflateInit2(&s->strm, -window_bits);
+    if (rc != Z_OK)
+    {
+        WS_WARN("WSDeflateSession - zlib stream init failed with[err:%d]", rc);
+        free(s);
+        return NULL;
+    }
+    ws_atomic_add(&streams_created_, 1);
+    return s;
+}
+
+// reset a stream and cache it, or free it if the cache is full
+static void put_stream(WSDeflateStream *s)
+{
+    if (s == NULL)
+    {
+        return;
+    }
+
+    StreamList &list = idle_streams_[s->compress ? 1 : 0];
+    if (list.count >= max_idle_streams_)
+    {
+        free_stream(s);
+        return;
+    }
+    if (s->compress)
+    {
+        deflateReset(&s->strm);
+    }
+    else
+    {
+        inflateReset(&s->strm);
+    }
+    s->next = list.head;
+    list.head = s;
+    list.count++;
+}
+
+// zalloc/zfree of dictionary compressors. deflateCopy allocates a whole
+// deflate state for every message, the blocks freed by the previous one
+// are kept per thread so that a copy costs little more than a memcpy.
+struct ZBlock
+{
+    ZBlock *next;
+    size_t size;
+};
+
+// keeps the data 16 bytes aligned
+static const size_t block_header_ = 16;
+// a deflate state is 5 blocks
+static const int max_idle_blocks_ = 8;
+
+static WS_THREAD_LOCAL ZBlock *idle_blocks_ = NULL;
+static WS_THREAD_LOCAL int idle_block_count_ = 0;
+
+static voidpf block_alloc(voidpf opaque, uInt items, uInt size)
+{
+    size_t n = (size_t)items * size;
+    for (ZBlock **link = &idle_blocks_; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->size == n)
+        {
+            ZBlock *b = *link;
+            *link = b->next;
+            idle_block_count_--;
+            return (char *)b + block_header_;
+        }
+    }
+    ZBlock *b = (ZBlock *)malloc(block_header_ + n);
+    if (b == NULL)
+    {
+        return Z_NULL;
+    }
+    b->size = n;
+    return (char *)b + block_header_;
+}
+
+static void block_free(voidpf opaque, voidpf address)
+{
+    ZBlock *b = (ZBlock *)((char *)address - block_header_);
+    if (idle_block_count_ >= max_idle_blocks_)
+    {
+        free(b);
+        return;
+    }
+    b->next = idle_blocks_;
+    idle_blocks_ = b;
+    idle_block_count_++;
+}
+
+// a compressor that has been given the dictionary and nothing else
+struct PrimedDeflater
+{
+    int64_t serial;
+    z_stream strm;
+};
+
+static WS_THREAD_LOCAL PrimedDeflater *primed_ = NULL;
+
+static void free_primed()
+{
+    if (primed_ != NULL)
+    {
+        deflateEnd(&primed_->strm);
+        free(primed_);
+        primed_ = NULL;
+        ws_atomic_add(&streams_freed_, 1);
+    }
+}
+
+// take one of the config.max_context_streams
+static bool reserve_context(const WSDeflateConfig &config)
+{
+    if (ws_atomic_add(&context_streams_, 1) > config.max_context_streams)
+    {
+        ws_atomic_add(&context_streams_, -1);
+        return false;
+    }
+    return true;
+}
+
+WSDeflateConfig ws_deflate_default_config()
+{
+    WSDeflateConfig config;
+    config.level = Z_DEFAULT_COMPRESSION;
+    config.mem_level = 8;
+    config.server_max_window_bits = 15;
+    config.client_max_window_bits = 15;
+    config.server_no_context_takeover = false;
+    config.client_no_context_takeover = false;
+    config.min_size = 64;
+    config.max_message_size = 64 * 1024 * 1024;
+    config.max_context_streams = 1024;
+    return config;
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// [begin, end) without surrounding spaces and quotes
+static void trim(const char *&begin, const char *&end)
+{
+    while (begin < end && is_space(*begin))
+    {
+        begin++;
+    }
+    while (end > begin && is_space(end[-1]))
+    {
+        end--;
+    }
+    if (end - begin >= 2 && *begin == '"' && end[-1] == '"')
+    {
+        begin++;
+        end--;
+    }
+}
+
+static bool token_equals(const char *begin, const char *end, const char *token)
+{
+    size_t n = strlen(token);
+    if ((size_t)(end - begin) != n)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = begin[i];
+        if (c >= 'A' && c <= 'Z')
+        {
+            c = c - 'A' + 'a';
+        }
+        if (c != token[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// window bits 8 to 15. zlib can't compress with an 8 bits window, so
+// only 9 and up are usable for the server side.
+static int parse_window_bits(const char *begin, const char *end)
+{
+    if (end - begin == 1 && *begin >= '8' && *begin <= '9')
+    {
+        return *begin - '0';
+    }
+    if (end - begin == 2 && begin[0] == '1' && begin[1] >= '0' && begin[1] <= '5')
+    {
+        return 10 + begin[1] - '0';
+    }
+    return -1;
+}
+
+// check one offer: the parameters after "permessage-deflate"
+static bool accept_offer(const char *begin, const char *end, const WSDeflateConfig &config,
+                         WSDeflateParams &params)
+{
+    bool server_no_context_takeover = false;
+    bool client_no_context_takeover = false;
+    int server_bits = 0;
+    int client_bits = 0;
+    bool client_bits_offered = false;
+
+    while (begin < end)
+    {
+        const char *sep = (const char *)memchr(begin, ';', end - begin);
+        const char *param_end = sep != NULL ? sep : end;
+        const char *name = begin;
+        const char *name_end = param_end;
+        const char *value = NULL;
+        const char *value_end = NULL;
+        const char *eq = (const char *)memchr(name, '=', param_end - name);
+        if (eq != NULL)
+        {
+            name_end = eq;
+            value = eq + 1;
+            value_end = param_end;
+            trim(value, value_end);
+        }
+        trim(name, name_end);
+        begin = sep != NULL ? sep + 1 : end;
+
+        // a parameter may not be repeated, and unknown ones decline the offer
+        if (token_equals(name, name_end, "server_no_context_takeover") && value == NULL &&
+            !server_no_context_takeover)
+        {
+            server_no_context_takeover = true;
+        }
+        else if (token_equals(name, name_end, "client_no_context_takeover") && value == NULL &&
+                 !client_no_context_takeover)
+        {
+            client_no_context_takeover = true;
+        }
+        else if (token_equals(name, name_end, "server_max_window_bits") && value != NULL &&
+                 server_bits == 0)
+        {
+            server_bits = parse_window_bits(value, value_end);
+            if (server_bits < 9)
+            {
+                return false;
+            }
+        }
+        else if (token_equals(name, name_end, "client_max_window_bits") && !client_bits_offered)
+        {
+            client_bits_offered = true;
+            client_bits = value != NULL ? parse_window_bits(value, value_end) : 15;
+            if (client_bits < 8)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    params.server_no_context_takeover = server_no_context_takeover || config.server_no_context_takeover;
+    params.client_no_context_takeover = client_no_context_takeover || config.client_no_context_takeover;
+    params.server_max_window_bits = config.server_max_window_bits;
+    params.server_max_window_bits_offered = server_bits != 0;
+    if (server_bits != 0 && server_bits < params.server_max_window_bits)
+    {
+        params.server_max_window_bits = server_bits;
+    }
+    // a client that does not offer client_max_window_bits may use 15 bits
+    params.client_max_window_bits = 15;
+    params.client_max_window_bits_offered = client_bits_offered;
+    if (client_bits_offered)
+    {
+        params.client_max_window_bits = client_bits < config.client_max_window_bits
+                                            ? client_bits
+                                            : config.client_max_window_bits;
+    }
+    return true;
+}
+
+bool ws_deflate_negotiate(const char *offers, int32_t length, const WSDeflateConfig &config,
+                          WSDeflateParams &params)
+{
+    const char *p = offers;
+    const char *end = offers + length;
+    while (p < end)
+    {
+        // offers are separated by ',', parameters by ';'
+        const char *comma = (const char *)memchr(p, ',', end - p);
+        const char *offer_end = comma != NULL ? comma : end;
+        const char *name = p;
+        const char *semi = (const char *)memchr(p, ';', offer_end - p);
+        const char *name_end = semi != NULL ? semi : offer_end;
+        trim(name, name_end);
+
+        if (token_equals(name, name_end, "permessage-deflate") &&
+            accept_offer(semi != NULL ? semi + 1 : offer_end, offer_end, config, params))
+        {
+            return true;
+        }
+        p = comma != NULL ? comma + 1 : end;
+    }
+    return false;
+}
+
+void ws_deflate_response(const WSDeflateParams &params, std::string &value)
+{
+    char bits[48];
+    value = "permessage-deflate";
+    if (params.server_no_context_takeover)
+    {
+        value += "; server_no_context_takeover";
+    }
+    if (params.client_no_context_takeover)
+    {
+        value += "; client_no_context_takeover";
+    }
+    if (params.server_max_window_bits_offered || params.server_max_window_bits < 15)
+    {
+        snprintf(bits, sizeof(bits), "; server_max_window_bits=%d", params.server_max_window_bits);
+        value += bits;
+    }
+    // only a client that offered it understands client_max_window_bits
+    if (params.client_max_window_bits_offered && params.client_max_window_bits < 15)
+    {
+        snprintf(bits, sizeof(bits), "; client_max_window_bits=%d", params.client_max_window_bits);
+        value += bits;
+    }
+}
+
+void ws_deflate_get_stats(WSDeflateStats &stats)
+{
+    stats.streams_created = ws_atomic_load(&streams_created_);
+    stats.streams_freed = ws_atomic_load(&streams_freed_);
+    stats.context_streams = ws_atomic_load(&context_streams_);
+}
+
+void ws_deflate_trim()
+{
+    free_primed();
+    while (idle_blocks_ != NULL)
+    {
+        ZBlock *b = idle_blocks_;
+        idle_blocks_ = b->next;
+        free(b);
+    }
+    idle_block_count_ = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        StreamList &list = idle_streams_[i];
+        while (list.head != NULL)
+        {
+            WSDeflateStream *s = list.head;
+            list.head = s->next;
+            free_stream(s);
+        }
+        list.count = 0;
+    }
+}
+
+/*
+*  WSDeflateSession
+*
+*/
+WSDeflateSession::WSDeflateSession()
+{
+    config_ = NULL;
+    memset(&params_, 0, sizeof(params_));
+    deflater_ = NULL;
+    inflater_ = NULL;
+    inflated_ = 0;
+}
+
+WSDeflateSession::~WSDeflateSession()
+{
+    // a stream kept for context takeover can't be reused by others
+    if (deflater_ != NULL)
+    {
+        free_stream(deflater_);
+    }
+    if (inflater_ != NULL)
+    {
+        free_stream(inflater_);
+    }
+    if (config_ != NULL)
+    {
+        int n = (params_.server_no_context_takeover ? 0 : 1) +
+                (params_.client_no_context_takeover ? 0 : 1);
+        ws_atomic_add(&context_streams_, -n);
+    }
+}
+
+void WSDeflateSession::start(const WSDeflateConfig *config, WSDeflateParams &params)
+{
+    if (config_ != NULL)
+    {
+        return;
+    }
+
+    // zlib does not compress with an 8 bits window, a 9 bits decompressor
+    // reads it
+    if (params.server_max_window_bits < 9)
+    {
+        params.server_max_window_bits = 9;
+    }
+    if (!params.server_no_context_takeover && !reserve_context(*config))
+    {
+        params.server_no_context_takeover = true;
+    }
+    if (!params.client_no_context_takeover && !reserve_context(*config))
+    {
+        params.client_no_context_takeover = true;
+    }
+
+    config_ = config;
+    params_ = params;
+}
+
+int32_t WSDeflateSession::compress(const char *data, int64_t size, ByteBuffer &out)
+{
+    if (deflater_ == NULL)
+    {
+        deflater_ = get_stream(true, params_.server_max_window_bits, config_->level,
+                               config_->mem_level);
+        if (deflater_ == NULL)
+        {
+            return -1;
+        }
+    }
+
+    z_stream &strm = deflater_->strm;
+    strm.next_in = (Bytef *)data;
+    strm.avail_in = (uInt)size;
+    int begin = out.length();
+    int rc = Z_OK;
+    do
+    {
+        int room = (int)deflateBound(&strm, strm.avail_in) + 16;
+        strm.next_out = (Bytef *)out.reserve(room);
+        strm.avail_out = room;
+        rc = deflate(&strm, Z_SYNC_FLUSH);
+        out.commit(room - strm.avail_out);
+    } while (rc == Z_OK && strm.avail_out == 0);
+
+    int32_t n = out.length() - begin;
+    if (params_.server_no_context_takeover)
+    {
+        put_stream(deflater_);
+        deflater_ = NULL;
+    }
+    if (rc != Z_OK || n < 4 || memcmp(out.bytes() + out.length() - 4, deflate_tail_, 4) != 0)
+    {
+        WS_WARN("WSDeflateSession - deflate failed with[err:%d]", rc);
+        return -1;
+    }
+    return n - 4;
+}
+
+int32_t WSDeflateSession::inflate_into(const char *data, int64_t size, ByteBuffer &out)
+{
+    if (inflater_ == NULL)
+    {
+        inflater_ = get_stream(false, params_.client_max_window_bits < 9 ? 9 : params_.client_max_window_bits,
+                               0, 0);
+        if (inflater_ == NULL)
+        {
+            return WS_CLOSE_INTERNAL_ERROR;
+        }
+    }
+
+    z_stream &strm = inflater_->strm;
+    strm.next_in = (Bytef *)data;
+    strm.avail_in = (uInt)size;
+    for (;;)
+    {
+        // json and the like inflate to several times their size
+        int64_t room = strm.avail_in < 64 * 1024 ? (int64_t)strm.avail_in * 4 : 256 * 1024;
+        if (room < 16 * 1024)
+        {
+            room = 16 * 1024;
+        }
+        // one byte over the limit tells that it is exceeded
+        if (inflated_ + room > config_->max_message_size)
+        {
+            room = config_->max_message_size - inflated_ + 1;
+        }
+        strm.next_out = (Bytef *)out.reserve((int)room);
+        strm.avail_out = (uInt)room;
+        int rc = inflate(&strm, Z_SYNC_FLUSH);
+        int produced = (int)room - strm.avail_out;
+        out.commit(produced);
+        inflated_ += produced;
+
+        if (inflated_ > config_->max_message_size)
+        {
+            WS_WARN("WSDeflateSession - message inflates to more than %lld bytes",
+                    (long long)config_->max_message_size);
+            return WS_CLOSE_MESSAGE_TOO_BIG;
+        }
+        if (rc == Z_STREAM_END)
+        {
+            // a block with BFINAL set ends the stream, the next one starts fresh
+            inflateReset(&strm);
+        }
+        else if (rc == Z_BUF_ERROR && strm.avail_in == 0)
+        {
+            // everything is inflated
+            break;
+        }
+        else if (rc != Z_OK)
+        {
+            WS_WARN("WSDeflateSession - inflate failed with[err:%d]", rc);
+            return WS_CLOSE_INVALID_PAYLOAD;
+        }
+
+        // zlib keeps output back only when it has run out of room
+        if (strm.avail_in == 0 && strm.avail_out != 0)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+int32_t WSDeflateSession::decompress(const char *data, int64_t size, ByteBuffer &out)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+    return inflate_into(data, size, out);
+}
+
+int32_t WSDeflateSession::finish_message(ByteBuffer &out)
+{
+    // the sender has removed the tail of the final sync flush
+    int32_t status = inflate_into((const char *)deflate_tail_, 4, out);
+    inflated_ = 0;
+    if (params_.client_no_context_takeover && inflater_ != NULL)
+    {
+        put_stream(inflater_);
+        inflater_ = NULL;
+    }
+    return status;
+}
+
+/*
+*  WSDeflateDictionary
+*
+*/
+// flags byte of a message in the dictionary subprotocol
+#define WS_DICT_COMPRESSED 0x01
+#define WS_DICT_TEXT 0x02
+
+// the dictionary of the thread's primed compressor. a thread using
+// several dictionaries in turn primes again on every switch.
+static z_stream *primed_deflater(const std::string &dict, int64_t serial, const WSDeflateConfig &config)
+{
+    if (primed_ != NULL && primed_->serial == serial)
+    {
+        return &primed_->strm;
+    }
+    free_primed();
+
+    PrimedDeflater *p = (PrimedDeflater *)calloc(1, sizeof(PrimedDeflater));
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    p->serial = serial;
+    p->strm.zalloc = block_alloc;
+    p->strm.zfree = block_free;
+    int rc = deflateInit2(&p->strm, config.level, Z_DEFLATED, -config.server_max_window_bits,
+                          config.mem_level, Z_DEFAULT_STRATEGY);
+    if (rc != Z_OK)
+    {
+        WS_WARN("WSDeflateDictionary - zlib stream init failed with[err:%d]", rc);
+        free(p);
+        return NULL;
+    }
+    ws_atomic_add(&streams_created_, 1);
+    primed_ = p;
+
+    rc = deflateSetDictionary(&p->strm, (const Bytef *)dict.data(), (uInt)dict.length());
+    if (rc != Z_OK)
+    {
+        WS_WARN("WSDeflateDictionary - deflateSetDictionary failed with[err:%d]", rc);
+        free_primed();
+        return NULL;
+    }
+    return &p->strm;
+}
+
+WSDeflateDictionary::WSDeflateDictionary()
+{
+    id_ = 0;
+    config_ = ws_deflate_default_config();
+    serial_ = 0;
+}
+
+WSDeflateDictionary::~WSDeflateDictionary() {}
+
+bool WSDeflateDictionary::set(const char *data, int32_t size, const WSDeflateConfig &config)
+{
+    // zlib only looks back a 32K window
+    static const int32_t max_dict_size = 32 * 1024;
+    if (data == NULL || size <= 0)
+    {
+        return false;
+    }
+    if (size > max_dict_size)
+    {
+        data += size - max_dict_size;
+        size = max_dict_size;
+    }
+
+    dict_.assign(data, size);
+    id_ = (uint32_t)adler32(adler32(0L, Z_NULL, 0), (const Bytef *)data, (uInt)size);
+    char name[64];
+    snprintf(name, sizeof(name), "wsfiles.deflate-dict.%08x", id_);
+    protocol_ = name;
+
+    config_ = config;
+    if (config_.server_max_window_bits < 9)
+    {
+        config_.server_max_window_bits = 9;
+    }
+    serial_ = ws_atomic_add(&dictionary_serial_, 1);
+    return true;
+}
+
+bool WSDeflateDictionary::load(const char *path, const WSDeflateConfig &config)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        WS_WARN("WSDeflateDictionary - can't open %s", path);
+        return false;
+    }
+    std::string data;
+    char buf[4096];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        data.append(buf, n);
+    }
+    fclose(fp);
+    return set(data.data(), (int32_t)data.length(), config);
+}
+
+int32_t WSDeflateDictionary::compress(uint8_t opcode, const char *data, int64_t size, ByteBuffer &out) const
+{
+    uint8_t flags = opcode == WebSocketPacket::WSOpcode_Text ? WS_DICT_TEXT : 0;
+    // never bigger than the message and its flags byte
+    int64_t stored_size = size + 1;
+    if (stored_size > 0x7FFFFFFF)
+    {
+        return -1;
+    }
+
+    z_stream *primed = NULL;
+    if (size >= config_.min_size && is_loaded())
+    {
+        primed = primed_deflater(dict_, serial_, config_);
+    }
+
+    z_stream strm;
+    if (primed != NULL && deflateCopy(&strm, primed) == Z_OK)
+    {
+        int64_t room = (int64_t)deflateBound(&strm, (uLong)size) + 1;
+        if (room < stored_size)
+        {
+            room = stored_size;
+        }
+        char *p = out.reserve((int)room);
+        strm.next_in = (Bytef *)data;
+        strm.avail_in = (uInt)size;
+        strm.next_out = (Bytef *)p + 1;
+        strm.avail_out = (uInt)(room - 1);
+        int rc = deflate(&strm, Z_FINISH);
+        int64_t produced = (room - 1) - strm.avail_out;
+        deflateEnd(&strm);
+
+        // stored below if deflate does not pay
+        if (rc == Z_STREAM_END && produced < size)
+        {
+            p[0] = (char)(flags | WS_DICT_COMPRESSED);
+            out.commit((int)produced + 1);
+            return (int32_t)produced + 1;
+        }
+    }
+
+    // nothing has been committed, so this is the same space
+    char *p = out.reserve((int)stored_size);
+    p[0] = (char)flags;
+    if (size > 0)
+    {
+        memcpy(p + 1, data, size);
+    }
+    out.commit((int)stored_size);
+    return (int32_t)stored_size;
+}
+
+int32_t WSDeflateDictionary::decompress(const char *data, int64_t size, uint8_t &opcode, ByteBuffer &out) const
+{
+    if (size < 1 || (data[0] & ~(WS_DICT_COMPRESSED | WS_DICT_TEXT)) != 0)
+    {
+        WS_WARN("WSDeflateDictionary - bad message flags");
+        return WS_CLOSE_INVALID_PAYLOAD;
+    }
+    uint8_t flags = (uint8_t)data[0];
+    opcode = (flags & WS_DICT_TEXT) ? WebSocketPacket::WSOpcode_Text : WebSocketPacket::WSOpcode_Binary;
+    data++;
+    size--;
+
+    if (!(flags & WS_DICT_COMPRESSED))
+    {
+        if (size > config_.max_message_size)
+        {
+            return WS_CLOSE_MESSAGE_TOO_BIG;
+        }
+        out.append(data, (int)size);
+        return 0;
+    }
+
+    // any window up to 15 bits is read by a 15 bits decompressor
+    WSDeflateStream *inflater = get_stream(false, 15, 0, 0);
+    if (inflater == NULL)
+    {
+        return WS_CLOSE_INTERNAL_ERROR;
+    }
+    z_stream &strm = inflater->strm;
+    // a raw stream takes the dictionary before any data, it is a memcpy
+    int rc = inflateSetDictionary(&strm, (const Bytef *)dict_.data(), (uInt)dict_.length());
+    strm.next_in = (Bytef *)data;
+    strm.avail_in = (uInt)size;
+    int64_t inflated = 0;
+    int32_t status = 0;
+    while (rc == Z_OK)
+    {
+        // small messages are what a dictionary is for
+        int64_t room = (int64_t)strm.avail_in * 8 + 256;
+        if (room > 256 * 1024)
+        {
+            room = 256 * 1024;
+        }
+        // one byte over the limit tells that it is exceeded
+        if (inflated + room > config_.max_message_size)
+        {
+            room = config_.max_message_size - inflated + 1;
+        }
+        strm.next_out = (Bytef *)out.reserve((int)room);
+        strm.avail_out = (uInt)room;
+        rc = inflate(&strm, Z_FINISH);
+        int produced = (int)room - strm.avail_out;
+        out.commit(produced);
+        inflated += produced;
+
+        if (inflated > config_.max_message_size)
+        {
+            WS_WARN("WSDeflateDictionary - message inflates to more than %lld bytes",
+                    (long long)config_.max_message_size);
+            status = WS_CLOSE_MESSAGE_TOO_BIG;
+            break;
+        }
+        // Z_FINISH without the whole output is reported as Z_BUF_ERROR
+        if (rc == Z_BUF_ERROR && strm.avail_out == 0)
+        {
+            rc = Z_OK;
+        }
+    }
+    if (status == 0 && (rc != Z_STREAM_END || strm.avail_in != 0))
+    {
+        WS_WARN("WSDeflateDictionary - inflate failed with[err:%d]", rc);
+        status = WS_CLOSE_INVALID_PAYLOAD;
+    }
+    put_stream(inflater);
+    return status;
+}
@@ -0,0 +1,253 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* permessage-deflate extension (RFC7692): negotiation, per connection
+* compression and a pool of zlib streams. and a subprotocol compressing
+* each message on its own with a preset dictionary.
+*/
+
+#ifndef _WS_DEFLATE_H_
+#define _WS_DEFLATE_H_
+
+#include <stdint.h>
+#include <string>
+
+class ByteBuffer;
+struct WSDeflateStream;
+
+/**
+* what the server offers. one config is usually shared by all endpoints,
+* it must outlive them.
+*/
+struct WSDeflateConfig
+{
+    // zlib compression level(0-9) and memLevel(1-9) of the server side
+    int level;
+    int mem_level;
+    // largest LZ77 window(9-15) the server compresses with, and the one
+    // it asks clients to compress with when they allow it
+    int server_max_window_bits;
+    int client_max_window_bits;
+    // reset the compression context after every message. it is also
+    // forced once max_context_streams is reached.
+    bool server_no_context_takeover;
+    bool client_no_context_takeover;
+    // messages shorter than this are sent uncompressed
+    int min_size;
+    // a compressed message inflating to more than this fails the
+    // connection with status 1009
+    int64_t max_message_size;
+    // zlib streams all connections may keep between messages for
+    // context takeover. a compressor with a 15 bits window and memLevel 8
+    // takes about 256K, a decompressor about 44K. the streams of
+    // connections without context takeover are only borrowed for a
+    // message and come from a per thread pool.
+    int max_context_streams;
+};
+
+/**
+* get a config with the defaults: level 6, memLevel 8, 15 bits windows,
+* context takeover, min_size 64, max_message_size 64M and 1024 context
+* streams.
+*/
+WSDeflateConfig ws_deflate_default_config();
+
+/**
+* the parameters agreed on in the handshake
+*/
+struct WSDeflateParams
+{
+    bool server_no_context_takeover;
+    bool client_no_context_takeover;
+    int server_max_window_bits;
+    int client_max_window_bits;
+    // the offer had these parameters, so the response has to answer them
+    bool server_max_window_bits_offered;
+    bool client_max_window_bits_offered;
+};
+
+/**
+* pick the first permessage-deflate offer of a Sec-WebSocket-Extensions
+* header that config can accept.
+* @param offers the header value
+* @return true if an offer is accepted, params get the result
+*/
+bool ws_deflate_negotiate(const char *offers, int32_t length, const WSDeflateConfig &config,
+                          WSDeflateParams &params);
+
+/**
+* format the Sec-WebSocket-Extensions value of the response
+*/
+void ws_deflate_response(const WSDeflateParams &params, std::string &value);
+
+struct WSDeflateStats
+{
+    // zlib streams initialized and ended, the difference is alive
+    int64_t streams_created;
+    int64_t streams_freed;
+    // streams kept by connections for context takeover
+    int64_t context_streams;
+};
+
+/**
+* get the counters of all threads
+*/
+void ws_deflate_get_stats(WSDeflateStats &stats);
+
+/**
+* free the idle zlib streams and the primed dictionary compressor cached
+* by the calling thread
+*/
+void ws_deflate_trim();
+
+/**
+* compression state of one connection, server side. a stream with
+* context takeover is kept from the first message to the end of the
+* connection, other ones are taken from the pool for one message.
+* @remark not thread safe, like WebSocketEndpoint.
+*/
+class WSDeflateSession
+{
+public:
+    WSDeflateSession();
+    virtual ~WSDeflateSession();
+
+public:
+    /**
+    * turn compression on with negotiated params. context takeover is
+    * given up in the params when config.max_context_streams are in use.
+    */
+    void start(const WSDeflateConfig *config, WSDeflateParams &params);
+
+    bool is_enabled() { return config_ != NULL; }
+
+    // true if a message of size bytes is worth compressing
+    bool should_compress(int64_t size) { return config_ != NULL && size >= config_->min_size; }
+
+    /**
+    * compress a whole message and append it to out
+    * @return the number of bytes appended, <0 on a zlib error
+    */
+    int32_t compress(const char *data, int64_t size, ByteBuffer &out);
+
+    /**
+    * inflate the next piece of a compressed message and append it to out
+    * @return 0, or the status to close the connection with
+    */
+    int32_t decompress(const char *data, int64_t size, ByteBuffer &out);
+
+    /**
+    * the last frame of the message has been given to decompress
+    * @return 0, or the status to close the connection with
+    */
+    int32_t finish_message(ByteBuffer &out);
+
+private:
+    WSDeflateSession(const WSDeflateSession &);
+    WSDeflateSession &operator=(const WSDeflateSession &);
+
+    int32_t inflate_into(const char *data, int64_t size, ByteBuffer &out);
+
+private:
+    const WSDeflateConfig *config_;
+    WSDeflateParams params_;
+    // kept for context takeover, or borrowed for the current message
+    WSDeflateStream *deflater_;
+    WSDeflateStream *inflater_;
+    // bytes inflated for the current message
+    int64_t inflated_;
+};
+
+/**
+* a preset dictionary, loaded once and shared by all connections. small
+* messages with the same keys hardly shrink under permessage-deflate
+* without context takeover, but do with a dictionary trained on them
+* (see tools/ws_dict_train).
+*
+* it is a subprotocol: a client lists get_protocol() in
+* Sec-WebSocket-Protocol. then every data message is sent in binary
+* frames, and the message payload starts with a flags byte:
+*   bit 0  the rest is raw deflate data(RFC1951) of the message, made
+*          with the dictionary and a window of at most 15 bits, and
+*          ended by a final block. otherwise the rest is the message.
+*   bit 1  the message is text
+* no context is kept between messages, so a connection holds no zlib
+* state. each thread primes a compressor with the dictionary once and
+* copies it for every message, decompressors come from the stream pool.
+* @remark immutable once set, all threads may use it.
+*/
+class WSDeflateDictionary
+{
+public:
+    WSDeflateDictionary();
+    virtual ~WSDeflateDictionary();
+
+public:
+    /**
+    * set the dictionary. only the last 32K are used, put the most
+    * common strings at the end.
+    * @param config level, mem_level, server_max_window_bits, min_size
+    *       and max_message_size are used
+    * @return false if it is empty
+    */
+    bool set(const char *data, int32_t size, const WSDeflateConfig &config);
+
+    // read a dictionary file, like set()
+    bool load(const char *path, const WSDeflateConfig &config);
+
+    bool is_loaded() const { return !dict_.empty(); }
+
+    // adler32 of the dictionary, zlib's dictionary id
+    uint32_t get_id() const { return id_; }
+
+    // subprotocol name: wsfiles.deflate-dict.<id in 8 hex digits>
+    const std::string &get_protocol() const { return protocol_; }
+
+    /**
+    * encode a whole message with the flags byte and append it to out.
+    * messages shorter than min_size, or not getting shorter, are stored.
+    * @return the number of bytes appended, <0 on error
+    */
+    int32_t compress(uint8_t opcode, const char *data, int64_t size, ByteBuffer &out) const;
+
+    /**
+    * decode a whole message and append it to out
+    * @param opcode receives WSOpcode_Text or WSOpcode_Binary
+    * @return 0, or the status to close the connection with
+    */
+    int32_t decompress(const char *data, int64_t size, uint8_t &opcode, ByteBuffer &out) const;
+
+private:
+    WSDeflateDictionary(const WSDeflateDictionary &);
+    WSDeflateDictionary &operator=(const WSDeflateDictionary &);
+
+private:
+    std::string dict_;
+    uint32_t id_;
+    std::string protocol_;
+    WSDeflateConfig config_;
+    // tells the primed compressor of a thread which dictionary it has
+    int64_t serial_;
+};
+
+#endif //_WS_DEFLATE_H_
@@ -0,0 +1,412 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ws_demo.h"
+#include "ws_pubsub.h"
+#include "ws_shared_frame.h"
+#include "ws_log.h"
+
+static void demo_fail(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+* -b: data messages go to every peer of the event loop instead of back.
+* the endpoints of a loop are chained, an endpoint leaves the chain when
+* it is deleted.
+*/
+class WSBroadcastEndpoint : public WebSocketEndpoint
+{
+public:
+    WSBroadcastEndpoint(WSBroadcastEndpoint **peers, const WSDeflateDictionary *dictionary)
+        : peers_(peers), dictionary_(dictionary), prev_(NULL), next_(*peers)
+    {
+        if (next_ != NULL)
+        {
+            next_->prev_ = this;
+        }
+        *peers_ = this;
+    }
+
+    virtual ~WSBroadcastEndpoint()
+    {
+        if (prev_ != NULL)
+        {
+            prev_->next_ = next_;
+        }
+        else
+        {
+            *peers_ = next_;
+        }
+        if (next_ != NULL)
+        {
+            next_->prev_ = prev_;
+        }
+    }
+
+    virtual int32_t user_defined_process(WebSocketPacket &packet, const ByteView &frame_payload)
+    {
+        uint8_t opcode = packet.get_opcode();
+        if (opcode != WebSocketPacket::WSOpcode_Text && opcode != WebSocketPacket::WSOpcode_Binary)
+        {
+            return WebSocketEndpoint::user_defined_process(packet, frame_payload);
+        }
+        broadcast(opcode, frame_payload.bytes(), frame_payload.length());
+        return 0;
+    }
+
+private:
+    // pack a message once and queue it on every peer of the loop. peers
+    // on the dictionary subprotocol get a frame encoded with it, also
+    // made once. the transports fail a peer refusing it after the walk.
+    void broadcast(uint8_t opcode, const char *data, int64_t size)
+    {
+        WSSharedFrame *frame = WSSharedFrame::create(opcode, data, size);
+        WSSharedFrame *dict_frame = NULL;
+        if (frame == NULL)
+        {
+            return;
+        }
+        for (WSBroadcastEndpoint *peer = *peers_; peer != NULL; peer = peer->next_)
+        {
+            if (peer->is_dictionary_enabled())
+            {
+                if (dict_frame == NULL)
+                {
+                    dict_frame = WSSharedFrame::create(opcode, data, size, dictionary_);
+                }
+                peer->send_shared(dict_frame);
+            }
+            else
+            {
+                peer->send_shared(frame);
+            }
+        }
+        frame->unref();
+        if (dict_frame != NULL)
+        {
+            dict_frame->unref();
+        }
+    }
+
+    WSBroadcastEndpoint **peers_;
+    const WSDeflateDictionary *dictionary_;
+    WSBroadcastEndpoint *prev_;
+    WSBroadcastEndpoint *next_;
+};
+
+/**
+* -p: topic commands in text messages, see the usage in ws_demo.h. the
+* endpoint is unsubscribed when it is deleted, on the loop thread that
+* owns its shard.
+*/
+class WSPubSubEndpoint : public WebSocketEndpoint
+{
+public:
+    WSPubSubEndpoint(WSPubSub *pubsub, int shard) : pubsub_(pubsub), shard_(shard), subs_(NULL) {}
+
+    virtual ~WSPubSubEndpoint()
+    {
+        while (subs_ != NULL)
+        {
+            WSSubscription *sub = subs_;
+            subs_ = sub->next;
+            pubsub_->unsubscribe(sub);
+        }
+    }
+
+    virtual int32_t user_defined_process(WebSocketPacket &packet, const ByteView &frame_payload)
+    {
+        const char *p = frame_payload.bytes();
+        size_t len = (size_t)frame_payload.length();
+        if (packet.get_opcode() != WebSocketPacket::WSOpcode_Text)
+        {
+            return WebSocketEndpoint::user_defined_process(packet, frame_payload);
+        }
+
+        if (len > 4 && memcmp(p, "PUB ", 4) == 0)
+        {
+            const char *topic = p + 4;
+            const char *end = (const char *)memchr(topic, ' ', len - 4);
+            size_t topic_len = end ? end - topic : len - 4;
+            const char *msg = end ? end + 1 : p + len;
+            pubsub_->publish(topic, topic_len, WebSocketPacket::WSOpcode_Text, msg,
+                             p + len - msg, shard_);
+            return 0;
+        }
+        if (len > 4 && memcmp(p, "SUB ", 4) == 0)
+        {
+            if (find(p + 4, len - 4) == NULL)
+            {
+                WSSubscription *sub = pubsub_->subscribe(shard_, p + 4, len - 4, this);
+                sub->next = subs_;
+                subs_ = sub;
+            }
+            return send_message(WebSocketPacket::WSOpcode_Text, "OK", 2);
+        }
+        if (len > 6 && memcmp(p, "UNSUB ", 6) == 0)
+        {
+            WSSubscription **link = find(p + 6, len - 6);
+            if (link != NULL)
+            {
+                WSSubscription *sub = *link;
+                *link = sub->next;
+                pubsub_->unsubscribe(sub);
+            }
+            return send_message(WebSocketPacket::WSOpcode_Text, "OK", 2);
+        }
+        return WebSocketEndpoint::user_defined_process(packet, frame_payload);
+    }
+
+private:
+    // the link to the subscription of topic in the chain of the endpoint
+    WSSubscription **find(const char *topic, size_t topic_len)
+    {
+        for (WSSubscription **link = &subs_; *link != NULL; link = &(*link)->next)
+        {
+            if ((*link)->has_topic(topic, topic_len))
+            {
+                return link;
+            }
+        }
+        return NULL;
+    }
+
+    WSPubSub *pubsub_;
+    int shard_;
+    WSSubscription *subs_;
+};
+
+WSDemo::WSDemo() : pubsub_(NULL), broadcast_peers_(NULL)
+{
+    options_.port = 9000;
+    options_.num_loops = 1;
+    options_.pool_mode = false;
+    options_.num_workers = 0;
+    options_.use_deflate = false;
+    options_.deflate_config = ws_deflate_default_config();
+    options_.broadcast_mode = false;
+    options_.pubsub_mode = false;
+    options_.send_limits = ws_send_default_limits();
+    options_.keepalive_config = ws_keepalive_default_config();
+}
+
+WSDemo::~WSDemo()
+{
+    delete pubsub_;
+    delete[] broadcast_peers_;
+}
+
+void WSDemo::usage(const char *prog, int features)
+{
+    fprintf(stderr, "usage: %s %s [-t loops]%s [-z] [-d dict] [-b|-p] [-s drop|latest|close] [-q low,high,max] [-k ping,pong] [-i idle] [port]\n",
+            prog, (features & WS_DEMO_WORKERS) ? "[-m inline|pool]" : "[-m inline]",
+            (features & WS_DEMO_WORKERS) ? " [-w workers]" : "");
+    exit(EXIT_FAILURE);
+}
+
+void WSDemo::parse(int argc, char **argv, const char *server, int features)
+{
+    bool workers = (features & WS_DEMO_WORKERS) != 0;
+    WSSendLimits &send_limits = options_.send_limits;
+    WSKeepaliveConfig &keepalive_config = options_.keepalive_config;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:w:zd:bps:q:k:i:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "inline") == 0)
+            {
+                options_.pool_mode = false;
+            }
+            else if (strcmp(optarg, "pool") == 0 && workers)
+            {
+                options_.pool_mode = true;
+            }
+            else if (!workers)
+            {
+                demo_fail("the %s server processes every read on its loop thread, use -m inline", server);
+            }
+            else
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 't':
+            options_.num_loops = atoi(optarg);
+            if (options_.num_loops < 1 || options_.num_loops > WS_DEMO_MAX_LOOPS)
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 'w':
+            if (!workers)
+            {
+                demo_fail("the %s server has no working threads, -w is not supported", server);
+            }
+            options_.num_workers = atoi(optarg);
+            if (options_.num_workers < 1)
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 'z':
+            options_.use_deflate = true;
+            break;
+        case 'd':
+            if (!dictionary_.load(optarg, ws_deflate_default_config()))
+            {
+                demo_fail("can't load dictionary %s", optarg);
+            }
+            break;
+        case 'b':
+            options_.broadcast_mode = true;
+            break;
+        case 'p':
+            options_.pubsub_mode = true;
+            break;
+        case 's':
+            if (strcmp(optarg, "drop") == 0)
+            {
+                send_limits.policy = WS_SLOW_DROP_OLDEST;
+            }
+            else if (strcmp(optarg, "latest") == 0)
+            {
+                send_limits.policy = WS_SLOW_KEEP_LATEST;
+            }
+            else if (strcmp(optarg, "close") == 0)
+            {
+                send_limits.policy = WS_SLOW_CLOSE;
+            }
+            else
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 'q':
+            if (sscanf(optarg, "%" SCNd64 ",%" SCNd64 ",%" SCNd64, &send_limits.low_watermark,
+                       &send_limits.high_watermark, &send_limits.max_queued) != 3 ||
+                send_limits.low_watermark < 0 ||
+                send_limits.low_watermark > send_limits.high_watermark ||
+                send_limits.high_watermark > send_limits.max_queued)
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 'k':
+            if (sscanf(optarg, "%u,%u", &keepalive_config.ping_interval,
+                       &keepalive_config.pong_timeout) != 2 ||
+                (keepalive_config.ping_interval == 0) != (keepalive_config.pong_timeout == 0))
+            {
+                usage(argv[0], features);
+            }
+            break;
+        case 'i':
+            if (sscanf(optarg, "%u", &keepalive_config.idle_timeout) != 1)
+            {
+                usage(argv[0], features);
+            }
+            break;
+        default:
+            usage(argv[0], features);
+        }
+    }
+    // the peers of -b and -p are reached from the loop thread
+    if ((options_.broadcast_mode || options_.pubsub_mode) && options_.pool_mode)
+    {
+        usage(argv[0], features);
+    }
+    if (options_.broadcast_mode && options_.pubsub_mode)
+    {
+        usage(argv[0], features);
+    }
+    if (optind < argc)
+    {
+        options_.port = atoi(argv[optind]);
+    }
+
+    if (options_.broadcast_mode)
+    {
+        broadcast_peers_ = new WSBroadcastEndpoint *[options_.num_loops];
+        for (int i = 0; i < options_.num_loops; i++)
+        {
+            broadcast_peers_[i] = NULL;
+        }
+    }
+    if (options_.pubsub_mode)
+    {
+        pubsub_ = new WSPubSub(options_.num_loops);
+        if (dictionary_.is_loaded())
+        {
+            pubsub_->set_dictionary(&dictionary_);
+        }
+    }
+
+    WS_INFO("Serving on port %d, %s%s, %d event loop(s)%s", options_.port, server,
+            !workers ? "" : (options_.pool_mode ? ", pool mode" : ", inline mode"),
+            options_.num_loops, options_.use_deflate ? ", permessage-deflate" : "");
+    if (dictionary_.is_loaded())
+    {
+        WS_INFO("Dictionary subprotocol %s", dictionary_.get_protocol().c_str());
+    }
+}
+
+WebSocketEndpoint *WSDemo::create_endpoint(int index)
+{
+    const WSDeflateDictionary *dictionary = dictionary_.is_loaded() ? &dictionary_ : NULL;
+    WebSocketEndpoint *endpoint;
+    if (broadcast_peers_ != NULL)
+    {
+        endpoint = new WSBroadcastEndpoint(&broadcast_peers_[index], dictionary);
+    }
+    else if (pubsub_ != NULL)
+    {
+        endpoint = new WSPubSubEndpoint(pubsub_, index);
+    }
+    else
+    {
+        endpoint = new WebSocketEndpoint();
+    }
+    if (options_.use_deflate)
+    {
+        endpoint->set_deflate(&options_.deflate_config);
+    }
+    if (dictionary != NULL)
+    {
+        endpoint->set_deflate_dictionary(dictionary);
+    }
+    endpoint->set_keepalive(&options_.keepalive_config);
+    return endpoint;
+}
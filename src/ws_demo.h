@@ -0,0 +1,137 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* what the demo servers(main.cpp, main_uring.cpp and main_epoll.cpp) have
+* in common: the command line, and the endpoints of -b and -p. a server
+* only adds its transport.
+*
+* usage: <server> [-m inline|pool] [-t loops] [-w workers] [-z] [-d dict] [-b|-p] [-s policy] [-q low,high,max] [-k ping,pong] [-i idle] [port]
+*   -m, -w     see the server. one without working threads only takes
+*              -m inline
+*   -t loops   number of event loop threads(default 1). each one has its
+*              own SO_REUSEPORT listener on the same port, and a
+*              connection stays on the loop that accepted it.
+*   -z         accept permessage-deflate(RFC7692) offers from clients
+*   -d dict    offer the preset dictionary subprotocol with a dictionary
+*              file made by tools/ws_dict_train
+*   -b         broadcast: every data message is sent to all peers of the
+*              event loop instead of being echoed. the frame is packed
+*              once and each peer queues a reference to it. peers are
+*              reached from the loop thread, so not with -m pool.
+*   -p         pub/sub: text messages "SUB topic" and "UNSUB topic"
+*              (answered with "OK"), and "PUB topic message", which sends
+*              message to the subscribers of topic on every event loop.
+*              other messages are echoed. not with -m pool.
+*   -s policy  what to do when a peer does not read its data fast enough
+*              and its send queue reaches the limit: drop(oldest
+*              messages), latest(keep only the newest message) or
+*              close(with status 1008, the default)
+*   -q low,high,max  send queue limits in bytes(default 65536,1048576,
+*              16777216). reads of a peer stop while more than high bytes
+*              wait for it, until they are down to low.
+*   -k ping,pong  keepalive in milliseconds(default 30000,10000): a peer
+*              that sent nothing for ping is pinged, and closed if still
+*              nothing comes within pong. 0,0 turns pings off. the
+*              handshake must be completed within 10s.
+*   -i idle    close a peer with status 1001 after idle milliseconds
+*              without data messages either way(default 0, never)
+*/
+
+#ifndef _WS_DEMO_H_
+#define _WS_DEMO_H_
+
+#include <stdint.h>
+#include "ws_endpoint.h"
+#include "ws_send_queue.h"
+
+class WSPubSub;
+class WSBroadcastEndpoint;
+
+#define WS_DEMO_MAX_LOOPS 64
+
+// the server can process reads on working threads: -m pool and -w
+#define WS_DEMO_WORKERS 1
+
+struct WSDemoOptions
+{
+    int port;
+    int num_loops;
+    // -m pool, and -w(0 if not given)
+    bool pool_mode;
+    int num_workers;
+    // -z, shared by every endpoint
+    bool use_deflate;
+    WSDeflateConfig deflate_config;
+    bool broadcast_mode;
+    bool pubsub_mode;
+    // -s and -q, for the send queue of every peer
+    WSSendLimits send_limits;
+    // -k and -i, for the endpoint of every peer
+    WSKeepaliveConfig keepalive_config;
+};
+
+/**
+* the command line of a demo server, and the endpoints of its peers. it
+* must outlive them.
+*/
+class WSDemo
+{
+public:
+    WSDemo();
+    ~WSDemo();
+
+    /**
+    * parse the command line. the usage is printed and the process exits
+    * if it is wrong.
+    * @param server the transport, e.g. "io_uring", for the messages
+    * @param features WS_DEMO_WORKERS, or 0
+    */
+    void parse(int argc, char **argv, const char *server, int features);
+
+    const WSDemoOptions &options() const { return options_; }
+    // the hub of -p, one shard per event loop. NULL without -p
+    WSPubSub *get_pubsub() { return pubsub_; }
+
+    /**
+    * the endpoint of a peer accepted by event loop index, with the options
+    * of the command line: an echo, or the endpoint of -b or -p, which is
+    * used by the loop thread only. delete it on that thread.
+    */
+    WebSocketEndpoint *create_endpoint(int index);
+
+private:
+    WSDemo(const WSDemo &);
+    WSDemo &operator=(const WSDemo &);
+
+    void usage(const char *prog, int features);
+
+private:
+    WSDemoOptions options_;
+    // -d, loaded once
+    WSDeflateDictionary dictionary_;
+    WSPubSub *pubsub_;
+    // -b, the endpoints of each event loop
+    WSBroadcastEndpoint **broadcast_peers_;
+};
+
+#endif //_WS_DEMO_H_
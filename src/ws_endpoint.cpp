@@ -21,19 +21,74 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include "ws_endpoint.h"
+#include "ws_log.h"
+
+WSKeepaliveConfig ws_keepalive_default_config()
+{
+    WSKeepaliveConfig config;
+    config.handshake_timeout = 10000;
+    config.ping_interval = 30000;
+    config.pong_timeout = 10000;
+    config.idle_timeout = 0;
+    return config;
+}
 
 WebSocketEndpoint::WebSocketEndpoint()
 {
     //networklayer_ = nt;
     nt_write_cb_ = NULL;
+    nt_work_data_ = NULL;
+    nt_write_shared_cb_ = NULL;
+    nt_shared_data_ = NULL;
+    nt_frame_write_cb_ = NULL;
+    nt_write_frame_cb_ = NULL;
     ws_handshake_completed_ = false;
+    message_opcode_ = 0;
+    streaming_ = false;
+    stream_frame_started_ = false;
+    stream_echo_opcode_ = 0;
+    blocking_ = false;
+    close_sent_ = false;
+    deflate_config_ = NULL;
+    ws_utf8_reset(inflate_utf8_);
+    deflate_dictionary_ = NULL;
+    dictionary_enabled_ = false;
+    keepalive_ = NULL;
+    ka_delay_ = 0;
+    ka_idle_ = 0;
+    ka_received_ = false;
+    ka_active_ = false;
+    ka_ping_sent_ = false;
+    ka_closing_ = false;
 }
 
 WebSocketEndpoint::WebSocketEndpoint(nt_write_cb write_cb)
 {
     //networklayer_ = nt;
     nt_write_cb_ = write_cb;
+    nt_work_data_ = NULL;
+    nt_write_shared_cb_ = NULL;
+    nt_shared_data_ = NULL;
+    nt_frame_write_cb_ = NULL;
+    nt_write_frame_cb_ = NULL;
     ws_handshake_completed_ = false;
+    message_opcode_ = 0;
+    streaming_ = false;
+    stream_frame_started_ = false;
+    stream_echo_opcode_ = 0;
+    blocking_ = false;
+    close_sent_ = false;
+    deflate_config_ = NULL;
+    ws_utf8_reset(inflate_utf8_);
+    deflate_dictionary_ = NULL;
+    dictionary_enabled_ = false;
+    keepalive_ = NULL;
+    ka_delay_ = 0;
+    ka_idle_ = 0;
+    ka_received_ = false;
+    ka_active_ = false;
+    ka_ping_sent_ = false;
+    ka_closing_ = false;
 }
 
 WebSocketEndpoint::~WebSocketEndpoint() {}
@@ -47,7 +102,7 @@ int32_t WebSocketEndpoint::process(const char *readbuf, int32_t size, nt_write_c
 {
     if (write_cb == NULL || work_data == NULL)
     {
-        std::cout << "WebSocketEndpoint - Attention: write cb is NULL! It will skip current read buf!" << std::endl;
+        WS_WARN("WebSocketEndpoint - Attention: write cb is NULL! It will skip current read buf!");
         return 0;
     }
 
@@ -60,40 +115,82 @@ int32_t WebSocketEndpoint::process(const char *readbuf, int32_t size, nt_write_c
 int32_t WebSocketEndpoint::from_wire(const char *readbuf, int32_t size)
 {
     fromwire_buf_.append(readbuf, size);
-    std::cout<< "WebSocketEndpoint - set fromwire_buf, current length:"<<fromwire_buf_.length()<<std::endl;
-    while (true)
-    {
-        int64_t nrcv = parse_packet(fromwire_buf_);
-        if (nrcv > 0)
-        { // for next one
-            // clear used data
-            int64_t n_used = fromwire_buf_.getoft();
-            std::cout<< "WebSocketEndpoint - fromwire_buf: used data:"<<n_used <<" nrcv:"<<nrcv
-                <<" length:"<<fromwire_buf_.length()<<std::endl;
-            fromwire_buf_.erase(nrcv);
-            fromwire_buf_.resetoft();
-            if (fromwire_buf_.length() == 0)
-            {
-                return nrcv;
-            }
-            else
-            {
-                continue;
-            }
+    if (size > 0)
+    {
+        ka_received_ = true;
+    }
+    WS_TRACE("WebSocketEndpoint - set fromwire_buf, current length:%d", fromwire_buf_.length());
+
+    return parse_fromwire();
+}
+
+char *WebSocketEndpoint::wire_buffer(int32_t size)
+{
+    return fromwire_buf_.reserve(size);
+}
+
+char *WebSocketEndpoint::wire_buffer(int32_t size, int32_t *room)
+{
+    return fromwire_buf_.reserve(size, room);
+}
+
+int32_t WebSocketEndpoint::process_received(int32_t size, nt_write_cb write_cb, void *work_data)
+{
+    if (size > 0 && (write_cb == NULL || work_data == NULL))
+    {
+        WS_WARN("WebSocketEndpoint - Attention: write cb is NULL! It will skip current read buf!");
+        size = 0;
+    }
+
+    // keeps the room in use, or gives an unused one back
+    fromwire_buf_.commit(size);
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    nt_write_cb_ = write_cb;
+    nt_work_data_ = work_data;
+    ka_received_ = true;
+
+    WS_TRACE("WebSocketEndpoint - received in place, current length:%d", fromwire_buf_.length());
+    return parse_fromwire();
+}
+
+int32_t WebSocketEndpoint::parse_fromwire()
+{
+    // the connection has been failed, nothing after it is processed
+    if (close_sent_)
+    {
+        fromwire_buf_.erase(fromwire_buf_.length());
+        fromwire_buf_.resetoft();
+        return -1;
+    }
+
+    int64_t nrcv = 0;
+    while (fromwire_buf_.length() > 0)
+    {
+        nrcv = parse_packet(fromwire_buf_);
+
+        // the parser keeps its progress, so clear used data
+        // even if the packet is not completed yet
+        int64_t n_used = fromwire_buf_.getoft();
+        WS_TRACE("WebSocketEndpoint - fromwire_buf: used data:%lld nrcv:%lld length:%d",
+                 (long long)n_used, (long long)nrcv, fromwire_buf_.length());
+        fromwire_buf_.erase(n_used);
+        fromwire_buf_.resetoft();
+
+        if (nrcv < 0)
+        {
+            return -1;
         }
         else if (nrcv == 0)
         { // contueue recving
-            fromwire_buf_.resetoft();
             break;
         }
-        else
-        {
-            return -1;
-        }
     }
 
-    // make it happy
-    return 0;
+    return nrcv;
 }
 
 int32_t WebSocketEndpoint::to_wire(const char *writebuf, int64_t size)
@@ -108,11 +205,22 @@ int32_t WebSocketEndpoint::to_wire(const char *writebuf, int64_t size)
     return 0;
 }
 
+int32_t WebSocketEndpoint::to_wire(ByteBuffer &frame)
+{
+    if (nt_write_frame_cb_ == NULL || nt_write_cb_ != nt_frame_write_cb_ || nt_work_data_ == NULL || frame.length() <= 0)
+    {
+        return to_wire(frame.bytes(), frame.length());
+    }
+
+    nt_write_frame_cb_(frame, nt_work_data_);
+    return 0;
+}
+
 int64_t WebSocketEndpoint::parse_packet(ByteBuffer &input)
 {
-    WebSocketPacket wspacket;
     if (!ws_handshake_completed_)
     {
+        WebSocketPacket wspacket;
         uint32_t nstatus = 0;
         nstatus = wspacket.recv_handshake(input);
         if (nstatus != 0)
@@ -127,18 +235,61 @@ int64_t WebSocketEndpoint::parse_packet(ByteBuffer &input)
             return 0;
         }
 
+        // the dictionary subprotocol compresses on its own
+        if (deflate_dictionary_ != NULL && deflate_dictionary_->is_loaded() &&
+            wspacket.has_hs_protocol(deflate_dictionary_->get_protocol().c_str()))
+        {
+            wspacket.set_hs_protocol(deflate_dictionary_->get_protocol());
+            dictionary_enabled_ = true;
+            // a message is decoded whole, so frames are not handed out in pieces
+            rx_packet_.set_stream_payload(false);
+        }
+
+        int32_t offers_length = 0;
+        const char *offers = wspacket.get_hs_header(WSHeader_SecWebSocketExtensions, &offers_length);
+        WSDeflateParams params;
+        if (deflate_config_ != NULL && !dictionary_enabled_ && offers_length > 0 &&
+            ws_deflate_negotiate(offers, offers_length, *deflate_config_, params))
+        {
+            // may give up context takeover, so answer with what it keeps
+            deflate_.start(deflate_config_, params);
+            std::string extensions;
+            ws_deflate_response(params, extensions);
+            wspacket.set_hs_extensions(extensions);
+            rx_packet_.set_compression(true);
+        }
+
         std::string hs_rsp;
         wspacket.pack_handshake_rsp(hs_rsp);
         to_wire(hs_rsp.c_str(), hs_rsp.length());
         ws_handshake_completed_ = true;
-        std::cout << "WebsocketEndpont - handshake successful!" << std::endl
-                  << std::endl;
+        ka_active_ = true;
+        WS_DEBUG("WebsocketEndpont - handshake successful!");
 
         return wspacket.get_hs_length();
     }
     else
     {
-        uint64_t ndf = wspacket.recv_dataframe(input);
+        int64_t ndf = rx_packet_.recv_dataframe(input);
+        if (ndf < 0)
+        {
+            if (rx_packet_.get_close_status() != 0)
+            {
+                send_close(rx_packet_.get_close_status());
+            }
+            return -1;
+        }
+
+        if (rx_packet_.header_parsed() && rx_packet_.get_opcode() < WebSocketPacket::WSOpcode_Close)
+        {
+            ka_active_ = true;
+        }
+
+        if (streaming_ && !dictionary_enabled_ && rx_packet_.header_parsed() &&
+            rx_packet_.get_opcode() < WebSocketPacket::WSOpcode_Close)
+        {
+            return stream_dataframe(ndf);
+        }
 
         // continue recving data until get an entire frame
         if (ndf == 0)
@@ -146,66 +297,448 @@ int64_t WebSocketEndpoint::parse_packet(ByteBuffer &input)
             return 0;
         }
 
-        if (ndf > 0xFFFFFFFF)
+        // it may refer into input, which is not erased before we return
+        const ByteView &payload = rx_packet_.get_payload_view();
+
+        // control frames may come between the fragments of a message
+        if (rx_packet_.get_opcode() >= WebSocketPacket::WSOpcode_Close)
         {
-            std::cout << "Attention:frame data length exceeds the max value of a uint32_t varable!" << std::endl;
+            process_message_data(rx_packet_, payload);
+            rx_packet_.reset();
+            return ndf;
         }
 
-        ByteBuffer &payload = wspacket.get_payload();
+        if (rx_packet_.is_compressed_message())
+        {
+            if (rx_packet_.get_opcode() != WebSocketPacket::WSOpcode_Continue)
+            {
+                message_opcode_ = rx_packet_.get_opcode();
+            }
+
+            // fragments are inflated as they come, only the inflated
+            // message is kept
+            bool last = rx_packet_.get_fin() == 1;
+            int32_t status = inflate_payload(payload.bytes(), payload.length(), last, message_data_);
+            if (status != 0)
+            {
+                send_close(status);
+                return -1;
+            }
+            if (last)
+            {
+                rx_packet_.set_opcode(message_opcode_);
+                process_message_data(rx_packet_, ByteView(message_data_));
+                message_data_.erase(message_data_.length());
+                message_data_.resetoft();
+            }
+            rx_packet_.reset();
+            return ndf;
+        }
+
+        if (rx_packet_.get_opcode() != WebSocketPacket::WSOpcode_Continue)
+        {
+            message_opcode_ = rx_packet_.get_opcode();
+
+            // a single frame message needs no reassembly
+            if (rx_packet_.get_fin() == 1)
+            {
+                if (deliver_message(payload) < 0)
+                {
+                    return -1;
+                }
+                rx_packet_.reset();
+                return ndf;
+            }
+        }
         message_data_.append(payload.bytes(), payload.length());
 
         // now, we have a entire frame
-        if (wspacket.get_fin() == 1)
+        if (rx_packet_.get_fin() == 1)
         {
-            process_message_data(wspacket, message_data_);
+            // the last fragment carries a continue opcode, report the
+            // opcode of the message instead
+            rx_packet_.set_opcode(message_opcode_);
+            int32_t rc = deliver_message(ByteView(message_data_));
             message_data_.erase(message_data_.length());
             message_data_.resetoft();
-            return ndf;
+            if (rc < 0)
+            {
+                return -1;
+            }
         }
 
+        rx_packet_.reset();
         return ndf;
     }
 
     return -1;
 }
 
-int32_t WebSocketEndpoint::process_message_data(WebSocketPacket &packet, ByteBuffer &frame_payload)
+int64_t WebSocketEndpoint::stream_dataframe(int64_t ndf)
+{
+    if (!stream_frame_started_)
+    {
+        stream_frame_started_ = true;
+        if (rx_packet_.get_opcode() != WebSocketPacket::WSOpcode_Continue)
+        {
+            message_opcode_ = rx_packet_.get_opcode();
+            process_message_begin(rx_packet_);
+        }
+    }
+
+    // hand over what this call has unmasked in place
+    const ByteView &payload = rx_packet_.get_payload_view();
+    bool compressed = rx_packet_.is_compressed_message();
+    bool last = ndf > 0 && rx_packet_.get_fin() == 1;
+    if (compressed && (payload.length() > 0 || last))
+    {
+        int32_t status = inflate_payload(payload.bytes(), payload.length(), last, inflate_buf_);
+        if (status != 0)
+        {
+            send_close(status);
+            return -1;
+        }
+        if (inflate_buf_.length() > 0)
+        {
+            process_message_chunk(rx_packet_, inflate_buf_.bytes(), inflate_buf_.length());
+            inflate_buf_.erase(inflate_buf_.length());
+            inflate_buf_.resetoft();
+        }
+    }
+    else if (payload.length() > 0)
+    {
+        process_message_chunk(rx_packet_, payload.bytes(), payload.length());
+    }
+
+    // continue recving data until get an entire frame
+    if (ndf == 0)
+    {
+        return 0;
+    }
+
+    stream_frame_started_ = false;
+    if (last)
+    {
+        rx_packet_.set_opcode(message_opcode_);
+        process_message_end(rx_packet_);
+    }
+
+    rx_packet_.reset();
+    return ndf;
+}
+
+int32_t WebSocketEndpoint::inflate_payload(const char *data, int64_t size, bool last, ByteBuffer &out)
+{
+    int begin = out.length();
+    int32_t status = deflate_.decompress(data, size, out);
+    if (status == 0 && last)
+    {
+        status = deflate_.finish_message(out);
+    }
+
+    // the inflated text is validated piece by piece, like an uncompressed one
+    if (status == 0 && message_opcode_ == WebSocketPacket::WSOpcode_Text)
+    {
+        if (!ws_utf8_validate(inflate_utf8_, out.bytes() + begin, out.length() - begin) ||
+            (last && !ws_utf8_complete(inflate_utf8_)))
+        {
+            WS_WARN("WebSocketEndpoint - inflated text message is not valid utf-8!");
+            status = WS_CLOSE_INVALID_PAYLOAD;
+        }
+    }
+    if (last)
+    {
+        ws_utf8_reset(inflate_utf8_);
+    }
+    return status;
+}
+
+int32_t WebSocketEndpoint::deliver_message(const ByteView &message)
+{
+    if (!dictionary_enabled_)
+    {
+        process_message_data(rx_packet_, message);
+        return 0;
+    }
+
+    // every message of the subprotocol is binary, with a flags byte
+    uint8_t opcode = WebSocketPacket::WSOpcode_Binary;
+    int32_t status = WS_CLOSE_UNSUPPORTED_DATA;
+    if (rx_packet_.get_opcode() == WebSocketPacket::WSOpcode_Binary)
+    {
+        status = deflate_dictionary_->decompress(message.bytes(), message.length(), opcode, inflate_buf_);
+    }
+    if (status == 0 && opcode == WebSocketPacket::WSOpcode_Text)
+    {
+        WSUtf8State state;
+        ws_utf8_reset(state);
+        if (!ws_utf8_validate(state, inflate_buf_.bytes(), inflate_buf_.length()) ||
+            !ws_utf8_complete(state))
+        {
+            WS_WARN("WebSocketEndpoint - decoded text message is not valid utf-8!");
+            status = WS_CLOSE_INVALID_PAYLOAD;
+        }
+    }
+    if (status == 0)
+    {
+        rx_packet_.set_opcode(opcode);
+        process_message_data(rx_packet_, ByteView(inflate_buf_));
+    }
+    inflate_buf_.erase(inflate_buf_.length());
+    inflate_buf_.resetoft();
+
+    if (status != 0)
+    {
+        send_close(status);
+        return -1;
+    }
+    return 0;
+}
+
+int32_t WebSocketEndpoint::send_message(uint8_t opcode, const char *data, int64_t size)
+{
+    WebSocketPacket wspacket;
+    wspacket.set_fin(1);
+    wspacket.set_opcode(opcode);
+    wspacket.set_payload_view(data, size);
+    if (opcode < WebSocketPacket::WSOpcode_Close)
+    {
+        ka_active_ = true;
+    }
+
+    // control frames are never compressed
+    if (opcode < WebSocketPacket::WSOpcode_Close && dictionary_enabled_)
+    {
+        int32_t n = deflate_dictionary_->compress(opcode, data, size, deflate_buf_);
+        if (n < 0)
+        {
+            return -1;
+        }
+        wspacket.set_opcode(WebSocketPacket::WSOpcode_Binary);
+        wspacket.set_payload_view(deflate_buf_.bytes(), n);
+    }
+    else if (opcode < WebSocketPacket::WSOpcode_Close && deflate_.should_compress(size))
+    {
+        int32_t n = deflate_.compress(data, size, deflate_buf_);
+        if (n >= 0)
+        {
+            wspacket.set_rsv1(1);
+            wspacket.set_payload_view(deflate_buf_.bytes(), n);
+        }
+    }
+
+    ByteBuffer output;
+    wspacket.pack_dataframe(output);
+    deflate_buf_.erase(deflate_buf_.length());
+    deflate_buf_.resetoft();
+    return to_wire(output);
+}
+
+int32_t WebSocketEndpoint::send_shared(WSSharedFrame *frame)
+{
+    if (frame == NULL || !ws_handshake_completed_ || close_sent_)
+    {
+        return -1;
+    }
+    // the bytes are final, they can't be encoded for this connection
+    const WSDeflateDictionary *dictionary = dictionary_enabled_ ? deflate_dictionary_ : NULL;
+    if (frame->get_dictionary() != dictionary)
+    {
+        return -1;
+    }
+    ka_active_ = true;
+
+    if (nt_write_shared_cb_ != NULL)
+    {
+        nt_write_shared_cb_(frame, nt_shared_data_);
+        return 0;
+    }
+    return to_wire(frame->bytes(), frame->length());
+}
+
+int32_t WebSocketEndpoint::send_close(uint16_t status)
+{
+    if (close_sent_)
+    {
+        return 0;
+    }
+    close_sent_ = true;
+
+    char body[2];
+    body[0] = (char)(status >> 8);
+    body[1] = (char)(status & 0xFF);
+
+    WebSocketPacket wspacket;
+    wspacket.set_fin(1);
+    wspacket.set_opcode(WebSocketPacket::WSOpcode_Close);
+    wspacket.set_payload_view(body, sizeof(body));
+    char frame[WS_MAX_FRAME_HEADER_SIZE + sizeof(body)];
+    int32_t size = wspacket.pack_dataframe(frame, sizeof(frame));
+    if (size < 0)
+    {
+        return -1;
+    }
+    WS_DEBUG("WebSocketEndpoint - fail the connection with status %d", (int)status);
+    return to_wire(frame, size);
+}
+
+uint32_t WebSocketEndpoint::keepalive_start()
+{
+    ka_idle_ = 0;
+    ka_received_ = false;
+    ka_active_ = false;
+    ka_ping_sent_ = false;
+    ka_closing_ = false;
+    ka_delay_ = 0;
+    if (keepalive_ == NULL)
+    {
+        return 0;
+    }
+
+    ka_delay_ = keepalive_->ping_interval > 0 ? keepalive_->ping_interval : keepalive_->idle_timeout;
+    if (!ws_handshake_completed_ && keepalive_->handshake_timeout > 0 &&
+        (ka_delay_ == 0 || keepalive_->handshake_timeout < ka_delay_))
+    {
+        ka_delay_ = keepalive_->handshake_timeout;
+    }
+    return ka_delay_;
+}
+
+int64_t WebSocketEndpoint::on_keepalive_timer(nt_write_cb write_cb, void *work_data, bool reads_paused)
+{
+    if (keepalive_ == NULL)
+    {
+        return 0;
+    }
+    if (reads_paused)
+    {
+        return keepalive_start();
+    }
+    if (write_cb != NULL)
+    {
+        nt_write_cb_ = write_cb;
+        nt_work_data_ = work_data;
+    }
+
+    if (!ws_handshake_completed_)
+    {
+        if (keepalive_->handshake_timeout == 0)
+        {
+            return ka_delay_;
+        }
+        // ka_idle_ counts the time since the connection was accepted
+        ka_idle_ += ka_delay_;
+        if (ka_idle_ >= keepalive_->handshake_timeout)
+        {
+            WS_DEBUG("WebSocketEndpoint - handshake timed out");
+            return -1;
+        }
+        if (keepalive_->handshake_timeout - ka_idle_ < ka_delay_)
+        {
+            ka_delay_ = keepalive_->handshake_timeout - ka_idle_;
+        }
+        return ka_delay_;
+    }
+
+    // a close frame has gone out, give the peer a while to answer it
+    if (close_sent_)
+    {
+        if (ka_closing_ || keepalive_->pong_timeout == 0)
+        {
+            return -1;
+        }
+        ka_closing_ = true;
+        return keepalive_->pong_timeout;
+    }
+
+    bool received = ka_received_;
+    bool active = ka_active_;
+    ka_received_ = false;
+    ka_active_ = false;
+
+    if (ka_ping_sent_ && !received)
+    {
+        WS_DEBUG("WebSocketEndpoint - no pong within %u ms", keepalive_->pong_timeout);
+        return -1;
+    }
+    ka_ping_sent_ = false;
+
+    ka_idle_ = active ? 0 : ka_idle_ + ka_delay_;
+    if (keepalive_->idle_timeout > 0 && ka_idle_ >= keepalive_->idle_timeout)
+    {
+        WS_DEBUG("WebSocketEndpoint - idle for %u ms", ka_idle_);
+        send_close(WS_CLOSE_GOING_AWAY);
+        ka_closing_ = true;
+        // the close frame is written out before the connection is closed
+        return keepalive_->pong_timeout > 0 ? keepalive_->pong_timeout : 1;
+    }
+
+    uint32_t next = keepalive_->ping_interval;
+    if (keepalive_->ping_interval > 0 && keepalive_->pong_timeout > 0 && !received)
+    {
+        // a ping is answered by a pong, anything else will do too
+        if (send_message(WebSocketPacket::WSOpcode_Ping, NULL, 0) < 0)
+        {
+            return -1;
+        }
+        ka_ping_sent_ = true;
+        next = keepalive_->pong_timeout;
+    }
+    if (next == 0)
+    {
+        next = keepalive_->idle_timeout;
+    }
+    // the idle timeout is checked no later than it expires
+    if (keepalive_->idle_timeout > 0 && keepalive_->idle_timeout - ka_idle_ < next)
+    {
+        next = keepalive_->idle_timeout - ka_idle_;
+    }
+    ka_delay_ = next;
+    return next;
+}
+
+int32_t WebSocketEndpoint::process_message_data(WebSocketPacket &packet, const ByteView &frame_payload)
 {
     //#ifdef _SHOW_OPCODE_
     switch (packet.get_opcode())
     {
     case WebSocketPacket::WSOpcode_Continue:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Continue opcode." << std::endl;
+        WS_TRACE("WebSocketEndpoint - recv a Continue opcode.");
         user_defined_process(packet, frame_payload);
         break;
     case WebSocketPacket::WSOpcode_Text:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Text opcode." << std::endl;
+        WS_TRACE("WebSocketEndpoint - recv a Text opcode.");
         user_defined_process(packet, frame_payload);
         break;
     case WebSocketPacket::WSOpcode_Binary:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Binary opcode." << std::endl;
+        WS_TRACE("WebSocketEndpoint - recv a Binary opcode.");
         user_defined_process(packet, frame_payload);
         break;
     case WebSocketPacket::WSOpcode_Close:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Close opcode." << std::endl;
+        WS_TRACE("WebSocketEndpoint - recv a Close opcode.");
         user_defined_process(packet, frame_payload);
         break;
     case WebSocketPacket::WSOpcode_Ping:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Ping opcode." << std::endl;
-        user_defined_process(packet, frame_payload);
+        // answered by a pong with the same payload(RFC6455 5.5.2), unless
+        // the connection is closing
+        WS_TRACE("WebSocketEndpoint - recv a Ping opcode.");
+        if (!close_sent_)
+        {
+            send_message(WebSocketPacket::WSOpcode_Pong, frame_payload.bytes(), frame_payload.length());
+        }
         break;
     case WebSocketPacket::WSOpcode_Pong:
         // add your process code here
-        std::cout << "WebSocketEndpoint - recv a Pong opcode." << std::endl;
-        user_defined_process(packet, frame_payload);
+        // the answer to a keepalive ping, it is not answered
+        WS_TRACE("WebSocketEndpoint - recv a Pong opcode.");
         break;
     default:
-        std::cout << "WebSocketEndpoint - recv an unknown opcode." << std::endl;
+        WS_WARN("WebSocketEndpoint - recv an unknown opcode.");
         break;
     }
     //#endif
@@ -214,22 +747,56 @@ int32_t WebSocketEndpoint::process_message_data(WebSocketPacket &packet, ByteBuf
 
 // we directly return what we get from client
 // user could modify this function
-int32_t WebSocketEndpoint::user_defined_process(WebSocketPacket &packet, ByteBuffer &frame_payload)
+int32_t WebSocketEndpoint::user_defined_process(WebSocketPacket &packet, const ByteView &frame_payload)
 {
     // print received websocket payload from client
-    std::string str_recv(frame_payload.bytes(), frame_payload.length());
-    std::cout << "WebSocketEndpoint - received data, length:" << str_recv.length()
-              << " ,content:" << str_recv.c_str() << std::endl;
+    WS_TRACE("WebSocketEndpoint - received data, length:%lld ,content:%.*s",
+             (long long)frame_payload.length(), (int)frame_payload.length(),
+             frame_payload.length() > 0 ? frame_payload.bytes() : "");
+
+    // pack a websocket frame, compressed if permessage-deflate is on, and
+    // send it to client
+    send_message(packet.get_opcode(), frame_payload.bytes(), frame_payload.length());
+    return 0;
+}
 
+// in streaming mode we return what we get from client as a fragmented message
+// user could modify those functions
+int32_t WebSocketEndpoint::process_message_begin(WebSocketPacket &packet)
+{
+    WS_TRACE("WebSocketEndpoint - message begins, opcode:%d", (int)packet.get_opcode());
+    stream_echo_opcode_ = packet.get_opcode();
+    return 0;
+}
+
+int32_t WebSocketEndpoint::process_message_chunk(WebSocketPacket &packet, const char *data, int64_t size)
+{
+    WS_TRACE("WebSocketEndpoint - received message chunk, length:%lld", (long long)size);
+
+    WebSocketPacket wspacket;
+    // not the last fragment
+    wspacket.set_fin(0);
+    wspacket.set_opcode(stream_echo_opcode_);
+    wspacket.set_payload_view(data, size);
+    ByteBuffer output;
+    wspacket.pack_dataframe(output);
+    to_wire(output);
+
+    // the following fragments continue this message
+    stream_echo_opcode_ = WebSocketPacket::WSOpcode_Continue;
+    return 0;
+}
+
+int32_t WebSocketEndpoint::process_message_end(WebSocketPacket &packet)
+{
+    WS_TRACE("WebSocketEndpoint - message ends, opcode:%d", (int)packet.get_opcode());
+
+    // an empty final fragment
     WebSocketPacket wspacket;
-    // set FIN and opcode
     wspacket.set_fin(1);
-    wspacket.set_opcode(packet.get_opcode());
-    // set payload data
-    wspacket.set_payload(frame_payload.bytes(), frame_payload.length());
+    wspacket.set_opcode(stream_echo_opcode_);
     ByteBuffer output;
-    // pack a websocket data frame
     wspacket.pack_dataframe(output);
-    // send to client
-    to_wire(output.bytes(), output.length());
+    to_wire(output);
+    return 0;
 }
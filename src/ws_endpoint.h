@@ -32,8 +32,32 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <string>
 #include <stdint.h>
 #include "ws_packet.h"
+#include "ws_deflate.h"
+#include "ws_shared_frame.h"
 
 typedef void (*nt_write_cb)(char * buf,int64_t size, void* wd);
+// queue a shared frame by reference: take a ref() and unref() it once sent
+typedef void (*nt_write_shared_cb)(WSSharedFrame * frame, void* wd);
+// takes the memory of a packed frame(ByteBuffer::detach) instead of a copy
+typedef void (*nt_write_frame_cb)(ByteBuffer & frame, void* wd);
+
+// keepalive of a connection, times in milliseconds. 0 turns a check off
+struct WSKeepaliveConfig
+{
+    // the handshake must be completed within it
+    uint32_t handshake_timeout;
+    // a ping is sent after this long without anything received
+    uint32_t ping_interval;
+    // the peer is gone if nothing comes within it after a ping, and a
+    // closing handshake must be completed within it
+    uint32_t pong_timeout;
+    // the connection is closed(status 1001) after this long without data
+    // messages either way
+    uint32_t idle_timeout;
+};
+
+// handshake 10s, ping 30s, pong 10s, no idle timeout
+WSKeepaliveConfig ws_keepalive_default_config();
 
 class WebSocketEndpoint
 {
@@ -53,18 +77,147 @@ public:
     // receive data from wire until we get an entire handshake or frame data packet
     virtual int32_t from_wire(const char * readbuf, int32_t size);
 
+    // receive from wire straight into the endpoint without a copy: get room
+    // for size bytes, let the transport read into it, then call
+    // process_received with the number of bytes read. the room is only
+    // valid until the next call to the endpoint.
+    virtual char * wire_buffer(int32_t size);
+    // the same, but room is set to what is left of the memory the endpoint
+    // already has, up to size, so a partial frame does not make it grow.
+    virtual char * wire_buffer(int32_t size, int32_t *room);
+    virtual int32_t process_received(int32_t size, nt_write_cb write_cb, void* work_data);
+
+    // where received data is kept, e.g. a receive pool of the event loop.
+    // alloc must outlive the endpoint. it is used from the thread that
+    // calls process_received, and must be thread safe for a blocking
+    // endpoint, whose reads may be processed on any thread of a pool.
+    void set_recv_allocator(BufferAllocator * alloc) { fromwire_buf_.set_allocator(alloc); }
+
     // try to find and parse a websocket packet
     virtual int64_t parse_packet(ByteBuffer& input);
 
     // process message data
     // users should rewrite this function 
-    virtual int32_t process_message_data(WebSocketPacket& packet, ByteBuffer& frame_payload);
+    // frame_payload refers into the receive buffer when the message is a single
+    // frame, so it is only valid during the call.
+    virtual int32_t process_message_data(WebSocketPacket& packet, const ByteView& frame_payload);
 
     // user defined process
-    virtual int32_t user_defined_process(WebSocketPacket& packet, ByteBuffer& frame_payload);
+    virtual int32_t user_defined_process(WebSocketPacket& packet, const ByteView& frame_payload);
+
+    // streaming mode: data messages are not reassembled. each unmasked piece
+    // of payload is handed to process_message_chunk as soon as it arrives,
+    // so memory does not grow with the message size. control frames are
+    // still delivered whole to process_message_data.
+    void set_streaming(bool streaming)
+    {
+        streaming_ = streaming;
+        rx_packet_.set_stream_payload(streaming);
+    }
+    bool is_streaming() { return streaming_; }
+
+    // a blocking endpoint may wait in its handlers(disk, database...).
+    // the demo server then processes its reads on the thread pool instead
+    // of the event loop thread. the receive allocator is reset to the
+    // default pool then, as a pool of the loop thread may not be thread
+    // safe; call set_recv_allocator afterwards to pick another.
+    void set_blocking(bool blocking)
+    {
+        if (blocking && !blocking_)
+        {
+            fromwire_buf_.set_allocator(NULL);
+        }
+        blocking_ = blocking;
+    }
+    bool is_blocking() { return blocking_; }
+
+    // offer permessage-deflate(RFC7692) in the handshake. config must
+    // outlive the endpoint, NULL(the default) turns it off. call it before
+    // the handshake.
+    void set_deflate(const WSDeflateConfig * config) { deflate_config_ = config; }
+    bool is_deflate_enabled() { return deflate_.is_enabled(); }
+
+    // offer the subprotocol of a preset dictionary(WSDeflateDictionary)
+    // in the handshake. a client that lists it gets no permessage-deflate,
+    // and its messages are delivered whole even in streaming mode.
+    // dictionary must outlive the endpoint, NULL(the default) turns it off.
+    void set_deflate_dictionary(const WSDeflateDictionary * dictionary) { deflate_dictionary_ = dictionary; }
+    bool is_dictionary_enabled() { return dictionary_enabled_; }
+
+    // send a whole message in one frame, compressed if permessage-deflate
+    // is on and the message is long enough
+    virtual int32_t send_message(uint8_t opcode, const char * data, int64_t size);
+
+    // the transport queue of this connection for shared frames. wd must
+    // stay valid as long as the endpoint, unlike the work data of
+    // process(), since shared frames are also sent between passes, e.g.
+    // by a broadcast. cb is called on the thread calling send_shared.
+    void set_shared_writer(nt_write_shared_cb cb, void* wd) { nt_write_shared_cb_ = cb; nt_shared_data_ = wd; }
+
+    // the write callback for frames sent between process() calls, e.g. a
+    // send_close of the transport. process() and process_received() set
+    // their own, which may not be valid any more when they have returned.
+    void set_writer(nt_write_cb cb, void* wd) { nt_write_cb_ = cb; nt_work_data_ = wd; }
+
+    // frames packed while write_cb is the write callback go to frame_cb,
+    // with the same work data, which takes their memory rather than a copy.
+    // other write callbacks, e.g. the outbox of a worker thread, still copy.
+    void set_frame_writer(nt_write_cb write_cb, nt_write_frame_cb frame_cb) { nt_frame_write_cb_ = write_cb; nt_write_frame_cb_ = frame_cb; }
+
+    // send a frame packed once for many connections(see WSSharedFrame). it
+    // is not compressed by permessage-deflate, and a connection on the
+    // dictionary subprotocol only takes frames made with its dictionary.
+    // without a shared writer the frame is copied by to_wire.
+    // return 0, or -1 if the connection can't take it: no handshake yet,
+    // closing, or another encoding.
+    virtual int32_t send_shared(WSSharedFrame * frame);
 
-    // send data to wire 
+    // streaming mode: the first frame of a message has arrived.
+    // packet.get_opcode() tells the message type.
+    // users should rewrite this function
+    virtual int32_t process_message_begin(WebSocketPacket& packet);
+
+    // streaming mode: next piece of message payload. it is only valid during the call.
+    // users should rewrite this function
+    virtual int32_t process_message_chunk(WebSocketPacket& packet, const char * data, int64_t size);
+
+    // streaming mode: the last frame of a message is completed
+    // users should rewrite this function
+    virtual int32_t process_message_end(WebSocketPacket& packet);
+
+    // send data to wire. each call hands one whole frame, or the handshake
+    // response, to the write callback, so the transport can queue them in a
+    // WSSendQueue to bound what a slow peer holds
     virtual int32_t to_wire(const char * writebuf, int64_t size);
+    // send a frame packed by the endpoint, handed over to the frame writer
+    // if there is one for the current write callback. frame may be left empty
+    virtual int32_t to_wire(ByteBuffer & frame);
+
+    // start the closing handshake with a close frame of status, e.g.
+    // WS_CLOSE_INVALID_PAYLOAD. the endpoint drops whatever it receives
+    // after it, the transport should close the connection.
+    virtual int32_t send_close(uint16_t status);
+    bool is_close_sent() { return close_sent_; }
+
+    // keepalive: ping a quiet peer, and time out a dead peer, a slow
+    // handshake or an idle connection. a peer is pinged once it has sent
+    // nothing for a whole ping interval, so 1 to 2 intervals after the
+    // last thing it sent. config must outlive the endpoint,
+    // NULL(the default) turns it off. the endpoint reads no clock: the
+    // transport runs one timer per connection(e.g. on a WSTimerWheel of
+    // its event loop), started with keepalive_start() when the connection
+    // is accepted, and calls on_keepalive_timer when it expires.
+    void set_keepalive(const WSKeepaliveConfig * config) { keepalive_ = config; }
+    // the first delay of the timer, 0 if keepalive is off
+    uint32_t keepalive_start();
+    // pings and close frames are given to write_cb as in process(), so
+    // call it on the thread of the connection while it is not processing.
+    // reads_paused tells the transport does not read the peer(its send
+    // queue is full): the pong would not be read, and the peer is not
+    // idle, so the keepalive starts over.
+    // return the delay to start the timer again with, 0 to leave it
+    // stopped, or -1 if the connection has timed out and should be closed
+    int64_t on_keepalive_timer(nt_write_cb write_cb, void* work_data, bool reads_paused = false);
 
 private:
     bool ws_handshake_completed_;
@@ -72,8 +225,65 @@ private:
     ByteBuffer fromwire_buf_;
     ByteBuffer message_data_;
 
+    // frame parser, it keeps its state between from_wire calls
+    WebSocketPacket rx_packet_;
+    // opcode of the first fragment of current message
+    uint8_t message_opcode_;
+
+    bool streaming_;
+    // streaming mode: the header of rx_packet_ has been reported
+    bool stream_frame_started_;
+    // streaming mode: opcode of the next frame the default echo sends
+    uint8_t stream_echo_opcode_;
+
+    bool blocking_;
+    // a close frame has been sent, see send_close
+    bool close_sent_;
+
+    // keepalive: the delay the timer was started with, how long no data
+    // message has passed, and what happened since the timer was started
+    const WSKeepaliveConfig * keepalive_;
+    uint32_t ka_delay_;
+    uint32_t ka_idle_;
+    bool ka_received_;
+    bool ka_active_;
+    bool ka_ping_sent_;
+    bool ka_closing_;
+
+    // permessage-deflate
+    const WSDeflateConfig * deflate_config_;
+    WSDeflateSession deflate_;
+    // compressed output of send_message, inflated chunks in streaming mode
+    ByteBuffer deflate_buf_;
+    ByteBuffer inflate_buf_;
+    // utf-8 state of an inflated text message
+    WSUtf8State inflate_utf8_;
+    // preset dictionary subprotocol, offered and negotiated
+    const WSDeflateDictionary * deflate_dictionary_;
+    bool dictionary_enabled_;
+
+    // inflate a piece of a compressed message into out, and validate it if
+    // the message is text. last: the final frame is complete.
+    // return 0, or the status to close the connection with
+    int32_t inflate_payload(const char * data, int64_t size, bool last, ByteBuffer& out);
+
+    // hand a whole data message to process_message_data, decoding it first
+    // in the dictionary subprotocol. return 0, or -1 if the connection is
+    // failed.
+    int32_t deliver_message(const ByteView& message);
+
+    // hand the unmasked payload of rx_packet_ to the streaming callbacks
+    int64_t stream_dataframe(int64_t ndf);
+
+    // parse and consume what fromwire_buf_ holds
+    int32_t parse_fromwire();
+
     nt_write_cb nt_write_cb_;
     void * nt_work_data_;
+    nt_write_shared_cb nt_write_shared_cb_;
+    void * nt_shared_data_;
+    nt_write_cb nt_frame_write_cb_;
+    nt_write_frame_cb nt_write_frame_cb_;
 
 };
 #endif//_WS_SVR_HANDLER_H_
@@ -0,0 +1,809 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* a header only epoll transport for WebSocketEndpoint(linux), for programs
+* that have no event library of their own
+*/
+
+#ifndef _WS_EPOLL_REACTOR_H_
+#define _WS_EPOLL_REACTOR_H_
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "ws_endpoint.h"
+#include "ws_atomic.h"
+#include "ws_buffer_pool.h"
+#include "ws_send_queue.h"
+#include "ws_timer_wheel.h"
+#include "ws_log.h"
+
+class WSEpollReactor;
+
+/**
+* a connection of a WSEpollReactor: its socket, its endpoint and the
+* frames waiting for it. made by the reactor, and freed by it once closed.
+*/
+class WSEpollConnection
+{
+public:
+    int get_fd() const { return fd_; }
+    WebSocketEndpoint *get_endpoint() { return endpoint_; }
+    WSSendQueue &get_send_queue() { return sendq_; }
+    WSEpollReactor *get_reactor() { return reactor_; }
+    // the next connection of the reactor, NULL after the last one
+    WSEpollConnection *get_next() { return next_; }
+    bool is_closed() const { return closed_; }
+
+    // free for the user of the reactor
+    void *data;
+
+private:
+    friend class WSEpollReactor;
+
+    WSEpollConnection(WSEpollReactor *reactor, int fd, WebSocketEndpoint *endpoint,
+                      const WSSendLimits *limits)
+        : data(NULL), reactor_(reactor), fd_(fd), endpoint_(endpoint), sendq_(limits),
+          readable_(true), writable_(true), peer_shut_(false), read_paused_(false),
+          overflow_(false), shut_down_(false), closed_(false), dirty_(false), pending_(false),
+          prev_(NULL), next_(NULL), next_dirty_(NULL), next_pending_(NULL), next_closed_(NULL)
+    {
+    }
+
+    WSEpollConnection(const WSEpollConnection &);
+    WSEpollConnection &operator=(const WSEpollConnection &);
+
+private:
+    WSEpollReactor *reactor_;
+    int fd_;
+    WebSocketEndpoint *endpoint_;
+    // frames waiting for the peer, written with one sendmsg per flush
+    WSSendQueue sendq_;
+    // edge triggered: the socket may hold data not read yet, and took
+    // everything given to it since the last EAGAIN
+    bool readable_;
+    bool writable_;
+    // the peer shut its side down, or the socket failed: a short read
+    // does not mean the socket is drained, the end is still to be read
+    bool peer_shut_;
+    // the send queue is above its high watermark, received data stays in
+    // the socket until it is down to the low one
+    bool read_paused_;
+    // the send queue refused a frame, the peer is failed by the flush
+    bool overflow_;
+    // the close frame is written and the socket shut down for writing
+    bool shut_down_;
+    // closed, freed at the end of the loop iteration
+    bool closed_;
+    // links of the lists of the reactor
+    bool dirty_;
+    bool pending_;
+    WSEpollConnection *prev_;
+    WSEpollConnection *next_;
+    WSEpollConnection *next_dirty_;
+    WSEpollConnection *next_pending_;
+    WSEpollConnection *next_closed_;
+    WSTimer keepalive_;
+};
+
+/**
+* an event loop on epoll for websocket connections, without libuv:
+*   - connections are registered edge triggered. a readable one is read
+*     into WebSocketEndpoint::wire_buffer, whose memory comes from a slab
+*     pool of the reactor, until the socket is drained, and a few blocks
+*     at a time so that one busy peer does not hold up the others
+*   - frames the endpoint hands to its write callbacks are queued in the
+*     WSSendQueue of the connection, and every connection given frames is
+*     written once per loop iteration, the whole queue in one gather write
+*     (sendmsg, i.e. writev that raises no SIGPIPE)
+*   - reads stop above the high watermark of the send queue, so the peer
+*     is slowed down by TCP, and go on below the low one
+*   - wakeup() may be called from any thread. it writes an eventfd, and
+*     the loop thread then calls on_wakeup(), e.g. to call
+*     WSPubSub::dispatch
+*   - keepalive timers of the endpoints(WebSocketEndpoint::set_keepalive)
+*     are run on a WSTimerWheel of the reactor
+*
+* derive from it to make the endpoints of accepted connections(on_accept)
+* and to learn when they are gone(on_close). run a reactor per thread,
+* e.g. each with its own SO_REUSEPORT listener.
+* @remark not thread safe, except wakeup() and stop(). endpoints may
+*       send(send_message, send_shared) from the loop thread at any time,
+*       the frames are written at the end of the iteration.
+*/
+class WSEpollReactor
+{
+public:
+    enum
+    {
+        // receive blocks of the pool, one read takes at most one
+        RECV_BLOCK_SIZE = 64 * 1024,
+        RECV_BLOCKS_PER_SLAB = 16,
+        // reads of a connection per iteration before the others get a turn
+        READ_BUDGET = 4,
+        // connections accepted from a listener per iteration
+        ACCEPT_BUDGET = 64,
+        MAX_EVENTS = 256,
+        // most pieces of the send queue given to one sendmsg
+        WRITE_MAX_BUFS = 64,
+        // keepalive timers are rounded to it
+        TICK_MS = 100
+    };
+
+public:
+    // limits of the send queue of every connection, it must outlive the
+    // reactor. NULL: unbounded
+    explicit WSEpollReactor(const WSSendLimits *limits = NULL)
+        : epoll_fd_(-1), wakeup_fd_(-1), wakeup_pending_(0), stop_(0), limits_(limits),
+          recv_pool_(RECV_BLOCK_SIZE, RECV_BLOCKS_PER_SLAB), timers_(TICK_MS, now_ms()),
+          next_tick_(0), connections_(NULL), count_(0), dirty_(NULL), pending_(NULL),
+          closed_(NULL)
+    {
+    }
+
+    // closes the connections left, on_close of a derived class is not
+    // called from here: call close_all() in its destructor for that
+    virtual ~WSEpollReactor()
+    {
+        close_all();
+        free_closed();
+        if (wakeup_fd_ >= 0)
+        {
+            ::close(wakeup_fd_);
+        }
+        if (epoll_fd_ >= 0)
+        {
+            ::close(epoll_fd_);
+        }
+    }
+
+    // make the epoll and eventfd descriptors. return 0, or -errno
+    int init()
+    {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0)
+        {
+            return -errno;
+        }
+        wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeup_fd_ < 0)
+        {
+            return -errno;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = WAKEUP_TAG;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) < 0)
+        {
+            return -errno;
+        }
+        next_tick_ = now_ms() + TICK_MS;
+        return 0;
+    }
+
+    // accept connections from a listening socket, which is made non
+    // blocking. it is level triggered, so a connection left over by
+    // ACCEPT_BUDGET or a lack of descriptors is retried. the caller keeps
+    // the socket. return 0, or -errno
+    int add_listener(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        {
+            return -errno;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = ((uint64_t)fd << 1) | LISTENER_TAG;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            return -errno;
+        }
+        return 0;
+    }
+
+    /**
+    * serve a connected socket, which is made non blocking, with endpoint.
+    * the reactor owns both from now on and deletes the endpoint when the
+    * connection is closed.
+    * @return the connection, or NULL if it can't be watched. the caller
+    *       then keeps the socket and the endpoint.
+    */
+    WSEpollConnection *add_connection(int fd, WebSocketEndpoint *endpoint)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        {
+            WS_WARN("WSEpollReactor - fcntl failed: %s", strerror(errno));
+            return NULL;
+        }
+        WSEpollConnection *conn = new WSEpollConnection(this, fd, endpoint, limits_);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t)(uintptr_t)conn;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            WS_WARN("WSEpollReactor - epoll_ctl failed: %s", strerror(errno));
+            delete conn;
+            return NULL;
+        }
+        endpoint->set_recv_allocator(&recv_pool_);
+        endpoint->set_shared_writer(on_write_shared, conn);
+        endpoint->set_frame_writer(on_write, on_write_frame);
+
+        conn->next_ = connections_;
+        if (connections_ != NULL)
+        {
+            connections_->prev_ = conn;
+        }
+        connections_ = conn;
+        count_++;
+
+        WSTimerWheel::init(&conn->keepalive_, on_keepalive, conn);
+        uint32_t delay = endpoint->keepalive_start();
+        if (delay > 0)
+        {
+            timers_.start(&conn->keepalive_, delay);
+        }
+        // edge triggered: data that came before the socket was added
+        // raises no event
+        mark_pending(conn);
+        return conn;
+    }
+
+    // close a connection at once, without a closing handshake. on_close is
+    // called and the endpoint deleted, the connection itself is freed at
+    // the end of the loop iteration
+    void close_connection(WSEpollConnection *conn)
+    {
+        if (conn->closed_)
+        {
+            return;
+        }
+        conn->closed_ = true;
+        if (conn->prev_ != NULL)
+        {
+            conn->prev_->next_ = conn->next_;
+        }
+        else
+        {
+            connections_ = conn->next_;
+        }
+        if (conn->next_ != NULL)
+        {
+            conn->next_->prev_ = conn->prev_;
+        }
+        count_--;
+        timers_.stop(&conn->keepalive_);
+
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd_, NULL);
+        ::close(conn->fd_);
+        on_close(conn);
+        delete conn->endpoint_;
+        conn->endpoint_ = NULL;
+        // it may still be on the dirty or pending list, and have events
+        // in this iteration
+        conn->next_closed_ = closed_;
+        closed_ = conn;
+    }
+
+    void close_all()
+    {
+        while (connections_ != NULL)
+        {
+            close_connection(connections_);
+        }
+    }
+
+    /**
+    * wait up to timeout_ms(-1: no limit) for events, handle them, run the
+    * expired timers and write what was queued
+    * @return events handled, or -errno if epoll_wait failed
+    */
+    int run_once(int timeout_ms)
+    {
+        if (pending_ != NULL || dirty_ != NULL)
+        {
+            timeout_ms = 0;
+        }
+        else if (timers_.size() > 0)
+        {
+            uint64_t now = now_ms();
+            int tick = next_tick_ > now ? (int)(next_tick_ - now) : 0;
+            if (timeout_ms < 0 || tick < timeout_ms)
+            {
+                timeout_ms = tick;
+            }
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout_ms);
+        if (n < 0)
+        {
+            if (errno != EINTR)
+            {
+                return -errno;
+            }
+            n = 0;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t tag = events[i].data.u64;
+            if (tag == WAKEUP_TAG)
+            {
+                uint64_t count;
+                ssize_t rc = ::read(wakeup_fd_, &count, sizeof(count));
+                (void)rc;
+                // wakeups from now on write the eventfd again
+                ws_atomic_swap(&wakeup_pending_, 0);
+                on_wakeup();
+            }
+            else if (tag & LISTENER_TAG)
+            {
+                accept_connections((int)(tag >> 1));
+            }
+            else
+            {
+                on_connection_event((WSEpollConnection *)(uintptr_t)tag, events[i].events);
+            }
+        }
+
+        // connections that are still readable after their budget, or were
+        // resumed by the last flush
+        WSEpollConnection *conn = pending_;
+        pending_ = NULL;
+        while (conn != NULL)
+        {
+            WSEpollConnection *next = conn->next_pending_;
+            conn->pending_ = false;
+            if (!conn->closed_)
+            {
+                read_connection(conn);
+            }
+            conn = next;
+        }
+
+        uint64_t now = now_ms();
+        if (now >= next_tick_)
+        {
+            timers_.advance(now);
+            next_tick_ = now + TICK_MS;
+        }
+
+        // every connection given frames in this iteration is written once
+        while (dirty_ != NULL)
+        {
+            conn = dirty_;
+            dirty_ = conn->next_dirty_;
+            conn->dirty_ = false;
+            flush(conn);
+        }
+        free_closed();
+        return n;
+    }
+
+    // run until stop() is called
+    void run()
+    {
+        while (ws_atomic_cas(&stop_, 1, 0) != 1)
+        {
+            if (run_once(-1) < 0)
+            {
+                WS_ERROR("WSEpollReactor - epoll_wait failed: %s", strerror(errno));
+                return;
+            }
+        }
+    }
+
+    // make the loop thread call on_wakeup(), from any thread. wakeups
+    // before the loop gets to it are merged into one
+    void wakeup()
+    {
+        if (ws_atomic_swap(&wakeup_pending_, 1) == 0)
+        {
+            uint64_t one = 1;
+            ssize_t rc = ::write(wakeup_fd_, &one, sizeof(one));
+            (void)rc;
+        }
+    }
+
+    // make run() return, from any thread
+    void stop()
+    {
+        ws_atomic_swap(&stop_, 1);
+        wakeup();
+    }
+
+    // the first connection, see WSEpollConnection::get_next
+    WSEpollConnection *get_connections() { return connections_; }
+    size_t connection_count() const { return count_; }
+    WSTimerWheel &get_timers() { return timers_; }
+    SlabAllocator &get_recv_pool() { return recv_pool_; }
+
+protected:
+    // the endpoint for a connection accepted from a listener, allocated
+    // with new and set up(deflate, keepalive...), or NULL to refuse it
+    virtual WebSocketEndpoint *on_accept(int fd)
+    {
+        (void)fd;
+        return new WebSocketEndpoint();
+    }
+
+    // conn is closed, its endpoint is deleted after the call
+    virtual void on_close(WSEpollConnection *conn) { (void)conn; }
+
+    // wakeup() was called
+    virtual void on_wakeup() {}
+
+private:
+    enum
+    {
+        // low bit of the epoll data of a listener, connections are aligned
+        LISTENER_TAG = 1
+    };
+    static const uint64_t WAKEUP_TAG = ~(uint64_t)0;
+
+    static uint64_t now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    // write callback of every endpoint
+    static void on_write(char *buf, int64_t size, void *wd)
+    {
+        WSEpollConnection *conn = (WSEpollConnection *)wd;
+        conn->reactor_->queued(conn, conn->sendq_.push(buf, size));
+    }
+
+    // frame writer of every endpoint: the queue takes the packed frame's
+    // memory
+    static void on_write_frame(ByteBuffer &frame, void *wd)
+    {
+        WSEpollConnection *conn = (WSEpollConnection *)wd;
+        conn->reactor_->queued(conn, conn->sendq_.push(frame));
+    }
+
+    // shared writer of every endpoint
+    static void on_write_shared(WSSharedFrame *frame, void *wd)
+    {
+        WSEpollConnection *conn = (WSEpollConnection *)wd;
+        conn->reactor_->queued(conn, conn->sendq_.push_shared(frame));
+    }
+
+    // the endpoint pings the peer or times it out
+    static void on_keepalive(WSTimer *timer, void *data)
+    {
+        WSEpollConnection *conn = (WSEpollConnection *)data;
+        WSEpollReactor *reactor = conn->reactor_;
+        int64_t delay = conn->endpoint_->on_keepalive_timer(on_write, conn, conn->read_paused_);
+        if (delay < 0)
+        {
+            WS_INFO("WSEpollReactor - peer timed out");
+            reactor->close_connection(conn);
+            return;
+        }
+        if (delay > 0)
+        {
+            reactor->timers_.start(timer, delay);
+        }
+    }
+
+    // a frame was queued, dropped by the slow consumer policy, or refused:
+    // the peer is then failed by the flush
+    void queued(WSEpollConnection *conn, WSSendResult result)
+    {
+        if (result == WS_SEND_OVERFLOW)
+        {
+            conn->overflow_ = true;
+        }
+        mark_dirty(conn);
+    }
+
+    void mark_dirty(WSEpollConnection *conn)
+    {
+        if (!conn->dirty_ && !conn->closed_)
+        {
+            conn->dirty_ = true;
+            conn->next_dirty_ = dirty_;
+            dirty_ = conn;
+        }
+    }
+
+    void mark_pending(WSEpollConnection *conn)
+    {
+        if (!conn->pending_ && !conn->closed_)
+        {
+            conn->pending_ = true;
+            conn->next_pending_ = pending_;
+            pending_ = conn;
+        }
+    }
+
+    void accept_connections(int listen_fd)
+    {
+        for (int i = 0; i < ACCEPT_BUDGET; i++)
+        {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == ECONNABORTED || errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    WS_WARN("WSEpollReactor - accept failed: %s", strerror(errno));
+                }
+                return;
+            }
+
+            WebSocketEndpoint *endpoint = on_accept(fd);
+            if (endpoint == NULL)
+            {
+                ::close(fd);
+            }
+            else if (add_connection(fd, endpoint) == NULL)
+            {
+                delete endpoint;
+                ::close(fd);
+            }
+        }
+    }
+
+    void on_connection_event(WSEpollConnection *conn, uint32_t events)
+    {
+        if (conn->closed_)
+        {
+            return;
+        }
+        if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            conn->peer_shut_ = true;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            conn->readable_ = true;
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            conn->writable_ = true;
+            if (!conn->sendq_.empty())
+            {
+                mark_dirty(conn);
+            }
+        }
+        read_connection(conn);
+    }
+
+    // read what the socket holds straight into the endpoint and parse it,
+    // READ_BUDGET blocks at a time
+    void read_connection(WSEpollConnection *conn)
+    {
+        int budget = READ_BUDGET;
+        while (conn->readable_ && !conn->read_paused_ && !conn->closed_)
+        {
+            if (budget-- == 0)
+            {
+                mark_pending(conn);
+                return;
+            }
+
+            // capped at the room left in the block of the endpoint
+            int32_t size = 0;
+            char *buf = conn->endpoint_->wire_buffer(recv_pool_.block_size(), &size);
+            ssize_t nread = ::read(conn->fd_, buf, size);
+            if (nread <= 0)
+            {
+                // the room in the endpoint is given back
+                conn->endpoint_->process_received(0, NULL, NULL);
+                if (nread < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    conn->readable_ = false;
+                    return;
+                }
+                if (nread < 0)
+                {
+                    WS_WARN("WSEpollReactor - read error: %s", strerror(errno));
+                }
+                close_connection(conn);
+                return;
+            }
+
+            // a short read drained the socket, unless its end is to come
+            if (nread < size && !conn->peer_shut_)
+            {
+                conn->readable_ = false;
+            }
+            int nrc = conn->endpoint_->process_received((int32_t)nread, on_write, conn);
+            if (nrc < 0)
+            {
+                WS_WARN("WSEpollReactor - process read buf failed with[err:%d].", nrc);
+            }
+            if (conn->sendq_.is_paused())
+            {
+                conn->read_paused_ = true;
+            }
+        }
+    }
+
+    // write the send queue until the socket takes no more, fail a slow
+    // consumer, and stop or go on reading by the watermarks
+    void flush(WSEpollConnection *conn)
+    {
+        if (conn->closed_)
+        {
+            return;
+        }
+        WebSocketEndpoint *endpoint = conn->endpoint_;
+        WSSendQueue &sendq = conn->sendq_;
+        if (conn->overflow_)
+        {
+            // the send queue went over its limit: drop what the peer has
+            // not got yet and close it with 1008. what it sends from now
+            // on is dropped by the endpoint
+            conn->overflow_ = false;
+            if (!endpoint->is_close_sent())
+            {
+                WS_WARN("WSEpollReactor - slow consumer, %lld bytes queued",
+                        (long long)sendq.queued_bytes());
+                sendq.discard();
+                endpoint->send_close(WS_CLOSE_POLICY_VIOLATION);
+                conn->read_paused_ = false;
+            }
+        }
+
+        while (conn->writable_ && !sendq.empty())
+        {
+            WSSendBuf pieces[WRITE_MAX_BUFS];
+            struct iovec iov[WRITE_MAX_BUFS];
+            int32_t n = sendq.peek(pieces, WRITE_MAX_BUFS);
+            int64_t size = 0;
+            for (int32_t i = 0; i < n; i++)
+            {
+                iov[i].iov_base = (void *)pieces[i].data;
+                iov[i].iov_len = (size_t)pieces[i].size;
+                size += pieces[i].size;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+
+            ssize_t nwritten = sendmsg(conn->fd_, &msg, MSG_NOSIGNAL);
+            if (nwritten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    conn->writable_ = false;
+                    break;
+                }
+                // the peer is gone
+                WS_WARN("WSEpollReactor - write error: %s", strerror(errno));
+                close_connection(conn);
+                return;
+            }
+            sendq.consume(nwritten);
+            if (nwritten < size)
+            {
+                // the socket buffer is full, EPOLLOUT tells when it is not
+                conn->writable_ = false;
+            }
+        }
+
+        if (sendq.is_paused())
+        {
+            conn->read_paused_ = true;
+        }
+        else if (conn->read_paused_)
+        {
+            conn->read_paused_ = false;
+            if (conn->readable_)
+            {
+                mark_pending(conn);
+            }
+        }
+
+        if (endpoint->is_close_sent() && sendq.empty() && !conn->shut_down_)
+        {
+            // the close frame is out: the peer reads the end and closes
+            // its side, which ends the connection here
+            conn->shut_down_ = true;
+            shutdown(conn->fd_, SHUT_WR);
+        }
+    }
+
+    void free_closed()
+    {
+        // a closed connection may be on the pending list of the next
+        // iteration, take it off first
+        WSEpollConnection **link = &pending_;
+        while (*link != NULL)
+        {
+            if ((*link)->closed_)
+            {
+                *link = (*link)->next_pending_;
+            }
+            else
+            {
+                link = &(*link)->next_pending_;
+            }
+        }
+        while (closed_ != NULL)
+        {
+            WSEpollConnection *conn = closed_;
+            closed_ = conn->next_closed_;
+            delete conn;
+        }
+    }
+
+private:
+    WSEpollReactor(const WSEpollReactor &);
+    WSEpollReactor &operator=(const WSEpollReactor &);
+
+private:
+    int epoll_fd_;
+    int wakeup_fd_;
+    volatile int32_t wakeup_pending_;
+    volatile int32_t stop_;
+    const WSSendLimits *limits_;
+    // receive memory of the endpoints
+    SlabAllocator recv_pool_;
+    // keepalive timers of the connections
+    WSTimerWheel timers_;
+    uint64_t next_tick_;
+    // open connections, and those given frames or with reads to go on
+    // with in this iteration
+    WSEpollConnection *connections_;
+    size_t count_;
+    WSEpollConnection *dirty_;
+    WSEpollConnection *pending_;
+    // closed in this iteration, freed at its end
+    WSEpollConnection *closed_;
+};
+
+#endif // __linux__
+
+#endif //_WS_EPOLL_REACTOR_H_
@@ -0,0 +1,322 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "ws_cpu.h"
+#include "ws_handshake.h"
+
+#if defined(WS_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const char *header_names_[WSHeader_Count] = {
+    "Host",
+    "Upgrade",
+    "Connection",
+    "Origin",
+    "Sec-WebSocket-Key",
+    "Sec-WebSocket-Version",
+    "Sec-WebSocket-Protocol",
+    "Sec-WebSocket-Extensions",
+};
+
+// the same names in lower case, to compare with one to_lower per byte
+static const char *lower_names_[WSHeader_Count] = {
+    "host",
+    "upgrade",
+    "connection",
+    "origin",
+    "sec-websocket-key",
+    "sec-websocket-version",
+    "sec-websocket-protocol",
+    "sec-websocket-extensions",
+};
+
+static inline char to_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+static inline bool equals_nocase(const char *a, const char *b, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        if (to_lower(a[i]) != to_lower(b[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static inline WSHandshakeSpan make_span(const char *buf, const char *begin, const char *end)
+{
+    while (begin < end && is_space(*begin))
+    {
+        begin++;
+    }
+    while (end > begin && is_space(end[-1]))
+    {
+        end--;
+    }
+    WSHandshakeSpan span;
+    span.offset = (int32_t)(begin - buf);
+    span.length = (int32_t)(end - begin);
+    return span;
+}
+
+int ws_handshake_header_index(const char *name, int len)
+{
+    // every name has a different length, so one compare is enough
+    int header;
+    switch (len)
+    {
+    case 4:
+        header = WSHeader_Host;
+        break;
+    case 6:
+        header = WSHeader_Origin;
+        break;
+    case 7:
+        header = WSHeader_Upgrade;
+        break;
+    case 10:
+        header = WSHeader_Connection;
+        break;
+    case 17:
+        header = WSHeader_SecWebSocketKey;
+        break;
+    case 21:
+        header = WSHeader_SecWebSocketVersion;
+        break;
+    case 22:
+        header = WSHeader_SecWebSocketProtocol;
+        break;
+    case 24:
+        header = WSHeader_SecWebSocketExtensions;
+        break;
+    default:
+        return -1;
+    }
+
+    const char *lower_name = lower_names_[header];
+    for (int i = 0; i < len; i++)
+    {
+        if (to_lower(name[i]) != lower_name[i])
+        {
+            return -1;
+        }
+    }
+    return header;
+}
+
+// find the '\n' ending the line that starts at p, and the first ':' in
+// the line. returns NULL if the line is not complete.
+typedef const char *(*scan_line_func)(const char *p, const char *end, const char **colon);
+
+static const char *scan_line_generic(const char *p, const char *end, const char **colon)
+{
+    const char *lf = (const char *)memchr(p, '\n', end - p);
+    *colon = (lf == NULL) ? NULL : (const char *)memchr(p, ':', lf - p);
+    return lf;
+}
+
+#if defined(WS_ARCH_X86)
+static inline int ctz32(uint32_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+
+// both characters are looked for in the same pass over the line
+WS_TARGET("sse2")
+static const char *scan_line_sse2(const char *p, const char *end, const char **colon)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cl = _mm_set1_epi8(':');
+    *colon = NULL;
+
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        uint32_t lf_bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if (*colon == NULL)
+        {
+            uint32_t cl_bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cl));
+            if (lf_bits != 0)
+            {
+                // only colons before the line end count
+                cl_bits &= (lf_bits & (0 - lf_bits)) - 1;
+            }
+            if (cl_bits != 0)
+            {
+                *colon = p + ctz32(cl_bits);
+            }
+        }
+        if (lf_bits != 0)
+        {
+            return p + ctz32(lf_bits);
+        }
+    }
+
+    for (; p < end; p++)
+    {
+        if (*p == '\n')
+        {
+            return p;
+        }
+        if (*p == ':' && *colon == NULL)
+        {
+            *colon = p;
+        }
+    }
+    return NULL;
+}
+#endif
+
+static scan_line_func select_scan_line()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_SSE2))
+    {
+        return scan_line_sse2;
+    }
+#endif
+    return scan_line_generic;
+}
+
+int32_t ws_scan_handshake(const char *buf, int32_t size, WSHandshakeRequest &req)
+{
+    static scan_line_func scan_line = select_scan_line();
+
+    memset(&req, 0, sizeof(req));
+    const char *p = buf;
+    const char *end = buf + size;
+    const char *colon = NULL;
+    const char *eol = NULL;
+    const char *line_end = NULL;
+
+    // request line, empty lines before it are ignored(RFC7230 3.5)
+    for (;;)
+    {
+        eol = scan_line(p, end, &colon);
+        if (eol == NULL)
+        {
+            return 0;
+        }
+        line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        if (line_end > p)
+        {
+            break;
+        }
+        p = eol + 1;
+    }
+
+    // method SP request-target SP version
+    const char *sp1 = (const char *)memchr(p, ' ', line_end - p);
+    if (sp1 == NULL)
+    {
+        return -1;
+    }
+    const char *sp2 = (const char *)memchr(sp1 + 1, ' ', line_end - sp1 - 1);
+    if (sp2 == NULL)
+    {
+        return -1;
+    }
+    req.method = make_span(buf, p, sp1);
+    req.uri = make_span(buf, sp1 + 1, sp2);
+    req.version = make_span(buf, sp2 + 1, line_end);
+    if (req.method.length == 0 || req.uri.length == 0 || req.version.length == 0)
+    {
+        return -1;
+    }
+
+    // header fields: name ":" value, until an empty line
+    for (p = eol + 1;; p = eol + 1)
+    {
+        eol = scan_line(p, end, &colon);
+        if (eol == NULL)
+        {
+            return 0;
+        }
+        line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        if (line_end == p)
+        {
+            return (int32_t)(eol + 1 - buf);
+        }
+        if (colon == NULL || colon > line_end)
+        {
+            // invalid line
+            continue;
+        }
+
+        int header = ws_handshake_header_index(p, (int)(colon - p));
+        if (header >= 0 && req.headers[header].length == 0)
+        {
+            req.headers[header] = make_span(buf, colon + 1, line_end);
+        }
+    }
+}
+
+const char *ws_handshake_header_name(int header)
+{
+    return (header >= 0 && header < WSHeader_Count) ? header_names_[header] : "";
+}
+
+bool ws_span_equals(const char *buf, const WSHandshakeSpan &span, const char *value)
+{
+    int len = (int)strlen(value);
+    return span.length == len && equals_nocase(buf + span.offset, value, len);
+}
+
+bool ws_span_has_token(const char *buf, const WSHandshakeSpan &span, const char *token)
+{
+    int len = (int)strlen(token);
+    const char *p = buf + span.offset;
+    const char *end = p + span.length;
+    while (p < end)
+    {
+        const char *comma = (const char *)memchr(p, ',', end - p);
+        const char *item_end = (comma == NULL) ? end : comma;
+        WSHandshakeSpan item = make_span(buf, p, item_end);
+        if (item.length == len && equals_nocase(buf + item.offset, token, len))
+        {
+            return true;
+        }
+        p = item_end + 1;
+    }
+    return false;
+}
@@ -0,0 +1,99 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* single pass http/1.1 upgrade request scanner for the websocket handshake
+*/
+
+#ifndef _WS_HANDSHAKE_H_
+#define _WS_HANDSHAKE_H_
+
+#include <stdint.h>
+
+// the request headers a websocket upgrade needs
+enum WSHandshakeHeader
+{
+    WSHeader_Host = 0,
+    WSHeader_Upgrade,
+    WSHeader_Connection,
+    WSHeader_Origin,
+    WSHeader_SecWebSocketKey,
+    WSHeader_SecWebSocketVersion,
+    WSHeader_SecWebSocketProtocol,
+    WSHeader_SecWebSocketExtensions,
+    WSHeader_Count,
+};
+
+// bytes [offset, offset + length) of the scanned input, length is 0
+// if the element is missing
+struct WSHandshakeSpan
+{
+    int32_t offset;
+    int32_t length;
+};
+
+/**
+* the upgrade request as offsets into the input, nothing is copied
+*/
+struct WSHandshakeRequest
+{
+    WSHandshakeSpan method;
+    WSHandshakeSpan uri;
+    WSHandshakeSpan version;
+    // values with surrounding spaces trimmed. a repeated header keeps
+    // its first value.
+    WSHandshakeSpan headers[WSHeader_Count];
+};
+
+/**
+* scan an http/1.1 request in one pass and record the request line and
+* the WSHandshakeHeader headers. other headers are skipped.
+* @param buf the bytes received so far
+* @return size of the request including the empty line, 0 if it is not
+*       complete yet, <0 if it is malformed
+* @remark header names are matched case insensitively. line ends and ':'
+*       are searched 16 bytes at a time with sse2 where available.
+*/
+int32_t ws_scan_handshake(const char *buf, int32_t size, WSHandshakeRequest &req);
+
+/**
+* get the name of a WSHandshakeHeader, e.g. "Sec-WebSocket-Key"
+*/
+const char *ws_handshake_header_name(int header);
+
+/**
+* get the WSHandshakeHeader named name(len bytes, any case), -1 if none
+*/
+int ws_handshake_header_index(const char *name, int len);
+
+/**
+* compare a span of buf with value, ignoring case
+*/
+bool ws_span_equals(const char *buf, const WSHandshakeSpan &span, const char *value);
+
+/**
+* check if a comma separated list, e.g. "keep-alive, Upgrade", has
+* token, ignoring case
+*/
+bool ws_span_has_token(const char *buf, const WSHandshakeSpan &span, const char *token);
+
+#endif //_WS_HANDSHAKE_H_
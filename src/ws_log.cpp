@@ -0,0 +1,145 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ws_atomic.h"
+#include "ws_log.h"
+
+struct LogRecord
+{
+    // index + 1 of the record once it is completely written, 0 while writing
+    volatile int64_t seq;
+    int level;
+    char text[WS_LOG_RECORD_SIZE];
+};
+
+static LogRecord ring_[WS_LOG_RING_SIZE];
+// index of the next record to write
+static volatile int64_t ring_pos_ = 0;
+
+static volatile int log_level_ = -1;
+static volatile int console_level_ = -1;
+
+static const char *level_names_[] = {"trace", "debug", "info", "warn", "error", "none"};
+
+static int parse_level(const char *name, int default_level)
+{
+    if (name == NULL)
+    {
+        return default_level;
+    }
+    for (int i = WS_LOG_LEVEL_TRACE; i <= WS_LOG_LEVEL_NONE; i++)
+    {
+        if (strcmp(name, level_names_[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return default_level;
+}
+
+void ws_log_set_level(int level)
+{
+    log_level_ = level;
+}
+
+int ws_log_get_level()
+{
+    int level = log_level_;
+    if (level < 0)
+    {
+        level = parse_level(getenv("WSFILES_LOG_LEVEL"), WS_LOG_LEVEL_TRACE);
+        log_level_ = level;
+    }
+    return level;
+}
+
+void ws_log_set_console_level(int level)
+{
+    console_level_ = level;
+}
+
+static int get_console_level()
+{
+    int level = console_level_;
+    if (level < 0)
+    {
+        level = parse_level(getenv("WSFILES_LOG_CONSOLE"), WS_LOG_LEVEL_INFO);
+        console_level_ = level;
+    }
+    return level;
+}
+
+void ws_log_write(int level, const char *fmt, ...)
+{
+    // claim a slot, older records are overwritten
+    int64_t index = ws_atomic_add(&ring_pos_, 1) - 1;
+    LogRecord &record = ring_[index % WS_LOG_RING_SIZE];
+    record.seq = 0;
+    ws_atomic_fence();
+
+    record.level = level;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(record.text, sizeof(record.text), fmt, args);
+    va_end(args);
+
+    // publish it
+    ws_atomic_fence();
+    record.seq = index + 1;
+
+    if (level >= get_console_level())
+    {
+        fprintf(stderr, "[%s] %s\n", level_names_[level], record.text);
+    }
+}
+
+void ws_log_dump(FILE *out)
+{
+    int64_t end = ws_atomic_load(&ring_pos_);
+    int64_t begin = end > WS_LOG_RING_SIZE ? end - WS_LOG_RING_SIZE : 0;
+
+    char text[WS_LOG_RECORD_SIZE];
+    for (int64_t i = begin; i < end; i++)
+    {
+        LogRecord &record = ring_[i % WS_LOG_RING_SIZE];
+        int64_t seq = record.seq;
+        ws_atomic_fence();
+        if (seq != i + 1)
+        {
+            // being written or already overwritten
+            continue;
+        }
+        int level = record.level;
+        memcpy(text, record.text, sizeof(text));
+        text[sizeof(text) - 1] = '\0';
+        ws_atomic_fence();
+        if (record.seq != seq)
+        {
+            continue;
+        }
+        fprintf(out, "[%s] %s\n", level_names_[level], text);
+    }
+    fflush(out);
+}
@@ -0,0 +1,129 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* logging macros with compile time and runtime levels.
+*
+* records go to an in-memory ring that writers fill without locks, and
+* are dumped on demand by ws_log_dump(). records at or above the console
+* level are also written to stderr.
+*
+* levels below WS_LOG_LEVEL compile to nothing. it defaults to trace, or to
+* info when NDEBUG is defined (release builds).
+*/
+
+#ifndef _WS_LOG_H_
+#define _WS_LOG_H_
+
+#include <stdio.h>
+
+#define WS_LOG_LEVEL_TRACE 0
+#define WS_LOG_LEVEL_DEBUG 1
+#define WS_LOG_LEVEL_INFO 2
+#define WS_LOG_LEVEL_WARN 3
+#define WS_LOG_LEVEL_ERROR 4
+#define WS_LOG_LEVEL_NONE 5
+
+#ifndef WS_LOG_LEVEL
+#ifdef NDEBUG
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+#else
+#define WS_LOG_LEVEL WS_LOG_LEVEL_TRACE
+#endif
+#endif
+
+// max length of one record, longer ones are truncated
+#define WS_LOG_RECORD_SIZE 256
+// number of records the ring keeps
+#define WS_LOG_RING_SIZE 4096
+
+/**
+* records below level are dropped at runtime.
+* default is trace, or WSFILES_LOG_LEVEL from the environment
+* (trace, debug, info, warn, error, none).
+*/
+void ws_log_set_level(int level);
+int ws_log_get_level();
+
+/**
+* records at or above level are also written to stderr.
+* default is info, or WSFILES_LOG_CONSOLE from the environment.
+*/
+void ws_log_set_console_level(int level);
+
+/**
+* write the records kept in the ring to out, oldest first
+*/
+void ws_log_dump(FILE *out);
+
+// use the macros below instead
+void ws_log_write(int level, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+#define WS_LOG_WRITE(level, ...)                \
+    do                                          \
+    {                                           \
+        if ((level) >= ws_log_get_level())      \
+        {                                       \
+            ws_log_write((level), __VA_ARGS__); \
+        }                                       \
+    } while (0)
+
+#define WS_LOG_NOTHING() \
+    do                   \
+    {                    \
+    } while (0)
+
+#if WS_LOG_LEVEL <= WS_LOG_LEVEL_TRACE
+#define WS_TRACE(...) WS_LOG_WRITE(WS_LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define WS_TRACE(...) WS_LOG_NOTHING()
+#endif
+
+#if WS_LOG_LEVEL <= WS_LOG_LEVEL_DEBUG
+#define WS_DEBUG(...) WS_LOG_WRITE(WS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define WS_DEBUG(...) WS_LOG_NOTHING()
+#endif
+
+#if WS_LOG_LEVEL <= WS_LOG_LEVEL_INFO
+#define WS_INFO(...) WS_LOG_WRITE(WS_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define WS_INFO(...) WS_LOG_NOTHING()
+#endif
+
+#if WS_LOG_LEVEL <= WS_LOG_LEVEL_WARN
+#define WS_WARN(...) WS_LOG_WRITE(WS_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define WS_WARN(...) WS_LOG_NOTHING()
+#endif
+
+#if WS_LOG_LEVEL <= WS_LOG_LEVEL_ERROR
+#define WS_ERROR(...) WS_LOG_WRITE(WS_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define WS_ERROR(...) WS_LOG_NOTHING()
+#endif
+
+#endif //_WS_LOG_H_
@@ -0,0 +1,174 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "ws_cpu.h"
+#include "ws_mask.h"
+
+#if defined(WS_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+typedef uint32_t (*mask_func)(char *dst, const char *src, uint64_t size,
+                              const uint8_t key[4], uint32_t phase);
+
+// key bytes repeated and rotated so that pattern[0] masks src[0]
+static inline void make_pattern(uint8_t *pattern, int len, const uint8_t key[4], uint32_t phase)
+{
+    for (int i = 0; i < len; i++)
+    {
+        pattern[i] = key[(phase + i) & 3];
+    }
+}
+
+static inline uint32_t mask_tail(char *dst, const char *src, uint64_t size,
+                                 const uint8_t key[4], uint32_t phase)
+{
+    for (uint64_t i = 0; i < size; i++)
+    {
+        dst[i] = src[i] ^ key[phase & 3];
+        phase++;
+    }
+    return phase & 3;
+}
+
+uint32_t ws_mask_bytes_generic(char *dst, const char *src, uint64_t size,
+                               const uint8_t key[4], uint32_t phase)
+{
+    phase &= 3;
+    uint8_t pattern[8];
+    make_pattern(pattern, 8, key, phase);
+    uint64_t word_key = 0;
+    memcpy(&word_key, pattern, 8);
+
+    // 8 is a multiple of 4, so the phase does not move inside this loop
+    uint64_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        uint64_t w[4];
+        memcpy(w, src + i, 32);
+        w[0] ^= word_key;
+        w[1] ^= word_key;
+        w[2] ^= word_key;
+        w[3] ^= word_key;
+        memcpy(dst + i, w, 32);
+    }
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        w ^= word_key;
+        memcpy(dst + i, &w, 8);
+    }
+
+    return mask_tail(dst + i, src + i, size - i, key, phase);
+}
+
+#if defined(WS_ARCH_X86)
+WS_TARGET("sse2")
+static uint32_t mask_bytes_sse2(char *dst, const char *src, uint64_t size,
+                                const uint8_t key[4], uint32_t phase)
+{
+    phase &= 3;
+    uint8_t pattern[16];
+    make_pattern(pattern, 16, key, phase);
+    const __m128i k = _mm_loadu_si128((const __m128i *)pattern);
+
+    uint64_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128((__m128i *)(dst + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128((__m128i *)(dst + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, k));
+    }
+
+    return ws_mask_bytes_generic(dst + i, src + i, size - i, key, phase);
+}
+
+WS_TARGET("avx2")
+static uint32_t mask_bytes_avx2(char *dst, const char *src, uint64_t size,
+                                const uint8_t key[4], uint32_t phase)
+{
+    phase &= 3;
+    uint8_t pattern[32];
+    make_pattern(pattern, 32, key, phase);
+    const __m256i k = _mm256_loadu_si256((const __m256i *)pattern);
+
+    uint64_t i = 0;
+    for (; i + 128 <= size; i += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 96));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(b, k));
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), _mm256_xor_si256(c, k));
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), _mm256_xor_si256(d, k));
+    }
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, k));
+    }
+
+    return ws_mask_bytes_generic(dst + i, src + i, size - i, key, phase);
+}
+#endif
+
+static mask_func select_mask_func()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_AVX2))
+    {
+        return mask_bytes_avx2;
+    }
+    if (ws_cpu_has(WS_CPU_SSE2))
+    {
+        return mask_bytes_sse2;
+    }
+#endif
+    return ws_mask_bytes_generic;
+}
+
+uint32_t ws_mask_bytes(char *dst, const char *src, uint64_t size,
+                       const uint8_t key[4], uint32_t phase)
+{
+    static mask_func func = select_mask_func();
+
+    // a short payload is not worth a vector setup
+    if (size < 16)
+    {
+        return mask_tail(dst, src, size, key, phase & 3);
+    }
+    return func(dst, src, size, key, phase);
+}
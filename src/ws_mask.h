@@ -0,0 +1,51 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* websocket payload masking/unmasking (RFC6455 5.3)
+*/
+
+#ifndef _WS_MASK_H_
+#define _WS_MASK_H_
+
+#include <stdint.h>
+
+/**
+* xor size bytes of src with the 4 bytes masking key and store them to dst.
+* masking and unmasking are the same operation.
+* @param dst output bytes, may be the same address as src
+* @param key the 4 bytes masking key
+* @param phase index of the key byte used for src[0], 0 for a new payload
+* @return phase for the byte following src[size - 1], so a payload can be
+*       masked in several calls
+* @remark picks avx2, sse2 or a 64 bit word loop at runtime.
+*/
+uint32_t ws_mask_bytes(char *dst, const char *src, uint64_t size,
+                       const uint8_t key[4], uint32_t phase);
+
+/**
+* portable version of ws_mask_bytes, always available
+*/
+uint32_t ws_mask_bytes_generic(char *dst, const char *src, uint64_t size,
+                               const uint8_t key[4], uint32_t phase);
+
+#endif //_WS_MASK_H_
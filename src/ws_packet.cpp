@@ -20,8 +20,14 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <new>
+#include <string.h>
 #include "sha1.h"
 #include "base64.h"
+#include "ws_mask.h"
+#include "ws_utf8.h"
+#include "ws_buffer_pool.h"
+#include "ws_log.h"
 #include "ws_packet.h"
 #include "string_helper.h"
 
@@ -38,8 +44,43 @@ WebSocketPacket::WebSocketPacket()
 	opcode_ = 0;
 	mask_ = 0;
 	length_type_ = 0;
-	masking_key_[4] = {0};
+	memset(masking_key_, 0, sizeof(masking_key_));
 	payload_length_ = 0;
+	hs_length_ = 0;
+	memset(&hs_request_, 0, sizeof(hs_request_));
+	hs_base_ = NULL;
+	parse_state_ = WSParseState_Header;
+	header_size_ = 0;
+	mask_phase_ = 0;
+	payload_received_ = 0;
+	payload_external_ = false;
+	stream_payload_ = false;
+	close_status_ = 0;
+	text_message_ = false;
+	ws_utf8_reset(utf8_state_);
+	compression_ = false;
+	compressed_message_ = false;
+}
+
+void WebSocketPacket::reset()
+{
+	fin_ = 0;
+	rsv1_ = 0;
+	rsv2_ = 0;
+	rsv3_ = 0;
+	opcode_ = 0;
+	mask_ = 0;
+	length_type_ = 0;
+	memset(masking_key_, 0, sizeof(masking_key_));
+	payload_length_ = 0;
+	parse_state_ = WSParseState_Header;
+	header_size_ = 0;
+	mask_phase_ = 0;
+	payload_received_ = 0;
+	payload_.erase(payload_.length());
+	payload_.resetoft();
+	payload_view_ = ByteView();
+	payload_external_ = false;
 }
 
 int32_t WebSocketPacket::recv_handshake(ByteBuffer &input)
@@ -49,17 +90,32 @@ int32_t WebSocketPacket::recv_handshake(ByteBuffer &input)
 		return WS_MAX_HANDSHAKE_FRAME_SIZE;
 	}
 
-	std::string inputstr(input.bytes(), input.length());
-	int32_t frame_size = fetch_hs_element(inputstr);
-	if (frame_size <= 0)
+	if (input.length() == 0)
+	{
+		return 0;
+	}
+
+	// one pass over the bytes, headers are kept as offsets into input
+	int32_t frame_size = ws_scan_handshake(input.bytes(), input.length(), hs_request_);
+	if (frame_size == 0)
 	{
 		//continue recving data;
 		input.resetoft();
 		return 0;
 	}
+	if (frame_size < 0)
+	{
+		input.resetoft();
+		return WS_ERROR_INVALID_HANDSHAKE_FRAME;
+	}
+	hs_base_ = input.bytes();
 
-	if (get_param("Upgrade") != "websocket" || get_param("Connection") != "Upgrade" ||
-		get_param("Sec-WebSocket-Version") != "13" || get_param("Sec-WebSocket-Key") == "")
+	// Connection may list other tokens, e.g. "keep-alive, Upgrade"
+	const WSHandshakeSpan *headers = hs_request_.headers;
+	if (!ws_span_equals(hs_base_, headers[WSHeader_Upgrade], "websocket") ||
+		!ws_span_has_token(hs_base_, headers[WSHeader_Connection], "upgrade") ||
+		!ws_span_equals(hs_base_, headers[WSHeader_SecWebSocketVersion], "13") ||
+		headers[WSHeader_SecWebSocketKey].length == 0)
 	{
 		input.resetoft();
 		return WS_ERROR_INVALID_HANDSHAKE_PARAMS;
@@ -72,58 +128,169 @@ int32_t WebSocketPacket::recv_handshake(ByteBuffer &input)
 
 int32_t WebSocketPacket::pack_handshake_rsp(std::string &hs_rsp)
 {
-	std::string magic_key = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-	std::string raw_key = get_param("Sec-WebSocket-Key") + magic_key;
+	static const char magic_key[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	static const int32_t magic_length = sizeof(magic_key) - 1;
+	int32_t key_length = 0;
+	const char *key = get_hs_header(WSHeader_SecWebSocketKey, &key_length);
 
-	std::string sha1_key = SHA1::SHA1HashString(raw_key);
-	char accept_key[128] = {0};
-	Base64encode(accept_key, sha1_key.c_str(), sha1_key.length());
+	unsigned char sha1_key[SHA1::kSHA1Length];
+	if (key_length + magic_length == SHA1::kSHA1AcceptInputLength)
+	{
+		// a well-formed key is 24 base64 chars, hash it without allocating
+		unsigned char raw_key[SHA1::kSHA1AcceptInputLength];
+		memcpy(raw_key, key, key_length);
+		memcpy(raw_key + key_length, magic_key, magic_length);
+		SHA1::SHA1HashAcceptInput(raw_key, sha1_key);
+	}
+	else
+	{
+		std::string raw_key = std::string(key, key_length) + magic_key;
+		SHA1::SHA1HashBytes((const unsigned char *)raw_key.data(), raw_key.length(), sha1_key);
+	}
+	char accept_key[32] = {0};
+	Base64encode(accept_key, (const char *)sha1_key, SHA1::kSHA1Length);
 
-	std::ostringstream sstream;
-	sstream << "HTTP/1.1 101 Switching Protocols" << EOL;
-	sstream << "Connection: upgrade" << EOL;
-	sstream << "Upgrade: websocket" << EOL;
-	sstream << "Sec-WebSocket-Accept: " << accept_key << EOL;
-	if (get_param("Sec-WebSocket-Protocol") != "")
+	hs_rsp.clear();
+	hs_rsp.reserve(160);
+	hs_rsp.append("HTTP/1.1 101 Switching Protocols" EOL);
+	hs_rsp.append("Connection: upgrade" EOL);
+	hs_rsp.append("Upgrade: websocket" EOL);
+	hs_rsp.append("Sec-WebSocket-Accept: ");
+	hs_rsp.append(accept_key);
+	hs_rsp.append(EOL);
+	int32_t protocol_length = 0;
+	get_hs_header(WSHeader_SecWebSocketProtocol, &protocol_length);
+	if (!hs_protocol_.empty())
+	{
+		hs_rsp.append("Sec-WebSocket-Protocol: ");
+		hs_rsp.append(hs_protocol_);
+		hs_rsp.append(EOL);
+	}
+	else if (protocol_length > 0 || params_.find("Sec-WebSocket-Protocol") != params_.end())
 	{
-		sstream << "Sec-WebSocket-Protocol: chat" << EOL;
+		hs_rsp.append("Sec-WebSocket-Protocol: chat" EOL);
 	}
-	sstream << EOL;
-	hs_rsp = sstream.str();
+	if (!hs_extensions_.empty())
+	{
+		hs_rsp.append("Sec-WebSocket-Extensions: ");
+		hs_rsp.append(hs_extensions_);
+		hs_rsp.append(EOL);
+	}
+	hs_rsp.append(EOL);
 
 	return 0;
 }
 
-uint64_t WebSocketPacket::recv_dataframe(ByteBuffer &input)
+int64_t WebSocketPacket::recv_dataframe(ByteBuffer &input)
 {
-	int header_size = fetch_frame_info(input);
+	if (parse_state_ == WSParseState_Done)
+	{
+		reset();
+	}
+
+	if (parse_state_ == WSParseState_Header)
+	{
+		int32_t header_size = fetch_frame_info(input);
+		if (header_size < 0)
+		{
+			return -1;
+		}
+		if (header_size == 0)
+		{
+			// not even a whole header, nothing is consumed
+			input.resetoft();
+			return 0;
+		}
+
+		header_size_ = header_size;
+		payload_received_ = 0;
+		mask_phase_ = 0;
+		parse_state_ = WSParseState_Payload;
 
-	//std::cout << "WebSocketPacket: header size: " << header_size
-	//		  << " payload_length_: " << payload_length_ << " input.length: " << input.length() << std::endl;
+		// RSV1 may only mark the first frame of a compressed message
+		if (rsv2_ || rsv3_ ||
+			(rsv1_ && (!compression_ || opcode_ == WSOpcode_Continue || opcode_ >= WSOpcode_Close)))
+		{
+			WS_WARN("WebSocketPacket: unexpected RSV bits in a frame with opcode %d", (int)opcode_);
+			close_status_ = WS_CLOSE_PROTOCOL_ERROR;
+			return -1;
+		}
+
+		// continuation frames belong to the message the last data
+		// frame has started
+		if (opcode_ == WSOpcode_Text || opcode_ == WSOpcode_Binary)
+		{
+			text_message_ = opcode_ == WSOpcode_Text;
+			compressed_message_ = rsv1_ == 1;
+			ws_utf8_reset(utf8_state_);
+		}
+	}
 
-	if (payload_length_ + header_size > input.length())
+	if (fetch_payload(input) < 0)
 	{
-		// buffer size is not enough, so we continue recving data
-		std::cout << "WebSocketPacket: recv_dataframe: continue recving data." << std::endl;
-		input.resetoft();
+		WS_WARN("WebSocketPacket: text message payload is not valid utf-8!");
+		close_status_ = WS_CLOSE_INVALID_PAYLOAD;
+		return -1;
+	}
+
+	if (payload_received_ < payload_length_)
+	{
+		// keep what we have got, and continue recving data
+		WS_TRACE("WebSocketPacket: recv_dataframe: continue recving data, payload:%llu/%llu",
+				 (unsigned long long)payload_received_, (unsigned long long)payload_length_);
 		return 0;
 	}
 
-	fetch_payload(input);
+	// a message must not end inside a character
+	if (text_message_ && !compressed_message_ && fin_ == 1 && opcode_ < WSOpcode_Close && !ws_utf8_complete(utf8_state_))
+	{
+		WS_WARN("WebSocketPacket: text message ends with a partial utf-8 character!");
+		close_status_ = WS_CLOSE_INVALID_PAYLOAD;
+		return -1;
+	}
 
-	std::cout << "WebSocketPacket: received data with header size: " << header_size << " payload size:" << payload_length_
-			  << " input oft size:" << input.getoft() << std::endl;
-	//return payload_length_;
-	return input.getoft();
+	parse_state_ = WSParseState_Done;
+	WS_TRACE("WebSocketPacket: received data with header size: %d payload size:%llu input oft size:%d",
+			 (int)header_size_, (unsigned long long)payload_length_, input.getoft());
+	return header_size_ + payload_length_;
 }
 
 int32_t WebSocketPacket::fetch_frame_info(ByteBuffer &input)
 {
-	// FIN, opcode
+	int32_t begin = input.getoft();
+	if (!input.require(2))
+	{
+		return 0;
+	}
+
+	uint8_t *header = (uint8_t *)input.curat();
+	int32_t header_size = 2;
+	uint8_t length_type = header[1] & 0x7F;
+	if (length_type == 126)
+	{
+		header_size += 2;
+	}
+	else if (length_type == 127)
+	{
+		header_size += 8;
+	}
+	if (header[1] & 0x80)
+	{
+		header_size += 4;
+	}
+	if (!input.require(header_size))
+	{
+		return 0;
+	}
+
+	// FIN, RSV, opcode
 	uint8_t onebyte = 0;
 	input.read_bytes_x((char *)&onebyte, 1);
 	fin_ = onebyte >> 7;
-	opcode_ = onebyte & 0x7F;
+	rsv1_ = onebyte >> 6 & 0x01;
+	rsv2_ = onebyte >> 5 & 0x01;
+	rsv3_ = onebyte >> 4 & 0x01;
+	opcode_ = onebyte & 0x0F;
 
 	// payload length
 	input.read_bytes_x((char *)&onebyte, 1);
@@ -136,34 +303,28 @@ int32_t WebSocketPacket::fetch_frame_info(ByteBuffer &input)
 	}
 	else if (length_type_ == 126)
 	{
-		/*
-		uint16_t len = 0;
-		input.read_bytes_x((char *)&len, 2);
-		len = (len << 8) | (len >>8 & 0xFF);
-		payload_length_ = len;
-		*/
-		uint16_t len = 0;
 		uint8_t array[2] = {0};
 		input.read_bytes_x((char *)array, 2);
-		len = uint16_t(array[0] << 8) | uint16_t(array[1]);
-		payload_length_ = len;
+		payload_length_ = uint16_t(array[0] << 8) | uint16_t(array[1]);
 	}
-	else if (length_type_ == 127)
+	else
 	{
 		// if you don't have ntohll
-		uint64_t len = 0;
 		uint8_t array[8] = {0};
 		input.read_bytes_x((char *)array, 8);
-		len = (array[0] << 56) | array[1] << 48 | array[2] << 40 | array[3] << 32 
-		| array[4] << 24 | array[5] << 16 | array[6] << 8 | array[7];
-
-		if (payload_length_ > 0xFFFFFFFF)
+		payload_length_ = 0;
+		for (int i = 0; i < 8; i++)
 		{
-			//std::cout >>
+			payload_length_ = (payload_length_ << 8) | array[i];
 		}
 	}
-	else
+
+	// a payload must fit in a ByteBuffer
+	if (payload_length_ > WS_MAX_FRAME_PAYLOAD_SIZE)
 	{
+		WS_WARN("WebSocketPacket: frame payload length %llu exceeds the max value!",
+				(unsigned long long)payload_length_);
+		return -1;
 	}
 
 	// masking key
@@ -173,110 +334,168 @@ int32_t WebSocketPacket::fetch_frame_info(ByteBuffer &input)
 	}
 
 	// return header size
-	return input.getoft();
+	return input.getoft() - begin;
 }
 
 int32_t WebSocketPacket::fetch_payload(ByteBuffer &input)
 {
-	char real = 0;
-	if (mask_ == 1)
+	uint64_t remaining = payload_length_ - payload_received_;
+	int32_t available = input.length() - input.getoft();
+	int32_t size = remaining < (uint64_t)available ? (int32_t)remaining : available;
+	// control frames are always collected
+	bool stream = stream_payload_ && opcode_ < WSOpcode_Close;
+	if (stream)
+	{
+		payload_view_ = ByteView();
+		payload_external_ = true;
+	}
+	if (size <= 0)
 	{
-		for (uint64_t i = 0; i < payload_length_; i++)
+		return 0;
+	}
+
+	if (stream || (payload_received_ == 0 && (uint64_t)size == payload_length_))
+	{
+		// the bytes are all here, unmask them in place and refer to them
+		char *p = input.curat();
+		if (!unmask_payload(p, p, size))
 		{
-			input.read_bytes_x(&real, 1);
-			real = real ^ masking_key_[i % 4];
-			payload_.append(&real, 1);
+			return -1;
 		}
+		payload_view_ = ByteView(p, size);
+		payload_external_ = true;
 	}
 	else
 	{
-		payload_.append(input.curat(), payload_length_);
-		input.skip_x(payload_length_);
+		// unmask straight from the input buffer into the payload
+		char *dst = payload_.grow(size);
+		if (!unmask_payload(dst, input.curat(), size))
+		{
+			return -1;
+		}
+		payload_external_ = false;
 	}
-	return 0;
+	input.skip_x(size);
+	payload_received_ += size;
+	return size;
 }
 
-int32_t WebSocketPacket::pack_dataframe(ByteBuffer &output)
+bool WebSocketPacket::unmask_payload(char *dst, const char *src, int32_t size)
 {
-	uint8_t onebyte = 0;
-	onebyte |= (fin_ << 7);
-	onebyte |= (rsv1_ << 6);
-	onebyte |= (rsv2_ << 5);
-	onebyte |= (rsv3_ << 4);
-	onebyte |= (opcode_ & 0x0F);
-	output.append((char *)&onebyte, 1);
-
-	onebyte = 0;
+	// control frames carry no message data, and a compressed message
+	// is validated once it is inflated
+	if (text_message_ && !compressed_message_ && opcode_ < WSOpcode_Close)
+	{
+		if (mask_ == 1)
+		{
+			return ws_utf8_unmask_validate(utf8_state_, dst, src, size, masking_key_, mask_phase_);
+		}
+		if (dst != src)
+		{
+			memcpy(dst, src, size);
+		}
+		return ws_utf8_validate(utf8_state_, dst, size);
+	}
+
+	if (mask_ == 1)
+	{
+		mask_phase_ = ws_mask_bytes(dst, src, size, masking_key_, mask_phase_);
+	}
+	else if (dst != src)
+	{
+		memcpy(dst, src, size);
+	}
+	return true;
+}
+
+int32_t WebSocketPacket::encode_header(char *buf)
+{
+	uint8_t *p = (uint8_t *)buf;
+	p[0] = (fin_ << 7) | (rsv1_ << 6) | (rsv2_ << 5) | (rsv3_ << 4) | (opcode_ & 0x0F);
+
 	//set mask flag
-	onebyte = onebyte | (mask_ << 7);
+	uint8_t mask_flag = mask_ << 7;
 	uint8_t length_type = get_length_type();
+	int32_t size = 2;
 
 	if (length_type < 126)
 	{
-		onebyte |= payload_length_;
-		output.append((char *)&onebyte, 1);
+		p[1] = mask_flag | (uint8_t)payload_length_;
 	}
 	else if (length_type == 126)
 	{
-		onebyte |= length_type;
-		output.append((char *)&onebyte, 1);
-
+		p[1] = mask_flag | length_type;
 		// also can use htons
-		onebyte = (payload_length_ >> 8) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = payload_length_ & 0xFF;
-		output.append((char *)&onebyte, 1);
+		p[2] = (payload_length_ >> 8) & 0xFF;
+		p[3] = payload_length_ & 0xFF;
+		size = 4;
 	}
-	else if (length_type == 127)
+	else
 	{
-		onebyte |= length_type;
-		output.append((char *)&onebyte, 1);
-
+		p[1] = mask_flag | length_type;
 		// also can use htonll if you have it
-		onebyte = (payload_length_ >> 56) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 48) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 40) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 32) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 24) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 16) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = (payload_length_ >> 8) & 0xFF;
-		output.append((char *)&onebyte, 1);
-		onebyte = payload_length_ & 0XFF;
-		output.append((char *)&onebyte, 1);
+		for (int i = 0; i < 8; i++)
+		{
+			p[2 + i] = (payload_length_ >> (56 - 8 * i)) & 0xFF;
+		}
+		size = 10;
 	}
-	else
+
+	if (mask_ == 1)
+	{
+		// save masking key
+		memcpy(p + size, masking_key_, 4);
+		size += 4;
+	}
+
+	return size;
+}
+
+int32_t WebSocketPacket::pack_dataframe(ByteBuffer &output)
+{
+	uint64_t frame_size = get_header_size() + payload_length_;
+	if (frame_size > WS_MAX_FRAME_PAYLOAD_SIZE ||
+		payload_length_ > (uint64_t)get_payload_view().length())
+	{
+		return -1;
+	}
+
+	// reserve the whole frame once and write it in place, it can't fail
+	// any more
+	char *buf = output.grow((int)frame_size);
+	pack_dataframe(buf, frame_size);
+
+	return 0;
+}
+
+int32_t WebSocketPacket::pack_dataframe(char *buf, uint64_t size)
+{
+	int32_t header_size = get_header_size();
+	const ByteView &payload = get_payload_view();
+	if (size < header_size + payload_length_ || payload_length_ > (uint64_t)payload.length())
 	{
 		return -1;
 	}
 
+	encode_header(buf);
+	WS_TRACE("WebSocketPacket: send data with header size: %d payload size:%llu",
+			 header_size, (unsigned long long)payload_length_);
+
+	if (payload_length_ == 0)
+	{
+		return header_size;
+	}
+
 	if (mask_ == 1)
 	{
-		char value = 0;
-		// save masking key
-		output.append((char *)masking_key_, 4);
-		std::cout << "WebSocketPacket: send data with header size: " << output.length()
-				  << " payload size:" << payload_length_ << std::endl;
-		for (uint64_t i = 0; i < payload_length_; i++)
-		{
-			payload_.read_bytes_x(&value, 1);
-			value = value ^ masking_key_[i % 4];
-			output.append(&value, 1);
-		}
+		ws_mask_bytes(buf + header_size, payload.bytes(), payload_length_, masking_key_, 0);
 	}
 	else
 	{
-		std::cout << "WebSocketPacket: send data with header size: " << output.length()
-				  << " payload size:" << payload_length_ << std::endl<<std::endl;
-		output.append(payload_.bytes(), payload_.length());
+		memcpy(buf + header_size, payload.bytes(), payload_length_);
 	}
 
-	return 0;
+	return header_size + payload_length_;
 }
 
 int32_t WebSocketPacket::fetch_hs_element(const std::string &msg)
@@ -335,16 +554,76 @@ int32_t WebSocketPacket::fetch_hs_element(const std::string &msg)
 		}
 
 		params_[k] = v;
-		std::cout << "handshake element k:" << k.c_str() << " v:" << v.c_str() << std::endl;
+		WS_TRACE("handshake element k:%s v:%s", k.c_str(), v.c_str());
 	}
 
 	return endpos + 4;
 }
 
+const char *WebSocketPacket::get_hs_header(int header, int32_t *length)
+{
+	if (hs_base_ == NULL || header < 0 || header >= WSHeader_Count)
+	{
+		*length = 0;
+		return "";
+	}
+	*length = hs_request_.headers[header].length;
+	return hs_base_ + hs_request_.headers[header].offset;
+}
+
+bool WebSocketPacket::has_hs_protocol(const char *protocol)
+{
+	if (hs_base_ != NULL)
+	{
+		return ws_span_has_token(hs_base_, hs_request_.headers[WSHeader_SecWebSocketProtocol], protocol);
+	}
+
+	std::map<std::string, std::string>::const_iterator it = params_.find("Sec-WebSocket-Protocol");
+	if (it == params_.end())
+	{
+		return false;
+	}
+	WSHandshakeSpan span;
+	span.offset = 0;
+	span.length = (int32_t)it->second.length();
+	return ws_span_has_token(it->second.data(), span, protocol);
+}
+
+int WebSocketPacket::find_hs_header(const std::string &name) const
+{
+	if (hs_base_ == NULL)
+	{
+		return -1;
+	}
+	int header = ws_handshake_header_index(name.c_str(), (int)name.length());
+	if (header < 0 || hs_request_.headers[header].length == 0)
+	{
+		return -1;
+	}
+	return header;
+}
+
+std::string WebSocketPacket::hs_span_string(const WSHandshakeSpan &span) const
+{
+	if (hs_base_ == NULL)
+	{
+		return std::string();
+	}
+	return std::string(hs_base_ + span.offset, span.length);
+}
+
 void WebSocketPacket::set_payload(const char *buf, uint64_t size)
 {
 	payload_.append(buf, size);
 	payload_length_ = payload_.length();
+	payload_external_ = false;
+}
+
+void WebSocketPacket::set_payload_view(const char *buf, uint64_t size)
+{
+	payload_view_ = ByteView(buf, size);
+	payload_external_ = true;
+	payload_length_ = size;
 }
 
 const uint8_t WebSocketPacket::get_length_type()
@@ -365,7 +644,7 @@ const uint8_t WebSocketPacket::get_length_type()
 
 const uint8_t WebSocketPacket::get_header_size()
 {
-	int header_size = 0;
+	uint8_t header_size = 0;
 	if (get_length_type() < 126)
 	{
 		header_size = 2;
@@ -383,31 +662,95 @@ const uint8_t WebSocketPacket::get_header_size()
 	{
 		header_size += 4;
 	}
+
+	return header_size;
 }
 
 /*
 *  ByteBuffer
 *
 */
+// smallest allocation, enough for a handshake or a small frame
+#define BYTEBUFFER_MIN_CAPACITY 4096
+
 ByteBuffer::ByteBuffer()
 {
+	allocator = BufferPool::instance();
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
 	oft = 0;
 }
 
+ByteBuffer::ByteBuffer(BufferAllocator *alloc)
+{
+	allocator = (alloc == NULL) ? BufferPool::instance() : alloc;
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
+	oft = 0;
+}
+
+ByteBuffer::ByteBuffer(const ByteBuffer &other)
+{
+	allocator = other.allocator;
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
+	oft = 0;
+	*this = other;
+}
+
+ByteBuffer &ByteBuffer::operator=(const ByteBuffer &other)
+{
+	if (this == &other)
+	{
+		return *this;
+	}
+
+	start = 0;
+	end = 0;
+	int len = other.end - other.start;
+	if (len > 0)
+	{
+		ensure_space(len);
+		memcpy(data, other.data + other.start, len);
+		end = len;
+	}
+	oft = other.oft;
+	return *this;
+}
+
 ByteBuffer::~ByteBuffer()
 {
+	release();
+}
+
+void ByteBuffer::release()
+{
+	if (data != NULL)
+	{
+		allocator->deallocate(data, capacity);
+	}
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
 }
 
 bool ByteBuffer::require(int require)
 {
 	int len = length();
 
-	return require <= len - oft;
+	return require <= len - (int)oft;
 }
 
 char *ByteBuffer::curat()
 {
-	return (length() == 0) ? NULL : &data.at(oft);
+	return (length() == 0) ? NULL : data + start + oft;
 }
 
 int ByteBuffer::getoft()
@@ -432,7 +775,7 @@ bool ByteBuffer::read_bytes_x(char *cb, int size)
 {
 	if (require(size))
 	{
-		memcpy(cb, &data.at(oft), size);
+		memcpy(cb, data + start + oft, size);
 		oft += size;
 		return true;
 	}
@@ -449,14 +792,14 @@ void ByteBuffer::resetoft()
 
 int ByteBuffer::length()
 {
-	int len = (int)data.size();
+	int len = end - start;
 	//srs_assert(len >= 0);
 	return len;
 }
 
 char *ByteBuffer::bytes()
 {
-	return (length() == 0) ? NULL : &data.at(0);
+	return (length() == 0) ? NULL : data + start;
 }
 
 void ByteBuffer::erase(int size)
@@ -466,18 +809,178 @@ void ByteBuffer::erase(int size)
 		return;
 	}
 
+	// an empty buffer gives its memory back, so idle connections hold none
 	if (size >= length())
 	{
-		data.clear();
+		release();
 		return;
 	}
 
-	data.erase(data.begin(), data.begin() + size);
+	start += size;
 }
 
 void ByteBuffer::append(const char *bytes, int size)
+{
+	//srs_assert(size > 0);
+	if (size <= 0)
+	{
+		return;
+	}
+
+	ensure_space(size);
+	memcpy(data + end, bytes, size);
+	end += size;
+}
+
+char *ByteBuffer::grow(int size)
 {
 	//srs_assert(size > 0);
 
-	data.insert(data.end(), bytes, bytes + size);
+	ensure_space(size);
+	char *p = data + end;
+	end += size;
+	return p;
+}
+
+char *ByteBuffer::reserve(int size)
+{
+	ensure_space(size);
+	return data + end;
+}
+
+char *ByteBuffer::reserve(int size, int *room)
+{
+	int len = length();
+	if (end + size > capacity && len > 0 && start >= len)
+	{
+		// cheap to slide, see ensure_space
+		memmove(data, data + start, len);
+		start = 0;
+		end = len;
+	}
+
+	// only grow when what is left in the memory is too small to be worth
+	// a read, a read of a full block on top of a partial frame would
+	// double the buffer and move it off the pool.
+	if (end + size > capacity && capacity - end < BYTEBUFFER_MIN_CAPACITY)
+	{
+		ensure_space(size);
+	}
+
+	*room = capacity - end;
+	if (*room > size)
+	{
+		*room = size;
+	}
+	return data + end;
+}
+
+void ByteBuffer::commit(int size)
+{
+	if (size > 0)
+	{
+		end += size;
+	}
+	if (length() == 0)
+	{
+		release();
+	}
+}
+
+char *ByteBuffer::detach(BufferBlock &block)
+{
+	block.memory = data;
+	block.capacity = capacity;
+	block.allocator = allocator;
+	char *bytes = (length() == 0) ? NULL : data + start;
+
+	// the memory is not ours any more, release() must not give it back
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
+	oft = 0;
+	return bytes;
+}
+
+void ByteBuffer::set_allocator(BufferAllocator *alloc)
+{
+	if (alloc == NULL)
+	{
+		alloc = BufferPool::instance();
+	}
+	if (alloc == allocator)
+	{
+		return;
+	}
+
+	char *old_data = data;
+	int old_capacity = capacity;
+	int old_start = start;
+	int len = length();
+	BufferAllocator *old_allocator = allocator;
+
+	allocator = alloc;
+	data = NULL;
+	capacity = 0;
+	start = 0;
+	end = 0;
+	if (len > 0)
+	{
+		ensure_space(len);
+		memcpy(data, old_data + old_start, len);
+		end = len;
+	}
+	if (old_data != NULL)
+	{
+		old_allocator->deallocate(old_data, old_capacity);
+	}
+}
+
+void ByteBuffer::ensure_space(int size)
+{
+	if (end + size <= capacity)
+	{
+		return;
+	}
+
+	int len = length();
+
+	// only slide the bytes back when the consumed room is at least as large
+	// as what we have to move, so each byte is moved O(1) times on average.
+	if (len + size <= capacity && start >= len)
+	{
+		memmove(data, data + start, len);
+		start = 0;
+		end = len;
+		return;
+	}
+
+	int new_capacity = (capacity > 0x3FFFFFFF) ? 0x7FFFFFFF : capacity * 2;
+	if (new_capacity < BYTEBUFFER_MIN_CAPACITY)
+	{
+		new_capacity = BYTEBUFFER_MIN_CAPACITY;
+	}
+	if (new_capacity < len + size)
+	{
+		new_capacity = len + size;
+	}
+
+	char *new_data = allocator->allocate(new_capacity, &new_capacity);
+	if (new_data == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	if (len > 0)
+	{
+		memcpy(new_data, data + start, len);
+	}
+	if (data != NULL)
+	{
+		allocator->deallocate(data, capacity);
+	}
+	data = new_data;
+	capacity = new_capacity;
+	start = 0;
+	end = len;
 }
@@ -31,27 +31,59 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <sstream>
 #include <stdint.h>
 #include "string_helper.h"
+#include "ws_handshake.h"
+#include "ws_utf8.h"
 
 class ByteBuffer;
+class BufferAllocator;
+struct BufferBlock;
 
 #define WS_ERROR_INVALID_HANDSHAKE_PARAMS 10070
 #define WS_ERROR_INVALID_HANDSHAKE_FRAME 10071
 // max handshake frame = 100k
 #define WS_MAX_HANDSHAKE_FRAME_SIZE 1024 * 1000
+// 2 bytes + 8 bytes extended payload length + 4 bytes masking key
+#define WS_MAX_FRAME_HEADER_SIZE 14
+// max frame payload, it must fit in a ByteBuffer
+#define WS_MAX_FRAME_PAYLOAD_SIZE 0x7FFFFFFF
+// close frame status codes (RFC6455 7.4.1)
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_UNSUPPORTED_DATA 1003
+#define WS_CLOSE_INVALID_PAYLOAD 1007
+#define WS_CLOSE_POLICY_VIOLATION 1008
+#define WS_CLOSE_MESSAGE_TOO_BIG 1009
+#define WS_CLOSE_INTERNAL_ERROR 1011
 
 /**
-* a simple buffer class base on vector 
+* a simple buffer class with read/write cursors.
+* erase() only moves the read cursor, so consuming bytes from the beginning
+* is O(1). the consumed room is reclaimed lazily when append() runs out of
+* space at the end.
+* memory comes from a BufferAllocator, BufferPool by default, and is given
+* back as soon as the buffer becomes empty.
 */
 class ByteBuffer
 {
 private:
-    std::vector<char> data;
-
-    // current offset in bytes from data.at(0) (data beginning)
+    BufferAllocator *allocator;
+    char *data;
+    // allocated size of data
+    int capacity;
+    // valid bytes are [start, end) of data
+    int start;
+    int end;
+
+    // current offset in bytes from data[start] (data beginning)
     uint32_t oft;
 
 public:
     ByteBuffer();
+    // alloc must outlive the buffer, NULL means the default pool
+    explicit ByteBuffer(BufferAllocator *alloc);
+    ByteBuffer(const ByteBuffer &other);
+    ByteBuffer &operator=(const ByteBuffer &other);
     virtual ~ByteBuffer();
 
 public:
@@ -78,6 +110,46 @@ public:
 	* @remark assert size is positive.
 	*/
     virtual void append(const char *bytes, int size);
+    /**
+	* append size of uninitialized bytes to buffer.
+	* @return the address of the first appended byte, so callers
+	*       can write into the buffer directly.
+	* @remark assert size is positive.
+	*/
+    virtual char *grow(int size);
+    /**
+	* get room for size bytes after the end without appending them, so
+	*       a transport can receive into the buffer directly.
+	* @return the address of the room, valid until the buffer changes.
+	* @remark call commit() with the number of bytes written.
+	*/
+    virtual char *reserve(int size);
+    /**
+	* get room for up to size bytes after the end, without growing the
+	*       buffer while the memory it has left is worth a read.
+	* @param room set to the size of the room, at most size.
+	* @remark call commit() with the number of bytes written.
+	*/
+    virtual char *reserve(int size, int *room);
+    /**
+	* append size bytes written into the room got from reserve().
+	* @remark an empty buffer gives its memory back, so an unused
+	*       reservation costs nothing.
+	*/
+    virtual void commit(int size);
+    /**
+	* take memory from alloc from now on, NULL means the default pool.
+	* @remark the bytes are moved when the buffer is not empty.
+	*/
+    virtual void set_allocator(BufferAllocator *alloc);
+    /**
+	* hand the memory over, e.g. to a send queue, instead of copying the
+	*       bytes out. the buffer is left empty.
+	* @param block receives the memory and how to give it back.
+	* @return the first of the length() bytes the buffer held, NULL if
+	*       it was empty.
+	*/
+    virtual char *detach(BufferBlock &block);
 
     // resocman: exhance this class by adding thoes functions
     /** 
@@ -104,6 +176,39 @@ public:
 	* reset cur position to the beginning of vector
 	*/
     virtual void resetoft();
+
+private:
+    // make sure there is room for size bytes after end
+    void ensure_space(int size);
+    // give the memory back to allocator
+    void release();
+};
+
+/**
+* a read only view of bytes owned by someone else, usually a ByteBuffer.
+* it does not copy anything, and it is only valid until the owner is
+* modified or freed.
+*/
+class ByteView
+{
+public:
+    ByteView() : data_(NULL), size_(0) {}
+    ByteView(const char *data, int64_t size) : data_(data), size_(size) {}
+    ByteView(ByteBuffer &buf) : data_(buf.bytes()), size_(buf.length()) {}
+
+public:
+    /**
+	* get the bytes, NULL if empty.
+	*/
+    const char *bytes() const { return size_ == 0 ? NULL : data_; }
+    /**
+	* get the length of bytes. empty if zero.
+	*/
+    int64_t length() const { return size_; }
+
+private:
+    const char *data_;
+    int64_t size_;
 };
 
 class WebSocketPacket
@@ -140,9 +245,19 @@ public:
 	*/
     virtual int32_t recv_handshake(ByteBuffer &input);
 
-    // fetch handshake element
+    // fetch handshake element into params_, for callers holding the
+    // request in a std::string. recv_handshake does not use it.
     virtual int32_t fetch_hs_element(const std::string &msg);
 
+    /**
+    * get a header of the request scanned by recv_handshake
+    * @param header a WSHandshakeHeader
+    * @param length receives the length of the value, 0 if missing
+    * @return the value, it refers to the input of recv_handshake and is
+    *       only valid until that input is modified
+    */
+    const char *get_hs_header(int header, int32_t *length);
+
     /**
 	* pack a hand shake response packet
 	* @return errcode
@@ -151,31 +266,57 @@ public:
     virtual int32_t pack_handshake_rsp(std::string &hs_rsp);
 
     /**
-    * try to find and parse a data frame
+    * try to find and parse a data frame.
+    * the parser is resumable: once the header is decoded, every call
+    * consumes (and unmasks) whatever payload bytes input holds and keeps
+    * its progress, so the caller may erase input up to input.getoft().
     * @return an entire frame size 
     * 0 means we need to continue recving data, 
-    * and >0 means find get a frame successfule
+    * >0 means find get a frame successfule
+    * and <0 means an invalid frame
     */
-    virtual uint64_t recv_dataframe(ByteBuffer &input);
+    virtual int64_t recv_dataframe(ByteBuffer &input);
 
     /**
     * get frame info
-    * @return header size
+    * @return header size, 0 if input does not hold the whole header yet,
+    *       <0 if the frame can't be handled
     */
     virtual int32_t fetch_frame_info(ByteBuffer &input);
 
     /**
-    * get frame payload
-    * @return only payload size
+    * get frame payload, as much as input holds
+    * @return size of payload bytes consumed by this call, <0 if the
+    *       payload of a text message is not valid utf-8
     */
     virtual int32_t fetch_payload(ByteBuffer &input);
 
+    /**
+    * forget current frame, so this packet can parse the next one
+    */
+    virtual void reset();
+
     /**
     * pack a websocket data frame
     * @return 0 means successful
     */
     virtual int32_t pack_dataframe(ByteBuffer &input);
 
+    /**
+    * pack a websocket data frame into a caller provided region
+    * @param buf at least get_header_size() + get_payload_length() bytes
+    * @param size size of buf
+    * @return frame size written to buf, <0 if buf is too small
+    */
+    virtual int32_t pack_dataframe(char *buf, uint64_t size);
+
+    /**
+    * format the frame header (2 to 14 bytes) in one pass
+    * @param buf at least WS_MAX_FRAME_HEADER_SIZE bytes
+    * @return header size
+    */
+    int32_t encode_header(char *buf);
+
 public:
     const uint8_t get_fin() { return fin_; }
 
@@ -207,12 +348,73 @@ public:
 
     void set_payload(const char *buf, uint64_t size);
 
+    /**
+    * use buf as payload without copying it.
+    * buf must stay valid until the packet is packed.
+    */
+    void set_payload_view(const char *buf, uint64_t size);
+
+    /**
+    * stream payload mode: data frame payload is not collected into
+    * get_payload(). each recv_dataframe call unmasks the new bytes in place
+    * in the input buffer, and get_payload_view() refers to those bytes only.
+    */
+    void set_stream_payload(bool stream) { stream_payload_ = stream; }
+
     const uint8_t get_length_type();
 
     const uint8_t get_header_size();
 
+    // true once recv_dataframe has decoded the header of current frame
+    bool header_parsed() { return parse_state_ != WSParseState_Header; }
+
+    // the status to close the connection with after recv_dataframe has
+    // failed, e.g. WS_CLOSE_INVALID_PAYLOAD. 0 if there is none.
+    uint16_t get_close_status() { return close_status_; }
+
+    /**
+    * permessage-deflate has been negotiated: RSV1 marks the first frame of
+    * a compressed message. without it any RSV bit fails the frame.
+    */
+    void set_compression(bool compression) { compression_ = compression; }
+
+    // true if the current data message is compressed. its payload is
+    // not validated as utf-8 here, it is still deflated.
+    bool is_compressed_message() { return compressed_message_; }
+
+    // Sec-WebSocket-Extensions value pack_handshake_rsp sends, if not empty
+    void set_hs_extensions(const std::string &extensions) { hs_extensions_ = extensions; }
+
+    // true if protocol is one of the Sec-WebSocket-Protocol values of the
+    // request, scanned by recv_handshake or fetched by fetch_hs_element
+    bool has_hs_protocol(const char *protocol);
+
+    // Sec-WebSocket-Protocol value pack_handshake_rsp sends. if it is
+    // empty, a request listing protocols is answered with "chat".
+    void set_hs_protocol(const std::string &protocol) { hs_protocol_ = protocol; }
+
+    /**
+    * get the payload collected by set_payload() or by recv_dataframe()
+    * when a frame arrives in several pieces.
+    * @remark prefer get_payload_view(): a frame that arrives whole is
+    *       unmasked in place in the input buffer and not copied here.
+    */
     ByteBuffer &get_payload() { return payload_; }
 
+    /**
+    * get the payload of current frame wherever it is: in the input buffer
+    * given to recv_dataframe (valid until the input is modified), the
+    * buffer of set_payload_view() or get_payload(), however it was filled.
+    */
+    const ByteView &get_payload_view()
+    {
+        if (!payload_external_)
+        {
+            payload_view_ = ByteView(payload_);
+        }
+        return payload_view_;
+    }
+
 public:
     // get handshake packet length
     const uint32_t get_hs_length() { return hs_length_; }
@@ -220,7 +422,7 @@ public:
 public:
     const std::string mothod(void) const
     {
-        return mothod_;
+        return mothod_.empty() ? hs_span_string(hs_request_.method) : mothod_;
     }
 
     void mothod(const std::string &m)
@@ -230,7 +432,7 @@ public:
 
     const std::string uri(void) const
     {
-        return uri_;
+        return uri_.empty() ? hs_span_string(hs_request_.uri) : uri_;
     }
 
     void uri(const std::string &u)
@@ -240,7 +442,7 @@ public:
 
     const std::string version(void) const
     {
-        return version_;
+        return version_.empty() ? hs_span_string(hs_request_.version) : version_;
     }
 
     void version(const std::string &v)
@@ -250,9 +452,10 @@ public:
 
     bool has_param(const std::string &name) const
     {
-        return params_.find(name) != params_.end();
+        return params_.find(name) != params_.end() || find_hs_header(name) >= 0;
     }
 
+    // params_ first, then the headers scanned by recv_handshake
     const std::string get_param(const std::string &name) const
     {
         std::map<std::string, std::string>::const_iterator it =
@@ -261,6 +464,11 @@ public:
         {
             return it->second;
         }
+        int header = find_hs_header(name);
+        if (header >= 0)
+        {
+            return hs_span_string(hs_request_.headers[header]);
+        }
         return std::string();
     }
 
@@ -281,12 +489,23 @@ public:
         params_[name] = strHelper::valueOf<std::string, T>(v);
     }
 
+private:
+    // index of a scanned header named name, -1 if it is not present
+    int find_hs_header(const std::string &name) const;
+    std::string hs_span_string(const WSHandshakeSpan &span) const;
+
 private:
     std::string mothod_;
     std::string uri_;
     std::string version_;
     std::map<std::string, std::string> params_;
 
+    // request scanned by recv_handshake, as offsets from hs_base_
+    WSHandshakeRequest hs_request_;
+    const char *hs_base_;
+    std::string hs_extensions_;
+    std::string hs_protocol_;
+
 private:
     uint8_t fin_;
     uint8_t rsv1_;
@@ -301,7 +520,41 @@ private:
 private:
     uint32_t hs_length_;
 
+private:
+    enum WSParseState : uint8_t
+    {
+        WSParseState_Header = 0,
+        WSParseState_Payload,
+        WSParseState_Done,
+    };
+
+    // where recv_dataframe stopped in current frame
+    uint8_t parse_state_;
+    uint8_t header_size_;
+    // key byte to unmask the next payload byte with
+    uint32_t mask_phase_;
+    uint64_t payload_received_;
+    bool stream_payload_;
+    uint16_t close_status_;
+
+    // text messages are validated while their payload is unmasked. it
+    // spans the fragments of a message, so reset() keeps it.
+    bool text_message_;
+    WSUtf8State utf8_state_;
+    bool compression_;
+    bool compressed_message_;
+
+    // unmask (or copy) size payload bytes from src to dst, validating them
+    // if they belong to a text message
+    bool unmask_payload(char *dst, const char *src, int32_t size);
+
 public:
     ByteBuffer payload_;
+
+private:
+    ByteView payload_view_;
+    // payload_view_ refers outside payload_: to the buffer given to
+    // set_payload_view() or to a frame unmasked in place in the input
+    bool payload_external_;
 };
 #endif //_WS_PACKET_H_
\ No newline at end of file
@@ -0,0 +1,512 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "ws_atomic.h"
+#include "ws_endpoint.h"
+#include "ws_pubsub.h"
+
+struct WSPubSubTopic
+{
+    uint32_t hash;
+    std::string name;
+    std::vector<WSSubscription *> subs;
+};
+
+// a message queued for a shard. the topic bytes follow it
+struct WSPublication
+{
+    WSPublication *volatile next;
+    WSSharedFrame *frame;
+    WSSharedFrame *dictionary_frame;
+    uint32_t hash;
+    size_t topic_len;
+};
+
+// a slot of the topic table. probing compares hashes in this flat array
+// and only looks at a topic when the hash matches.
+struct WSTopicSlot
+{
+    uint32_t hash;
+    WSPubSubTopic *topic;
+};
+
+#define WS_TOPIC_TABLE_MIN 16
+#define WS_CACHE_LINE 64
+
+// subscribers of one event loop: a topic table, only used by the loop
+// thread, and the queue other threads publish into
+class WSPubSubShard
+{
+public:
+    WSPubSubShard();
+    ~WSPubSubShard();
+
+    WSPubSubTopic *find(uint32_t hash, const char *name, size_t len);
+    WSPubSubTopic *insert(uint32_t hash, const char *name, size_t len);
+    void erase(WSPubSubTopic *topic);
+
+    // any thread
+    void push(WSPublication *pub);
+    // loop thread. NULL if the queue is empty, or busy is set if a
+    // producer is half way through push and the rest comes later
+    WSPublication *pop(bool &busy);
+
+private:
+    void grow();
+
+public:
+    WSPubSub::wakeup_cb wakeup_;
+    void *wakeup_data_;
+
+    // written by the loop thread, read by publishers to skip the shard
+    volatile int32_t subscriptions_;
+
+    // producer side of the queue
+    char pad0_[WS_CACHE_LINE];
+    WSPublication *volatile head_;
+    // 1 once the loop has been woken and not dispatched yet
+    volatile int32_t signaled_;
+    volatile int64_t pending_;
+
+    // consumer side, loop thread only
+    char pad1_[WS_CACHE_LINE];
+    WSPublication *tail_;
+    WSPublication stub_;
+    WSTopicSlot *slots_;
+    uint32_t mask_;
+    uint32_t count_;
+    char pad2_[WS_CACHE_LINE];
+};
+
+bool WSSubscription::has_topic(const char *topic, size_t topic_len) const
+{
+    return topic_->name.size() == topic_len && memcmp(topic_->name.data(), topic, topic_len) == 0;
+}
+
+// fnv-1a
+static uint32_t topic_hash(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+WSPubSubShard::WSPubSubShard()
+    : wakeup_(NULL), wakeup_data_(NULL), subscriptions_(0), signaled_(0), pending_(0)
+{
+    stub_.next = NULL;
+    head_ = &stub_;
+    tail_ = &stub_;
+    mask_ = WS_TOPIC_TABLE_MIN - 1;
+    count_ = 0;
+    slots_ = (WSTopicSlot *)calloc(WS_TOPIC_TABLE_MIN, sizeof(WSTopicSlot));
+}
+
+WSPubSubShard::~WSPubSubShard()
+{
+    bool busy = false;
+    WSPublication *pub;
+    while ((pub = pop(busy)) != NULL)
+    {
+        pub->frame->unref();
+        if (pub->dictionary_frame != NULL)
+        {
+            pub->dictionary_frame->unref();
+        }
+        free(pub);
+    }
+    for (uint32_t i = 0; i <= mask_; i++)
+    {
+        WSPubSubTopic *topic = slots_[i].topic;
+        if (topic == NULL)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < topic->subs.size(); j++)
+        {
+            delete topic->subs[j];
+        }
+        delete topic;
+    }
+    free(slots_);
+}
+
+WSPubSubTopic *WSPubSubShard::find(uint32_t hash, const char *name, size_t len)
+{
+    for (uint32_t i = hash & mask_;; i = (i + 1) & mask_)
+    {
+        WSPubSubTopic *topic = slots_[i].topic;
+        if (topic == NULL)
+        {
+            return NULL;
+        }
+        if (slots_[i].hash == hash && topic->name.size() == len &&
+            memcmp(topic->name.data(), name, len) == 0)
+        {
+            return topic;
+        }
+    }
+}
+
+WSPubSubTopic *WSPubSubShard::insert(uint32_t hash, const char *name, size_t len)
+{
+    // at most 3/4 full, so probe sequences stay short
+    if ((count_ + 1) * 4 > (mask_ + 1) * 3)
+    {
+        grow();
+    }
+
+    WSPubSubTopic *topic = new WSPubSubTopic();
+    topic->hash = hash;
+    topic->name.assign(name, len);
+    uint32_t i = hash & mask_;
+    while (slots_[i].topic != NULL)
+    {
+        i = (i + 1) & mask_;
+    }
+    slots_[i].hash = hash;
+    slots_[i].topic = topic;
+    count_++;
+    return topic;
+}
+
+void WSPubSubShard::grow()
+{
+    uint32_t capacity = (mask_ + 1) * 2;
+    WSTopicSlot *slots = (WSTopicSlot *)calloc(capacity, sizeof(WSTopicSlot));
+    if (slots == NULL)
+    {
+        abort();
+    }
+    for (uint32_t i = 0; i <= mask_; i++)
+    {
+        if (slots_[i].topic == NULL)
+        {
+            continue;
+        }
+        uint32_t j = slots_[i].hash & (capacity - 1);
+        while (slots[j].topic != NULL)
+        {
+            j = (j + 1) & (capacity - 1);
+        }
+        slots[j] = slots_[i];
+    }
+    free(slots_);
+    slots_ = slots;
+    mask_ = capacity - 1;
+}
+
+void WSPubSubShard::erase(WSPubSubTopic *topic)
+{
+    uint32_t i = topic->hash & mask_;
+    while (slots_[i].topic != topic)
+    {
+        i = (i + 1) & mask_;
+    }
+
+    // backward shift: move up the entries whose probe sequence passes
+    // the hole, so the table needs no tombstones
+    uint32_t j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask_;
+        if (slots_[j].topic == NULL)
+        {
+            break;
+        }
+        uint32_t home = slots_[j].hash & mask_;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable)
+        {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i].topic = NULL;
+    count_--;
+    delete topic;
+}
+
+// an intrusive mpsc queue(D. Vyukov): producers swap the head and then
+// link the previous head to their node. the consumer follows the links
+// from the tail, and stub_ keeps the queue from ever being empty.
+void WSPubSubShard::push(WSPublication *pub)
+{
+    pub->next = NULL;
+    WSPublication *prev = ws_atomic_swap(&head_, pub);
+    ws_atomic_swap(&prev->next, pub);
+}
+
+WSPublication *WSPubSubShard::pop(bool &busy)
+{
+    WSPublication *tail = tail_;
+    WSPublication *next = tail->next;
+    if (tail == &stub_)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next;
+    }
+    if (next != NULL)
+    {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_)
+    {
+        busy = true;
+        return NULL;
+    }
+    // tail is the last node: put the stub behind it to take it out
+    push(&stub_);
+    next = tail->next;
+    if (next != NULL)
+    {
+        tail_ = next;
+        return tail;
+    }
+    busy = true;
+    return NULL;
+}
+
+WSPubSub::WSPubSub(int nshards)
+    : nshards_(nshards < 1 ? 1 : nshards), dictionary_(NULL),
+      dictionary_subscribers_(0), published_(0), delivered_(0)
+{
+    shards_ = new WSPubSubShard[nshards_];
+}
+
+WSPubSub::~WSPubSub()
+{
+    delete[] shards_;
+}
+
+void WSPubSub::set_wakeup(int shard, wakeup_cb cb, void *data)
+{
+    shards_[shard].wakeup_ = cb;
+    shards_[shard].wakeup_data_ = data;
+}
+
+WSSubscription *WSPubSub::subscribe(int shard, const char *topic, size_t topic_len,
+                                    WebSocketEndpoint *endpoint)
+{
+    WSPubSubShard &s = shards_[shard];
+    uint32_t hash = topic_hash(topic, topic_len);
+    WSPubSubTopic *t = s.find(hash, topic, topic_len);
+    if (t == NULL)
+    {
+        t = s.insert(hash, topic, topic_len);
+    }
+
+    WSSubscription *sub = new WSSubscription();
+    sub->endpoint = endpoint;
+    sub->next = NULL;
+    sub->topic_ = t;
+    sub->index_ = (uint32_t)t->subs.size();
+    sub->shard_ = shard;
+    sub->dictionary_ = endpoint->is_dictionary_enabled();
+    t->subs.push_back(sub);
+
+    ws_atomic_add(&s.subscriptions_, 1);
+    if (sub->dictionary_)
+    {
+        ws_atomic_add(&dictionary_subscribers_, 1);
+    }
+    return sub;
+}
+
+void WSPubSub::unsubscribe(WSSubscription *sub)
+{
+    WSPubSubShard &s = shards_[sub->shard_];
+    WSPubSubTopic *t = sub->topic_;
+
+    // the last subscription takes the free place
+    WSSubscription *last = t->subs.back();
+    t->subs[sub->index_] = last;
+    last->index_ = sub->index_;
+    t->subs.pop_back();
+    if (t->subs.empty())
+    {
+        s.erase(t);
+    }
+
+    ws_atomic_add(&s.subscriptions_, -1);
+    if (sub->dictionary_)
+    {
+        ws_atomic_add(&dictionary_subscribers_, -1);
+    }
+    delete sub;
+}
+
+// send the frames to the subscribers of a topic on this thread's shard
+static int64_t deliver(WSPubSubShard &s, uint32_t hash, const char *topic, size_t topic_len,
+                       WSSharedFrame *frame, WSSharedFrame *dictionary_frame)
+{
+    WSPubSubTopic *t = s.find(hash, topic, topic_len);
+    if (t == NULL)
+    {
+        return 0;
+    }
+
+    int64_t n = 0;
+    WSSubscription *const *subs = &t->subs[0];
+    size_t count = t->subs.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        WSSharedFrame *f = subs[i]->dictionary_ ? dictionary_frame : frame;
+        if (f != NULL && subs[i]->endpoint->send_shared(f) == 0)
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+int64_t WSPubSub::publish(const char *topic, size_t topic_len, uint8_t opcode,
+                          const char *data, int64_t size, int local_shard)
+{
+    WSSharedFrame *frame = WSSharedFrame::create(opcode, data, size);
+    if (frame == NULL)
+    {
+        return -1;
+    }
+    WSSharedFrame *dictionary_frame = NULL;
+    if (dictionary_ != NULL && ws_atomic_add(&dictionary_subscribers_, 0) > 0)
+    {
+        dictionary_frame = WSSharedFrame::create(opcode, data, size, dictionary_);
+    }
+    ws_atomic_add(&published_, 1);
+
+    uint32_t hash = topic_hash(topic, topic_len);
+    int64_t rc = 0;
+    for (int i = 0; i < nshards_; i++)
+    {
+        WSPubSubShard &s = shards_[i];
+        // a shard without subscribers has nothing to look up. one
+        // subscribing meanwhile may miss the message either way.
+        if (i == local_shard || s.subscriptions_ == 0)
+        {
+            continue;
+        }
+
+        WSPublication *pub = (WSPublication *)malloc(sizeof(WSPublication) + topic_len);
+        if (pub == NULL)
+        {
+            rc = -1;
+            continue;
+        }
+        frame->ref();
+        pub->frame = frame;
+        if (dictionary_frame != NULL)
+        {
+            dictionary_frame->ref();
+        }
+        pub->dictionary_frame = dictionary_frame;
+        pub->hash = hash;
+        pub->topic_len = topic_len;
+        memcpy(pub + 1, topic, topic_len);
+
+        ws_atomic_add(&s.pending_, 1);
+        s.push(pub);
+        // only the first publication after a dispatch wakes the loop
+        if (ws_atomic_swap(&s.signaled_, 1) == 0 && s.wakeup_ != NULL)
+        {
+            s.wakeup_(s.wakeup_data_);
+        }
+    }
+
+    if (local_shard >= 0 && local_shard < nshards_)
+    {
+        int64_t n = deliver(shards_[local_shard], hash, topic, topic_len, frame, dictionary_frame);
+        ws_atomic_add(&delivered_, n);
+        if (rc == 0)
+        {
+            rc = n;
+        }
+    }
+
+    frame->unref();
+    if (dictionary_frame != NULL)
+    {
+        dictionary_frame->unref();
+    }
+    return rc;
+}
+
+int64_t WSPubSub::dispatch(int shard)
+{
+    WSPubSubShard &s = shards_[shard];
+    // publications pushed from now on wake the loop again
+    ws_atomic_swap(&s.signaled_, 0);
+
+    int64_t n = 0;
+    int64_t count = 0;
+    bool busy = false;
+    WSPublication *pub;
+    while ((pub = s.pop(busy)) != NULL)
+    {
+        n += deliver(s, pub->hash, (const char *)(pub + 1), pub->topic_len,
+                     pub->frame, pub->dictionary_frame);
+        pub->frame->unref();
+        if (pub->dictionary_frame != NULL)
+        {
+            pub->dictionary_frame->unref();
+        }
+        free(pub);
+        count++;
+    }
+    ws_atomic_add(&s.pending_, -count);
+    ws_atomic_add(&delivered_, n);
+
+    // a producer has swapped the head but not linked its node yet, and
+    // may have found the loop signaled already: come back for it
+    if (busy && ws_atomic_swap(&s.signaled_, 1) == 0 && s.wakeup_ != NULL)
+    {
+        s.wakeup_(s.wakeup_data_);
+    }
+    return n;
+}
+
+WSPubSubStats WSPubSub::get_stats()
+{
+    WSPubSubStats stats;
+    stats.published = ws_atomic_load(&published_);
+    stats.delivered = ws_atomic_load(&delivered_);
+    stats.pending = 0;
+    for (int i = 0; i < nshards_; i++)
+    {
+        stats.pending += ws_atomic_load(&shards_[i].pending_);
+    }
+    return stats;
+}
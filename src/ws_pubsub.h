@@ -0,0 +1,143 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* topic based publish/subscribe over shared frames
+*/
+
+#ifndef _WS_PUBSUB_H_
+#define _WS_PUBSUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class WebSocketEndpoint;
+class WSSharedFrame;
+class WSDeflateDictionary;
+class WSPubSubShard;
+struct WSPubSubTopic;
+
+/**
+* a connection subscribed to a topic, made by WSPubSub::subscribe and
+* freed by WSPubSub::unsubscribe
+*/
+struct WSSubscription
+{
+    WebSocketEndpoint *endpoint;
+    // free for the owner, e.g. to chain the subscriptions of a connection
+    WSSubscription *next;
+
+    bool has_topic(const char *topic, size_t topic_len) const;
+
+    // the rest belongs to the hub
+    WSPubSubTopic *topic_;
+    uint32_t index_;
+    int shard_;
+    bool dictionary_;
+};
+
+struct WSPubSubStats
+{
+    // publish calls, and frames handed to subscribers
+    int64_t published;
+    int64_t delivered;
+    // publications queued for other shards and not dispatched yet
+    int64_t pending;
+};
+
+/**
+* a pub/sub hub: connections subscribe to topics, and a publish packs its
+* message once(WSSharedFrame) and sends it to every subscriber with
+* WebSocketEndpoint::send_shared.
+*
+* subscribers are split into shards, one per event loop. a shard is only
+* used by the thread of its loop: subscribe, unsubscribe and dispatch take
+* no lock. publish may be called from any thread. it delivers right away
+* to the shard of the calling loop if it is given, and queues a reference
+* to the frame on every other shard with subscribers, through a lock free
+* multi producer single consumer queue. the wakeup function of a shard is
+* called when its queue becomes non empty, e.g. uv_async_send, and the
+* loop thread then calls dispatch.
+* @remark the shared writers of the endpoints must not subscribe or
+*       unsubscribe, they are called during delivery.
+*/
+class WSPubSub
+{
+public:
+    typedef void (*wakeup_cb)(void *data);
+
+    explicit WSPubSub(int nshards);
+    ~WSPubSub();
+
+    int shard_count() const { return nshards_; }
+
+    // call it before any publish. cb runs on the publishing thread.
+    void set_wakeup(int shard, wakeup_cb cb, void *data);
+
+    // the dictionary of the endpoints on the preset dictionary
+    // subprotocol, so they get frames encoded with it. it must outlive
+    // the hub. call it before the first subscribe.
+    void set_dictionary(const WSDeflateDictionary *dictionary) { dictionary_ = dictionary; }
+
+    /**
+    * subscribe endpoint to a topic, on the thread of shard. the endpoint
+    * must have completed its handshake, and be unsubscribed before it is
+    * deleted.
+    */
+    WSSubscription *subscribe(int shard, const char *topic, size_t topic_len,
+                              WebSocketEndpoint *endpoint);
+    // on the thread of the shard of sub. sub is freed
+    void unsubscribe(WSSubscription *sub);
+
+    /**
+    * send a message to every subscriber of topic
+    * @param local_shard the shard of the calling thread, delivered before
+    *       returning. -1 if the thread owns no shard
+    * @return subscribers reached on local_shard, or -1 if out of memory
+    */
+    int64_t publish(const char *topic, size_t topic_len, uint8_t opcode,
+                    const char *data, int64_t size, int local_shard = -1);
+
+    /**
+    * deliver what other threads published for shard, on its thread
+    * @return frames delivered
+    */
+    int64_t dispatch(int shard);
+
+    WSPubSubStats get_stats();
+
+private:
+    WSPubSub(const WSPubSub &);
+    WSPubSub &operator=(const WSPubSub &);
+
+private:
+    int nshards_;
+    WSPubSubShard *shards_;
+    const WSDeflateDictionary *dictionary_;
+    // subscriptions of endpoints on the dictionary subprotocol, in all
+    // shards. publish makes the dictionary frame only if there are some
+    volatile int32_t dictionary_subscribers_;
+    volatile int64_t published_;
+    volatile int64_t delivered_;
+};
+
+#endif //_WS_PUBSUB_H_
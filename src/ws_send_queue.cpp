@@ -0,0 +1,353 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ws_atomic.h"
+#include "ws_buffer_pool.h"
+#include "ws_packet.h"
+#include "ws_shared_frame.h"
+#include "ws_send_queue.h"
+
+static volatile int64_t total_queued_bytes_ = 0;
+static volatile int64_t total_queued_frames_ = 0;
+static volatile int64_t total_dropped_frames_ = 0;
+static volatile int64_t total_dropped_bytes_ = 0;
+static volatile int64_t total_overflows_ = 0;
+static volatile int64_t total_pauses_ = 0;
+
+WSSendLimits ws_send_default_limits()
+{
+    WSSendLimits limits;
+    limits.low_watermark = 64 * 1024;
+    limits.high_watermark = 1024 * 1024;
+    limits.max_queued = 16 * 1024 * 1024;
+    limits.policy = WS_SLOW_CLOSE;
+    return limits;
+}
+
+// a whole unfragmented and uncompressed data message
+static bool is_droppable(const char *data, int64_t size)
+{
+    if (size < 2)
+    {
+        return false;
+    }
+    uint8_t b0 = (uint8_t)data[0];
+    return b0 == 0x81 || b0 == 0x82;
+}
+
+// close, ping and pong frames: FIN and an opcode from 8
+static bool is_control(const char *data, int64_t size)
+{
+    if (size < 2)
+    {
+        return false;
+    }
+    uint8_t b0 = (uint8_t)data[0];
+    return (b0 & 0x80) && (b0 & 0x0F) >= 8;
+}
+
+WSSendQueue::WSSendQueue(const WSSendLimits *limits)
+    : limits_(limits), head_(0), head_offset_(0), peeked_(0), queued_bytes_(0), paused_(false)
+{
+}
+
+WSSendQueue::~WSSendQueue()
+{
+    for (size_t i = head_; i < entries_.size(); i++)
+    {
+        release(entries_[i]);
+    }
+    ws_atomic_add(&total_queued_bytes_, -queued_bytes_);
+    ws_atomic_add(&total_queued_frames_, -(int64_t)(entries_.size() - head_));
+}
+
+void WSSendQueue::release(Entry &entry)
+{
+    if (entry.frame != NULL)
+    {
+        entry.frame->unref();
+    }
+    else if (entry.allocator != NULL)
+    {
+        entry.allocator->deallocate(entry.memory, entry.capacity);
+    }
+    else
+    {
+        free((void *)entry.data);
+    }
+    entry.data = NULL;
+    entry.frame = NULL;
+}
+
+WSSendResult WSSendQueue::push(const char *buf, int64_t size)
+{
+    char *copy = (char *)malloc(size > 0 ? size : 1);
+    if (copy == NULL)
+    {
+        return WS_SEND_OVERFLOW;
+    }
+    memcpy(copy, buf, size);
+    return push_owned(copy, size);
+}
+
+WSSendResult WSSendQueue::push_owned(char *buf, int64_t size)
+{
+    Entry entry;
+    entry.data = buf;
+    entry.size = size;
+    entry.frame = NULL;
+    entry.memory = NULL;
+    entry.capacity = 0;
+    entry.allocator = NULL;
+    entry.droppable = is_droppable(buf, size);
+    return push_entry(entry, is_control(buf, size));
+}
+
+WSSendResult WSSendQueue::push(ByteBuffer &frame)
+{
+    int64_t size = frame.length();
+    BufferBlock block;
+    Entry entry;
+    entry.data = frame.detach(block);
+    entry.size = size;
+    entry.frame = NULL;
+    entry.memory = block.memory;
+    entry.capacity = block.capacity;
+    entry.allocator = block.allocator;
+    if (entry.data == NULL)
+    {
+        // nothing to send, the memory goes back
+        release(entry);
+        return WS_SEND_QUEUED;
+    }
+    entry.droppable = is_droppable(entry.data, size);
+    return push_entry(entry, is_control(entry.data, size));
+}
+
+WSSendResult WSSendQueue::push_shared(WSSharedFrame *frame)
+{
+    Entry entry;
+    entry.data = frame->bytes();
+    entry.size = frame->length();
+    entry.frame = frame;
+    entry.memory = NULL;
+    entry.capacity = 0;
+    entry.allocator = NULL;
+    entry.droppable = is_droppable(entry.data, entry.size);
+    frame->ref();
+    return push_entry(entry, is_control(entry.data, entry.size));
+}
+
+WSSendResult WSSendQueue::push_entry(Entry &entry, bool control)
+{
+    WSSendResult result = WS_SEND_QUEUED;
+    if (limits_ != NULL && !control && queued_bytes_ + entry.size > limits_->max_queued)
+    {
+        if (limits_->policy == WS_SLOW_KEEP_LATEST && entry.droppable)
+        {
+            drop(-1);
+        }
+        else if (limits_->policy != WS_SLOW_CLOSE)
+        {
+            drop(queued_bytes_ + entry.size - limits_->max_queued);
+        }
+
+        if (queued_bytes_ + entry.size > limits_->max_queued)
+        {
+            // a data message can go instead, a fragment can't
+            if (limits_->policy != WS_SLOW_CLOSE && entry.droppable)
+            {
+                result = WS_SEND_DROPPED;
+                ws_atomic_add(&total_dropped_frames_, 1);
+                ws_atomic_add(&total_dropped_bytes_, entry.size);
+            }
+            else
+            {
+                result = WS_SEND_OVERFLOW;
+                ws_atomic_add(&total_overflows_, 1);
+            }
+            release(entry);
+            return result;
+        }
+    }
+
+    if (head_ > 0 && head_ == entries_.size())
+    {
+        entries_.clear();
+        head_ = 0;
+        peeked_ = 0;
+    }
+    entries_.push_back(entry);
+    queued_bytes_ += entry.size;
+    ws_atomic_add(&total_queued_bytes_, entry.size);
+    ws_atomic_add(&total_queued_frames_, 1);
+    update_pause();
+    return result;
+}
+
+void WSSendQueue::drop(int64_t need)
+{
+    // entries being written stay, and so does a partly written front
+    size_t first = head_ + peeked_;
+    if (first == head_ && head_offset_ > 0)
+    {
+        first++;
+    }
+
+    int64_t freed = 0;
+    int64_t frames = 0;
+    size_t out = first;
+    for (size_t i = first; i < entries_.size(); i++)
+    {
+        Entry &entry = entries_[i];
+        if (entry.droppable && (need < 0 || freed < need))
+        {
+            freed += entry.size;
+            frames++;
+            release(entry);
+            continue;
+        }
+        entries_[out++] = entry;
+    }
+    entries_.resize(out);
+
+    if (frames > 0)
+    {
+        queued_bytes_ -= freed;
+        ws_atomic_add(&total_queued_bytes_, -freed);
+        ws_atomic_add(&total_queued_frames_, -frames);
+        ws_atomic_add(&total_dropped_frames_, frames);
+        ws_atomic_add(&total_dropped_bytes_, freed);
+        update_pause();
+    }
+}
+
+void WSSendQueue::discard()
+{
+    // every pending entry counts as droppable here
+    size_t first = head_ + peeked_;
+    if (first == head_ && head_offset_ > 0)
+    {
+        first++;
+    }
+    int64_t freed = 0;
+    int64_t frames = 0;
+    for (size_t i = first; i < entries_.size(); i++)
+    {
+        freed += entries_[i].size;
+        frames++;
+        release(entries_[i]);
+    }
+    if (first < entries_.size())
+    {
+        entries_.resize(first);
+    }
+    queued_bytes_ -= freed;
+    ws_atomic_add(&total_queued_bytes_, -freed);
+    ws_atomic_add(&total_queued_frames_, -frames);
+    update_pause();
+}
+
+int32_t WSSendQueue::peek(WSSendBuf *bufs, int32_t n)
+{
+    int32_t count = 0;
+    int64_t offset = head_offset_;
+    for (size_t i = head_; i < entries_.size() && count < n; i++)
+    {
+        bufs[count].data = entries_[i].data + offset;
+        bufs[count].size = entries_[i].size - offset;
+        offset = 0;
+        count++;
+    }
+    peeked_ = count;
+    return count;
+}
+
+void WSSendQueue::consume(int64_t size)
+{
+    int64_t consumed = 0;
+    int64_t frames = 0;
+    while (size > 0 && head_ < entries_.size())
+    {
+        Entry &entry = entries_[head_];
+        int64_t rest = entry.size - head_offset_;
+        if (size < rest)
+        {
+            head_offset_ += size;
+            consumed += size;
+            break;
+        }
+        size -= rest;
+        consumed += rest;
+        frames++;
+        release(entry);
+        head_++;
+        head_offset_ = 0;
+    }
+    peeked_ = 0;
+
+    // keep the vector from growing while the queue never drains
+    if (head_ == entries_.size())
+    {
+        entries_.clear();
+        head_ = 0;
+    }
+    else if (head_ >= 64 && head_ * 2 >= entries_.size())
+    {
+        entries_.erase(entries_.begin(), entries_.begin() + head_);
+        head_ = 0;
+    }
+
+    queued_bytes_ -= consumed;
+    ws_atomic_add(&total_queued_bytes_, -consumed);
+    ws_atomic_add(&total_queued_frames_, -frames);
+    update_pause();
+}
+
+void WSSendQueue::update_pause()
+{
+    if (limits_ == NULL)
+    {
+        return;
+    }
+    if (!paused_ && queued_bytes_ > limits_->high_watermark)
+    {
+        paused_ = true;
+        ws_atomic_add(&total_pauses_, 1);
+    }
+    else if (paused_ && queued_bytes_ <= limits_->low_watermark)
+    {
+        paused_ = false;
+    }
+}
+
+void WSSendQueue::get_totals(WSSendQueueStats &stats)
+{
+    stats.queued_bytes = ws_atomic_load(&total_queued_bytes_);
+    stats.queued_frames = ws_atomic_load(&total_queued_frames_);
+    stats.dropped_frames = ws_atomic_load(&total_dropped_frames_);
+    stats.dropped_bytes = ws_atomic_load(&total_dropped_bytes_);
+    stats.overflows = ws_atomic_load(&total_overflows_);
+    stats.pauses = ws_atomic_load(&total_pauses_);
+}
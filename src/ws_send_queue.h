@@ -0,0 +1,185 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* outbound queue of a connection: byte accounting, watermarks and the
+* policy for slow consumers
+*/
+
+#ifndef _WS_SEND_QUEUE_H_
+#define _WS_SEND_QUEUE_H_
+
+#include <stdint.h>
+#include <vector>
+
+class ByteBuffer;
+class BufferAllocator;
+class WSSharedFrame;
+
+// what happens to a frame that would take the queue over max_queued
+enum WSSlowConsumerPolicy
+{
+    // drop queued data messages, oldest first, until it fits
+    WS_SLOW_DROP_OLDEST = 0,
+    // drop every queued data message, only the latest one is kept
+    WS_SLOW_KEEP_LATEST = 1,
+    // refuse it, the connection should be closed with status 1008
+    WS_SLOW_CLOSE = 2
+};
+
+struct WSSendLimits
+{
+    // queued bytes above high_watermark pause the producer, e.g. the
+    // reads of the connection, until they fall to low_watermark
+    int64_t low_watermark;
+    int64_t high_watermark;
+    // queued bytes allowed before policy applies. control frames are
+    // always taken
+    int64_t max_queued;
+    WSSlowConsumerPolicy policy;
+};
+
+// 64K/1M watermarks, 16M limit, close 1008
+WSSendLimits ws_send_default_limits();
+
+// results of WSSendQueue::push
+enum WSSendResult
+{
+    WS_SEND_QUEUED = 0,
+    // a data message was dropped by policy instead
+    WS_SEND_DROPPED = 1,
+    // over max_queued and nothing left to drop: fail the connection with
+    // WS_CLOSE_POLICY_VIOLATION
+    WS_SEND_OVERFLOW = -1
+};
+
+struct WSSendQueueStats
+{
+    // in all queues of the process now
+    int64_t queued_bytes;
+    int64_t queued_frames;
+    // since start
+    int64_t dropped_frames;
+    int64_t dropped_bytes;
+    int64_t overflows;
+    int64_t pauses;
+};
+
+// a piece of the queue to write
+struct WSSendBuf
+{
+    const char *data;
+    int64_t size;
+};
+
+/**
+* frames waiting to be written to one connection, in order. the transport
+* queues what WebSocketEndpoint gives to the write callbacks, takes the
+* front with peek(), writes it and calls consume() with the number of
+* bytes written.
+*
+* each buffer pushed must be one whole frame(or the handshake response),
+* as to_wire and send_shared hand them out. a frame with FIN, no RSV bit
+* and a text or binary opcode is a whole message that may be dropped by
+* policy. fragments and compressed frames are kept, since dropping them
+* would break the stream or the compression context of the peer.
+* @remark not thread safe, use it from the thread of the connection.
+*/
+class WSSendQueue
+{
+public:
+    // limits must outlive the queue. NULL: unbounded, never paused
+    explicit WSSendQueue(const WSSendLimits *limits = NULL);
+    ~WSSendQueue();
+
+    // queue a copy of buf
+    WSSendResult push(const char *buf, int64_t size);
+    // queue the bytes of frame, taking its memory(ByteBuffer::detach)
+    // instead of copying them. frame is left empty
+    WSSendResult push(ByteBuffer &frame);
+    // queue buf, a malloc'd block the queue now owns(and frees even if it
+    // is not queued)
+    WSSendResult push_owned(char *buf, int64_t size);
+    // queue a reference to frame, ref() is taken if it is queued
+    WSSendResult push_shared(WSSharedFrame *frame);
+
+    /**
+    * the front of the queue, from the first byte not written yet
+    * @return pieces filled, at most n. they stay valid and are not
+    *       dropped until the next consume()
+    */
+    int32_t peek(WSSendBuf *bufs, int32_t n);
+    // bytes from the front were written
+    void consume(int64_t size);
+
+    // drop every frame that is not being written, e.g. when the
+    // connection fails. the piece being written is kept
+    void discard();
+
+    bool empty() const { return head_ == entries_.size(); }
+    int64_t queued_bytes() const { return queued_bytes_; }
+    int32_t queued_frames() const { return (int32_t)(entries_.size() - head_); }
+    // above the high watermark, and not back to the low one yet
+    bool is_paused() const { return paused_; }
+
+    // totals of every queue in the process
+    static void get_totals(WSSendQueueStats &stats);
+
+private:
+    struct Entry
+    {
+        const char *data;
+        int64_t size;
+        // NULL if data is a malloc'd block of the queue
+        WSSharedFrame *frame;
+        // the memory of a ByteBuffer data is in, given back to allocator.
+        // NULL if it is not
+        char *memory;
+        int capacity;
+        BufferAllocator *allocator;
+        bool droppable;
+    };
+
+    WSSendResult push_entry(Entry &entry, bool control);
+    // drop data messages not in peek, oldest first, until at least need
+    // bytes are freed(all of them if need < 0)
+    void drop(int64_t need);
+    void release(Entry &entry);
+    void update_pause();
+
+private:
+    WSSendQueue(const WSSendQueue &);
+    WSSendQueue &operator=(const WSSendQueue &);
+
+private:
+    const WSSendLimits *limits_;
+    std::vector<Entry> entries_;
+    // the front entry, and how much of it is written
+    size_t head_;
+    int64_t head_offset_;
+    // entries handed out by the last peek
+    size_t peeked_;
+    int64_t queued_bytes_;
+    bool paused_;
+};
+
+#endif //_WS_SEND_QUEUE_H_
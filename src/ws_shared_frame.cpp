@@ -0,0 +1,84 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <new>
+#include "ws_atomic.h"
+#include "ws_deflate.h"
+#include "ws_packet.h"
+#include "ws_shared_frame.h"
+
+WSSharedFrame *WSSharedFrame::create(uint8_t opcode, const char *data, int64_t size,
+                                     const WSDeflateDictionary *dictionary)
+{
+    ByteBuffer encoded;
+    if (dictionary != NULL)
+    {
+        int32_t n = dictionary->compress(opcode, data, size, encoded);
+        if (n < 0)
+        {
+            return NULL;
+        }
+        // the subprotocol sends every message in binary frames
+        opcode = WebSocketPacket::WSOpcode_Binary;
+        data = encoded.bytes();
+        size = n;
+    }
+
+    WebSocketPacket wspacket;
+    wspacket.set_fin(1);
+    wspacket.set_opcode(opcode);
+    wspacket.set_payload_view(data, size);
+    int64_t frame_size = wspacket.get_header_size() + size;
+
+    // one allocation for the object and the frame
+    void *mem = malloc(sizeof(WSSharedFrame) + frame_size);
+    if (mem == NULL)
+    {
+        return NULL;
+    }
+    WSSharedFrame *frame = new (mem) WSSharedFrame();
+    frame->refs_ = 1;
+    frame->dictionary_ = dictionary;
+    frame->data_ = (char *)mem + sizeof(WSSharedFrame);
+    frame->size_ = wspacket.pack_dataframe(frame->data_, frame_size);
+    if (frame->size_ < 0)
+    {
+        frame->unref();
+        return NULL;
+    }
+    return frame;
+}
+
+void WSSharedFrame::ref()
+{
+    ws_atomic_add(&refs_, 1);
+}
+
+void WSSharedFrame::unref()
+{
+    if (ws_atomic_add(&refs_, -1) == 0)
+    {
+        this->~WSSharedFrame();
+        free(this);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* a frame encoded once and sent to many connections
+*/
+
+#ifndef _WS_SHARED_FRAME_H_
+#define _WS_SHARED_FRAME_H_
+
+#include <stdint.h>
+
+class WSDeflateDictionary;
+
+/**
+* an unmasked server frame packed into one immutable buffer. frames from
+* the server are not masked, so the bytes are the same for every
+* recipient: a broadcast packs its message once, and each connection
+* queues a reference instead of a copy.
+* @remark reference counted, ref() and unref() may be called from any
+*       thread. the bytes are never modified after create().
+*/
+class WSSharedFrame
+{
+public:
+    /**
+    * pack a whole message into a single frame with FIN set
+    * @param dictionary NULL for a plain frame. otherwise the message is
+    *       encoded for connections on that dictionary subprotocol
+    * @return a frame holding one reference, NULL if out of memory
+    */
+    static WSSharedFrame *create(uint8_t opcode, const char *data, int64_t size,
+                                 const WSDeflateDictionary *dictionary = NULL);
+
+    void ref();
+    // the last reference frees the frame
+    void unref();
+
+    const char *bytes() const { return data_; }
+    int64_t length() const { return size_; }
+
+    // the dictionary the payload is encoded with, NULL if plain
+    const WSDeflateDictionary *get_dictionary() const { return dictionary_; }
+
+private:
+    WSSharedFrame() {}
+    ~WSSharedFrame() {}
+    WSSharedFrame(const WSSharedFrame &);
+    WSSharedFrame &operator=(const WSSharedFrame &);
+
+private:
+    volatile int32_t refs_;
+    int64_t size_;
+    const WSDeflateDictionary *dictionary_;
+    // the frame follows this object in the same allocation
+    char *data_;
+};
+
+#endif //_WS_SHARED_FRAME_H_
@@ -0,0 +1,221 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "ws_timer_wheel.h"
+
+#define WHEEL_L0_BITS 10
+#define WHEEL_LN_BITS 6
+#define WHEEL_L0_SIZE (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1 << WHEEL_LN_BITS)
+#define WHEEL_L0_MASK (WHEEL_L0_SIZE - 1)
+#define WHEEL_LN_MASK (WHEEL_LN_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_MAX_TICKS ((uint64_t)1 << (WHEEL_L0_BITS + 3 * WHEEL_LN_BITS))
+
+// first list head of a level
+static inline int level_base(int level)
+{
+    return level == 0 ? 0 : WHEEL_L0_SIZE + (level - 1) * WHEEL_LN_SIZE;
+}
+
+// first tick bit of a level
+static inline int level_shift(int level)
+{
+    return level == 0 ? 0 : WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+}
+
+static inline void list_init(WSTimer *head)
+{
+    head->prev_ = head;
+    head->next_ = head;
+}
+
+static inline void list_append(WSTimer *head, WSTimer *timer)
+{
+    timer->prev_ = head->prev_;
+    timer->next_ = head;
+    head->prev_->next_ = timer;
+    head->prev_ = timer;
+}
+
+static inline void list_unlink(WSTimer *timer)
+{
+    timer->prev_->next_ = timer->next_;
+    timer->next_->prev_ = timer->prev_;
+    timer->prev_ = NULL;
+    timer->next_ = NULL;
+}
+
+// move every timer of from to the empty head to
+static inline void list_splice(WSTimer *from, WSTimer *to)
+{
+    if (from->next_ == from)
+    {
+        list_init(to);
+        return;
+    }
+    to->next_ = from->next_;
+    to->prev_ = from->prev_;
+    to->next_->prev_ = to;
+    to->prev_->next_ = to;
+    list_init(from);
+}
+
+WSTimerWheel::WSTimerWheel(uint32_t tick_ms, uint64_t now_ms)
+    : tick_ms_(tick_ms ? tick_ms : 1), count_(0)
+{
+    now_ = now_ms / tick_ms_;
+    current_ = now_;
+    for (int i = 0; i < WHEEL_L0_SIZE + 3 * WHEEL_LN_SIZE; i++)
+    {
+        list_init(&slots_[i]);
+    }
+}
+
+WSTimerWheel::~WSTimerWheel()
+{
+    // timers still started are only detached, they belong to their owners
+    for (int i = 0; i < WHEEL_L0_SIZE + 3 * WHEEL_LN_SIZE; i++)
+    {
+        while (slots_[i].next_ != &slots_[i])
+        {
+            list_unlink(slots_[i].next_);
+        }
+    }
+}
+
+void WSTimerWheel::init(WSTimer *timer, ws_timer_cb cb, void *data)
+{
+    timer->cb = cb;
+    timer->data = data;
+    timer->prev_ = NULL;
+    timer->next_ = NULL;
+    timer->expires_ = 0;
+}
+
+void WSTimerWheel::add(WSTimer *timer)
+{
+    uint64_t expires = timer->expires_;
+    uint64_t delta = expires - now_;
+    if (expires < now_)
+    {
+        // late, run it with the next tick
+        expires = now_;
+        delta = 0;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << level_shift(level + 1)))
+    {
+        level++;
+    }
+    uint32_t mask = level == 0 ? WHEEL_L0_MASK : WHEEL_LN_MASK;
+    uint32_t index = (uint32_t)(expires >> level_shift(level)) & mask;
+    list_append(&slots_[level_base(level) + index], timer);
+}
+
+void WSTimerWheel::start(WSTimer *timer, uint64_t delay_ms)
+{
+    if (is_active(timer))
+    {
+        list_unlink(timer);
+        count_--;
+    }
+    uint64_t ticks = (delay_ms + tick_ms_ - 1) / tick_ms_;
+    if (ticks >= WHEEL_MAX_TICKS)
+    {
+        ticks = WHEEL_MAX_TICKS - 1;
+    }
+    timer->expires_ = current_ + ticks;
+    add(timer);
+    count_++;
+}
+
+void WSTimerWheel::stop(WSTimer *timer)
+{
+    if (is_active(timer))
+    {
+        list_unlink(timer);
+        count_--;
+    }
+}
+
+uint32_t WSTimerWheel::cascade(int level, uint32_t index)
+{
+    WSTimer list;
+    list_splice(&slots_[level_base(level) + index], &list);
+    while (list.next_ != &list)
+    {
+        WSTimer *timer = list.next_;
+        list_unlink(timer);
+        add(timer);
+    }
+    return index;
+}
+
+int64_t WSTimerWheel::advance(uint64_t now_ms)
+{
+    uint64_t target = now_ms / tick_ms_;
+    int64_t expired = 0;
+    if (target > current_)
+    {
+        current_ = target;
+    }
+    while (now_ <= target)
+    {
+        if (count_ == 0)
+        {
+            // nothing to run in the ticks left
+            now_ = target + 1;
+            break;
+        }
+
+        uint32_t index = (uint32_t)now_ & WHEEL_L0_MASK;
+        // level 0 wrapped: bring down the next slot of level 1, and so on
+        if (index == 0)
+        {
+            for (int level = 1; level < WHEEL_LEVELS; level++)
+            {
+                uint32_t slot = (uint32_t)(now_ >> level_shift(level)) & WHEEL_LN_MASK;
+                if (cascade(level, slot) != 0)
+                {
+                    break;
+                }
+            }
+        }
+        now_++;
+
+        // callbacks may start or stop timers of this list, so it is
+        // taken out of the wheel and emptied one timer at a time
+        WSTimer list;
+        list_splice(&slots_[index], &list);
+        while (list.next_ != &list)
+        {
+            WSTimer *timer = list.next_;
+            list_unlink(timer);
+            count_--;
+            expired++;
+            timer->cb(timer, timer->data);
+        }
+    }
+    return expired;
+}
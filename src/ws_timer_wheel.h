@@ -0,0 +1,110 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* a hierarchical timing wheel for many coarse timers, e.g. keepalive
+*/
+
+#ifndef _WS_TIMER_WHEEL_H_
+#define _WS_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct WSTimer;
+typedef void (*ws_timer_cb)(WSTimer *timer, void *data);
+
+/**
+* a timer of a WSTimerWheel, embedded in the object it is for. init it
+* with WSTimerWheel::init before use.
+*/
+struct WSTimer
+{
+    ws_timer_cb cb;
+    void *data;
+
+    // the rest belongs to the wheel
+    WSTimer *prev_;
+    WSTimer *next_;
+    uint64_t expires_;
+};
+
+/**
+* timers rounded to a tick(e.g. 100ms) in 4 levels of slots: 1024 ticks
+* in the first one, then 64 slots of 1K, 64K and 4M ticks. a timer is
+* put in the slot of its expiry on the lowest level that reaches it, and
+* moved down a level when the lower one wraps, so starting, stopping and
+* expiring a timer are O(1), and a tick costs the same with 10 or 500K
+* timers. with 100ms ticks, keepalive intervals up to 100s stay in the
+* first level and are never moved. timers farther than 2^28 ticks expire
+* at that distance.
+* @remark not thread safe, use a wheel per event loop.
+*/
+class WSTimerWheel
+{
+public:
+    // now_ms: the current time of the clock later given to advance()
+    WSTimerWheel(uint32_t tick_ms, uint64_t now_ms);
+    ~WSTimerWheel();
+
+    static void init(WSTimer *timer, ws_timer_cb cb, void *data);
+
+    // (re)start timer to expire delay_ms after the time of the last
+    // advance(), rounded up to a tick
+    void start(WSTimer *timer, uint64_t delay_ms);
+    void stop(WSTimer *timer);
+    static bool is_active(const WSTimer *timer) { return timer->next_ != NULL; }
+
+    /**
+    * run the callbacks of the timers expired at now_ms. a callback may
+    * start or stop any timer, and the wheel may be deleted after the
+    * call returns.
+    * @return timers expired
+    */
+    int64_t advance(uint64_t now_ms);
+
+    uint32_t get_tick() const { return tick_ms_; }
+    // timers started and not expired or stopped
+    size_t size() const { return count_; }
+
+private:
+    void add(WSTimer *timer);
+    // move the timers of a slot of level 1-3 to lower levels, return the
+    // slot index
+    uint32_t cascade(int level, uint32_t index);
+
+private:
+    WSTimerWheel(const WSTimerWheel &);
+    WSTimerWheel &operator=(const WSTimerWheel &);
+
+private:
+    uint32_t tick_ms_;
+    // the next tick to run, and the tick of the last advance(). they
+    // differ while advance() catches up with a late call
+    uint64_t now_;
+    uint64_t current_;
+    size_t count_;
+    // list heads: 1024 slots of level 0, then 64 for each of levels 1-3
+    WSTimer slots_[1024 + 3 * 64];
+};
+
+#endif //_WS_TIMER_WHEEL_H_
@@ -0,0 +1,487 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "ws_cpu.h"
+#include "ws_mask.h"
+#include "ws_utf8.h"
+
+#if defined(WS_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+// validate [0, size) of src, which starts and ends on a character
+// boundary. if key is not NULL, src is unmasked into dst on the way.
+typedef bool (*utf8_func)(char *dst, const char *src, uint64_t size,
+                          const uint8_t key[4], uint32_t phase);
+
+// feed one byte to the state, false if it can't follow what came before
+static inline bool utf8_step(WSUtf8State &state, uint8_t c)
+{
+    if (state.need > 0)
+    {
+        if (c < state.lo || c > state.hi)
+        {
+            return false;
+        }
+        state.need--;
+        state.lo = 0x80;
+        state.hi = 0xBF;
+        return true;
+    }
+
+    if (c < 0x80)
+    {
+        return true;
+    }
+
+    // the first continuation byte excludes overlong forms, surrogates
+    // and code points above U+10FFFF
+    state.lo = 0x80;
+    state.hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        state.need = 1;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        state.need = 2;
+        if (c == 0xE0)
+        {
+            state.lo = 0xA0;
+        }
+        else if (c == 0xED)
+        {
+            state.hi = 0x9F;
+        }
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        state.need = 3;
+        if (c == 0xF0)
+        {
+            state.lo = 0x90;
+        }
+        else if (c == 0xF4)
+        {
+            state.hi = 0x8F;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool utf8_generic(char *dst, const char *src, uint64_t size,
+                         const uint8_t key[4], uint32_t phase)
+{
+    if (key != NULL)
+    {
+        ws_mask_bytes(dst, src, size, key, phase);
+        src = dst;
+    }
+
+    const uint8_t *p = (const uint8_t *)src;
+    WSUtf8State state = {0, 0x80, 0xBF};
+    uint64_t i = 0;
+    while (i < size)
+    {
+        // skip ascii a word at a time
+        if (state.need == 0 && i + 8 <= size)
+        {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            if ((w & 0x8080808080808080ULL) == 0)
+            {
+                i += 8;
+                continue;
+            }
+        }
+        if (!utf8_step(state, p[i]))
+        {
+            return false;
+        }
+        i++;
+    }
+    return state.need == 0;
+}
+
+#if defined(WS_ARCH_X86)
+// the kernels follow J. Keiser and D. Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte": three 4 bit lookups on each byte and
+// the one before it classify every error of a 2 byte window, the 3 and 4
+// byte sequences only need the continuation count checked on top.
+enum
+{
+    UTF8_TOO_SHORT = 1 << 0,
+    UTF8_TOO_LONG = 1 << 1,
+    UTF8_OVERLONG_3 = 1 << 2,
+    UTF8_TOO_LARGE = 1 << 3,
+    UTF8_SURROGATE = 1 << 4,
+    UTF8_OVERLONG_2 = 1 << 5,
+    UTF8_TOO_LARGE_1000 = 1 << 6,
+    UTF8_OVERLONG_4 = 1 << 6,
+    UTF8_TWO_CONTS = 1 << 7,
+    UTF8_CARRY = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS,
+};
+
+#define UTF8_BYTE_1_HIGH                                                 \
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,          \
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,      \
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,  \
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,                                \
+        UTF8_TOO_SHORT,                                                  \
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,               \
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+
+#define UTF8_BYTE_1_LOW                                                              \
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,                \
+        UTF8_CARRY | UTF8_OVERLONG_2,                                                \
+        UTF8_CARRY,                                                                  \
+        UTF8_CARRY,                                                                  \
+        UTF8_CARRY | UTF8_TOO_LARGE,                                                 \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,          \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,                           \
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+
+#define UTF8_BYTE_2_HIGH                                                                         \
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,                              \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,                          \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |                     \
+            UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,                                               \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,     \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,      \
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,      \
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+
+// a lead byte in the last 3 bytes that needs bytes of the next block
+#define UTF8_INCOMPLETE_MAX                                                    \
+    (char)255, (char)255, (char)255, (char)255, (char)255, (char)255, (char)255, \
+        (char)255, (char)255, (char)255, (char)255, (char)255, (char)255,      \
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+
+struct Utf8Sse
+{
+    __m128i prev;
+    __m128i prev_incomplete;
+    __m128i error;
+};
+
+WS_TARGET("ssse3")
+static inline void utf8_check_ssse3(Utf8Sse &s, __m128i in)
+{
+    if (_mm_movemask_epi8(in) == 0)
+    {
+        // ascii only, a character left open by the previous block is cut
+        s.error = _mm_or_si128(s.error, s.prev_incomplete);
+        s.prev_incomplete = _mm_setzero_si128();
+        s.prev = in;
+        return;
+    }
+
+    const __m128i byte_1_high = _mm_setr_epi8(UTF8_BYTE_1_HIGH);
+    const __m128i byte_1_low = _mm_setr_epi8(UTF8_BYTE_1_LOW);
+    const __m128i byte_2_high = _mm_setr_epi8(UTF8_BYTE_2_HIGH);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    __m128i prev1 = _mm_alignr_epi8(in, s.prev, 15);
+    __m128i sc = _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    sc = _mm_and_si128(sc, _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble)));
+    sc = _mm_and_si128(sc, _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+    // the 2nd continuation of a 3 or 4 byte sequence, the 3rd of a 4 byte one
+    __m128i prev2 = _mm_alignr_epi8(in, s.prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, s.prev, 13);
+    __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+
+    s.error = _mm_or_si128(s.error, _mm_xor_si128(must23, sc));
+    s.prev_incomplete = _mm_subs_epu8(in, _mm_setr_epi8(UTF8_INCOMPLETE_MAX));
+    s.prev = in;
+}
+
+WS_TARGET("ssse3")
+static bool utf8_ssse3(char *dst, const char *src, uint64_t size,
+                       const uint8_t key[4], uint32_t phase)
+{
+    uint8_t pattern[16] = {0};
+    if (key != NULL)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            pattern[i] = key[(phase + i) & 3];
+        }
+    }
+    const __m128i k = _mm_loadu_si128((const __m128i *)pattern);
+
+    Utf8Sse s;
+    s.prev = _mm_setzero_si128();
+    s.prev_incomplete = _mm_setzero_si128();
+    s.error = _mm_setzero_si128();
+
+    uint64_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i in = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), k);
+        if (key != NULL)
+        {
+            _mm_storeu_si128((__m128i *)(dst + i), in);
+        }
+        utf8_check_ssse3(s, in);
+    }
+    if (i < size)
+    {
+        // zero padding is ascii, it ends the last character
+        uint8_t tail[16] = {0};
+        memcpy(tail, src + i, size - i);
+        __m128i in = _mm_xor_si128(_mm_loadu_si128((const __m128i *)tail), k);
+        _mm_storeu_si128((__m128i *)tail, in);
+        memset(tail + (size - i), 0, 16 - (size - i));
+        in = _mm_loadu_si128((const __m128i *)tail);
+        if (key != NULL)
+        {
+            memcpy(dst + i, tail, size - i);
+        }
+        utf8_check_ssse3(s, in);
+    }
+
+    s.error = _mm_or_si128(s.error, s.prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(s.error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+struct Utf8Avx
+{
+    __m256i prev;
+    __m256i prev_incomplete;
+    __m256i error;
+};
+
+WS_TARGET("avx2")
+static inline void utf8_check_avx2(Utf8Avx &s, __m256i in)
+{
+    if (_mm256_movemask_epi8(in) == 0)
+    {
+        s.error = _mm256_or_si256(s.error, s.prev_incomplete);
+        s.prev_incomplete = _mm256_setzero_si256();
+        s.prev = in;
+        return;
+    }
+
+    const __m256i byte_1_high = _mm256_setr_epi8(UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH);
+    const __m256i byte_1_low = _mm256_setr_epi8(UTF8_BYTE_1_LOW, UTF8_BYTE_1_LOW);
+    const __m256i byte_2_high = _mm256_setr_epi8(UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    // alignr works per 128 bit lane, the lower lane needs the upper lane
+    // of the previous block
+    __m256i shifted = _mm256_permute2x128_si256(s.prev, in, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+    __m256i sc = _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble)));
+    sc = _mm256_and_si256(sc, _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+    __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+    __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+
+    s.error = _mm256_or_si256(s.error, _mm256_xor_si256(must23, sc));
+    const __m256i incomplete_max = _mm256_setr_epi8((char)255, (char)255, (char)255, (char)255,
+                                                    (char)255, (char)255, (char)255, (char)255,
+                                                    (char)255, (char)255, (char)255, (char)255,
+                                                    (char)255, (char)255, (char)255, (char)255,
+                                                    UTF8_INCOMPLETE_MAX);
+    s.prev_incomplete = _mm256_subs_epu8(in, incomplete_max);
+    s.prev = in;
+}
+
+WS_TARGET("avx2")
+static bool utf8_avx2(char *dst, const char *src, uint64_t size,
+                      const uint8_t key[4], uint32_t phase)
+{
+    uint8_t pattern[32] = {0};
+    if (key != NULL)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            pattern[i] = key[(phase + i) & 3];
+        }
+    }
+    const __m256i k = _mm256_loadu_si256((const __m256i *)pattern);
+
+    Utf8Avx s;
+    s.prev = _mm256_setzero_si256();
+    s.prev_incomplete = _mm256_setzero_si256();
+    s.error = _mm256_setzero_si256();
+
+    uint64_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i in = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i)), k);
+        if (key != NULL)
+        {
+            _mm256_storeu_si256((__m256i *)(dst + i), in);
+        }
+        utf8_check_avx2(s, in);
+    }
+    if (i < size)
+    {
+        uint8_t tail[32] = {0};
+        memcpy(tail, src + i, size - i);
+        __m256i in = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)tail), k);
+        _mm256_storeu_si256((__m256i *)tail, in);
+        memset(tail + (size - i), 0, 32 - (size - i));
+        in = _mm256_loadu_si256((const __m256i *)tail);
+        if (key != NULL)
+        {
+            memcpy(dst + i, tail, size - i);
+        }
+        utf8_check_avx2(s, in);
+    }
+
+    s.error = _mm256_or_si256(s.error, s.prev_incomplete);
+    return _mm256_testz_si256(s.error, s.error) != 0;
+}
+
+#undef UTF8_INCOMPLETE_MAX
+#undef UTF8_BYTE_2_HIGH
+#undef UTF8_BYTE_1_LOW
+#undef UTF8_BYTE_1_HIGH
+#endif
+
+static utf8_func select_utf8_func()
+{
+#if defined(WS_ARCH_X86)
+    if (ws_cpu_has(WS_CPU_AVX2))
+    {
+        return utf8_avx2;
+    }
+    if (ws_cpu_has(WS_CPU_SSSE3))
+    {
+        return utf8_ssse3;
+    }
+#endif
+    return utf8_generic;
+}
+
+static bool utf8_update(WSUtf8State &state, char *dst, const char *src, uint64_t size,
+                        const uint8_t key[4], uint32_t &phase)
+{
+    static utf8_func func = select_utf8_func();
+    const uint8_t *s = (const uint8_t *)src;
+    uint64_t i = 0;
+
+    // finish a character the previous call has left open
+    for (; state.need > 0 && i < size; i++, phase++)
+    {
+        uint8_t c = key != NULL ? s[i] ^ key[phase & 3] : s[i];
+        if (key != NULL)
+        {
+            dst[i] = (char)c;
+        }
+        if (!utf8_step(state, c))
+        {
+            return false;
+        }
+    }
+    if (i == size)
+    {
+        phase &= 3;
+        return true;
+    }
+
+    // the kernels want whole characters, keep a character that is cut
+    // at the end for the byte loop
+    uint64_t end = size;
+    for (uint64_t j = size; j > i && j + 3 > size; j--)
+    {
+        uint8_t c = key != NULL ? s[j - 1] ^ key[(phase + (j - 1 - i)) & 3] : s[j - 1];
+        if (c < 0x80)
+        {
+            break;
+        }
+        if (c >= 0xC0)
+        {
+            uint64_t len = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+            if (j - 1 + len > size)
+            {
+                end = j - 1;
+            }
+            break;
+        }
+    }
+
+    if (end > i)
+    {
+        if (!func(dst != NULL ? dst + i : NULL, src + i, end - i, key, phase))
+        {
+            return false;
+        }
+        phase += (uint32_t)(end - i);
+    }
+
+    for (i = end; i < size; i++, phase++)
+    {
+        uint8_t c = key != NULL ? s[i] ^ key[phase & 3] : s[i];
+        if (key != NULL)
+        {
+            dst[i] = (char)c;
+        }
+        if (!utf8_step(state, c))
+        {
+            return false;
+        }
+    }
+    phase &= 3;
+    return true;
+}
+
+void ws_utf8_reset(WSUtf8State &state)
+{
+    state.need = 0;
+    state.lo = 0x80;
+    state.hi = 0xBF;
+}
+
+bool ws_utf8_validate(WSUtf8State &state, const char *data, uint64_t size)
+{
+    uint32_t phase = 0;
+    return utf8_update(state, NULL, data, size, NULL, phase);
+}
+
+bool ws_utf8_unmask_validate(WSUtf8State &state, char *dst, const char *src, uint64_t size,
+                             const uint8_t key[4], uint32_t &phase)
+{
+    return utf8_update(state, dst, src, size, key, phase);
+}
@@ -0,0 +1,77 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* incremental utf-8 validation of text message payloads (RFC6455 8.1)
+*/
+
+#ifndef _WS_UTF8_H_
+#define _WS_UTF8_H_
+
+#include <stdint.h>
+
+/**
+* where validation of a message stopped: the rest of a character that
+* is split between two calls
+*/
+struct WSUtf8State
+{
+    // continuation bytes still expected
+    uint8_t need;
+    // the range the next continuation byte must be in
+    uint8_t lo;
+    uint8_t hi;
+};
+
+/**
+* start a new message
+*/
+void ws_utf8_reset(WSUtf8State &state);
+
+/**
+* validate the next size bytes of a message, a character may be split
+* between two calls.
+* @return false as soon as the bytes are not valid utf-8
+* @remark picks avx2, ssse3 or a byte loop at runtime.
+*/
+bool ws_utf8_validate(WSUtf8State &state, const char *data, uint64_t size);
+
+/**
+* unmask like ws_mask_bytes and validate the unmasked bytes in the same
+* pass, so the payload is read once.
+* @param dst output bytes, may be the same address as src
+* @param phase in/out, see ws_mask_bytes
+* @return false as soon as the bytes are not valid utf-8, dst is then only
+*       partly written
+*/
+bool ws_utf8_unmask_validate(WSUtf8State &state, char *dst, const char *src, uint64_t size,
+                             const uint8_t key[4], uint32_t &phase);
+
+/**
+* check that the message does not end inside a character
+*/
+inline bool ws_utf8_complete(const WSUtf8State &state)
+{
+    return state.need == 0;
+}
+
+#endif //_WS_UTF8_H_
@@ -0,0 +1,181 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* measure base64 encoding and decoding(src/base64.h) with the scalar
+* tables and the ssse3 and avx2 kernels the codec picks at runtime.
+*
+* usage: ws_base64_bench [-n megabytes] [size...]
+*   -n megabytes  plain bytes encoded and decoded per size and kernel
+*                 (default 256)
+*   size          plain sizes(default 20 1024 65536 1048576)
+*
+* the kernels are run in a child process each, with WSFILES_CPU_MASK
+* hiding what the kernel must not use(src/ws_cpu.h), as the codec picks
+* its kernels once per process. each size is checked to round trip.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "base64.h"
+#include "ws_cpu.h"
+#include "ws_bench.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n megabytes] [size...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+static void run(const char *kernel, int size, int64_t total)
+{
+    std::vector<char> plain(size), decoded(size + 3);
+    std::vector<char> coded(Base64encode_len(size));
+    for (int i = 0; i < size; i++)
+    {
+        plain[i] = (char)(i * 131 + 7);
+    }
+
+    int coded_len = Base64encode_n(&coded[0], (int)coded.size(), &plain[0], size);
+    if (coded_len < 0 || Base64decode_n(&decoded[0], (int)decoded.size(), &coded[0], coded_len) != size ||
+        memcmp(&decoded[0], &plain[0], size) != 0 || Base64decode(&decoded[0], &coded[0]) != size)
+    {
+        fprintf(stderr, "%s: %d bytes do not round trip\n", kernel, size);
+        exit(EXIT_FAILURE);
+    }
+
+    int64_t rounds = total / size;
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+    char name[64];
+
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < rounds; i++)
+    {
+        bench_sink += Base64encode(&coded[0], &plain[0], size);
+    }
+    int64_t ns = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "%s encode %d", kernel, size);
+    bench_report(name, rounds, rounds * size, ns);
+
+    // decoding is reported in plain bytes too, so the rates compare
+    start = bench_now_ns();
+    for (int64_t i = 0; i < rounds; i++)
+    {
+        bench_sink += Base64decode(&decoded[0], &coded[0]);
+    }
+    ns = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "%s decode %d", kernel, size);
+    bench_report(name, rounds, rounds * size, ns);
+
+    start = bench_now_ns();
+    for (int64_t i = 0; i < rounds; i++)
+    {
+        bench_sink += Base64decode_n(&decoded[0], (int)decoded.size(), &coded[0], coded_len);
+    }
+    ns = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "%s decode_n %d", kernel, size);
+    bench_report(name, rounds, rounds * size, ns);
+}
+
+// the benchmarks with the cpu features outside mask hidden
+static void run_kernel(const char *kernel, uint32_t mask, uint32_t need,
+                       const std::vector<int> &sizes, int64_t total)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        char value[16];
+        snprintf(value, sizeof(value), "%x", mask);
+        setenv("WSFILES_CPU_MASK", value, 1);
+        if (need != 0 && !ws_cpu_has(need))
+        {
+            printf("%-28s not supported\n", kernel);
+            _exit(0);
+        }
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            run(kernel, sizes[i], total);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64_t total = 256 << 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            total = (int64_t)atoi(optarg) << 20;
+            if (total <= 0)
+            {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    std::vector<int> sizes;
+    for (int i = optind; i < argc; i++)
+    {
+        int size = atoi(argv[i]);
+        if (size < 1 || size > (256 << 20))
+        {
+            usage(argv[0]);
+        }
+        sizes.push_back(size);
+    }
+    if (sizes.empty())
+    {
+        int defaults[] = {20, 1024, 65536, 1048576};
+        sizes.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+    run_kernel("scalar", 0, 0, sizes, total);
+    run_kernel("ssse3", WS_CPU_SSE2 | WS_CPU_SSSE3 | WS_CPU_SSE41, WS_CPU_SSSE3, sizes, total);
+    run_kernel("avx2", 0xffffffff, WS_CPU_AVX2 | WS_CPU_SSSE3, sizes, total);
+    return 0;
+}
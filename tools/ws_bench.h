@@ -0,0 +1,65 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* helpers shared by the benchmarks under tools/: make bench
+*/
+
+#ifndef _WS_BENCH_H_
+#define _WS_BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// monotonic clock in nanoseconds
+static inline int64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// print one result line: what was measured, operations per second and,
+// when bytes is not 0, the throughput in MB/s
+static inline void bench_report(const char *name, int64_t ops, int64_t bytes, int64_t ns)
+{
+    double secs = ns / 1e9;
+    if (secs <= 0)
+    {
+        secs = 1e-9;
+    }
+    if (bytes > 0)
+    {
+        printf("%-28s %12.0f ops/s %10.1f MB/s\n", name, ops / secs, bytes / secs / 1e6);
+    }
+    else
+    {
+        printf("%-28s %12.0f ops/s\n", name, ops / secs);
+    }
+    fflush(stdout);
+}
+
+// keeps the compiler from dropping results nobody reads
+static volatile uint64_t bench_sink;
+
+#endif //_WS_BENCH_H_
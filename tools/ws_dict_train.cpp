@@ -0,0 +1,529 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* train a preset dictionary for WSDeflateDictionary(src/ws_deflate.h) from
+* captured messages, and report how it compresses them.
+*
+* usage: ws_dict_train [-f lines|frames] [-s size] [-k segment] [-l level]
+*                      [-o dict] corpus...
+*   -f lines   one message per line(default)
+*   -f frames  websocket frames as captured from one direction of a
+*              connection after the handshake, masked or not. fragments
+*              are joined and control frames are skipped.
+*   -s size    dictionary size(default 16384, at most 32768)
+*   -k segment length of the pieces picked from the corpus(default 256)
+*   -l level   zlib level of the report(default 6)
+*   -o dict    output file(default ws.dict)
+*
+* the pieces are picked like zstd's COVER algorithm: the corpus is cut in
+* one epoch per piece, and each epoch gives the piece whose 8 byte
+* substrings occur in the most messages. substrings already picked do not
+* count again. the best pieces go last, nearest to the data, where zlib
+* reaches them with the shortest distances. one message of ten is kept
+* out of training to measure the result.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// length of the substrings counted
+#define DMER 8
+// zlib looks back 32K at most
+#define MAX_DICT_SIZE (32 * 1024)
+// corpus bytes used for training
+#define MAX_CORPUS_SIZE (64 * 1024 * 1024)
+
+struct Dmer
+{
+    uint64_t key;
+    // messages it occurs in, 0 once it has been picked
+    uint32_t freq;
+    // last message counted, so a message counts once
+    uint32_t last_msg;
+    // occurrences in the sliding window
+    uint32_t active;
+    bool used;
+};
+
+struct Segment
+{
+    size_t begin;
+    uint64_t score;
+};
+
+static bool segment_less(const Segment &a, const Segment &b)
+{
+    return a.score < b.score;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f lines|frames] [-s size] [-k segment] [-l level] "
+                    "[-o dict] corpus...\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+static bool read_file(const char *path, std::string &data)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    char buf[65536];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        data.append(buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+static void split_lines(const std::string &data, std::vector<std::string> &msgs)
+{
+    size_t begin = 0;
+    while (begin < data.length())
+    {
+        size_t end = data.find('\n', begin);
+        if (end == std::string::npos)
+        {
+            end = data.length();
+        }
+        size_t len = end - begin;
+        if (len > 0 && data[begin + len - 1] == '\r')
+        {
+            len--;
+        }
+        if (len > 0)
+        {
+            msgs.push_back(data.substr(begin, len));
+        }
+        begin = end + 1;
+    }
+}
+
+// data messages of a frame stream(RFC6455 5.2)
+static void split_frames(const std::string &data, std::vector<std::string> &msgs)
+{
+    const unsigned char *p = (const unsigned char *)data.data();
+    size_t size = data.length();
+    size_t pos = 0;
+    std::string msg;
+    bool in_message = false;
+    while (pos + 2 <= size)
+    {
+        bool fin = (p[pos] & 0x80) != 0;
+        int opcode = p[pos] & 0x0F;
+        bool masked = (p[pos + 1] & 0x80) != 0;
+        uint64_t len = p[pos + 1] & 0x7F;
+        size_t header = 2;
+        if (len == 126)
+        {
+            if (pos + 4 > size)
+            {
+                break;
+            }
+            len = ((uint64_t)p[pos + 2] << 8) | p[pos + 3];
+            header = 4;
+        }
+        else if (len == 127)
+        {
+            if (pos + 10 > size)
+            {
+                break;
+            }
+            len = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                len = (len << 8) | p[pos + 2 + i];
+            }
+            header = 10;
+        }
+        const unsigned char *key = p + pos + header;
+        if (masked)
+        {
+            header += 4;
+        }
+        if (len > size || pos + header + len > size)
+        {
+            break;
+        }
+
+        const unsigned char *payload = p + pos + header;
+        pos += header + (size_t)len;
+        if (opcode >= 8)
+        {
+            continue;
+        }
+        if (opcode != 0)
+        {
+            msg.clear();
+            in_message = true;
+        }
+        if (!in_message)
+        {
+            continue;
+        }
+        size_t old = msg.length();
+        msg.append((const char *)payload, (size_t)len);
+        if (masked)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                msg[old + i] ^= key[i & 3];
+            }
+        }
+        if (fin)
+        {
+            if (!msg.empty())
+            {
+                msgs.push_back(msg);
+            }
+            in_message = false;
+        }
+    }
+    if (pos != size)
+    {
+        fprintf(stderr, "warning: %lu bytes of an incomplete frame ignored\n",
+                (unsigned long)(size - pos));
+    }
+}
+
+static inline uint64_t load_dmer(const char *p)
+{
+    uint64_t key;
+    memcpy(&key, p, DMER);
+    return key;
+}
+
+// open addressing table of the substrings of the corpus
+class DmerTable
+{
+public:
+    explicit DmerTable(size_t count)
+    {
+        size_t cap = 1024;
+        while (cap < count * 2)
+        {
+            cap <<= 1;
+        }
+        slots_.resize(cap);
+        mask_ = cap - 1;
+    }
+
+    uint32_t find_or_add(uint64_t key)
+    {
+        size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask_;
+        while (slots_[i].used && slots_[i].key != key)
+        {
+            i = (i + 1) & mask_;
+        }
+        if (!slots_[i].used)
+        {
+            slots_[i].used = true;
+            slots_[i].key = key;
+            slots_[i].last_msg = 0xFFFFFFFF;
+        }
+        return (uint32_t)i;
+    }
+
+    Dmer &operator[](uint32_t i) { return slots_[i]; }
+
+private:
+    std::vector<Dmer> slots_;
+    size_t mask_;
+};
+
+static std::string train(const std::vector<std::string> &msgs, size_t dict_size, size_t seg_len)
+{
+    std::string corpus;
+    std::vector<size_t> ends;
+    for (size_t m = 0; m < msgs.size() && corpus.length() < MAX_CORPUS_SIZE; m++)
+    {
+        corpus += msgs[m];
+        ends.push_back(corpus.length());
+    }
+
+    // dmer at each position, none where it would cross a message end
+    const uint32_t none = 0xFFFFFFFF;
+    std::vector<uint32_t> dmer_at(corpus.length(), none);
+    DmerTable table(corpus.length());
+    size_t begin = 0;
+    for (size_t m = 0; m < ends.size(); m++)
+    {
+        for (size_t p = begin; p + DMER <= ends[m]; p++)
+        {
+            uint32_t d = table.find_or_add(load_dmer(corpus.data() + p));
+            dmer_at[p] = d;
+            if (table[d].last_msg != m)
+            {
+                table[d].last_msg = (uint32_t)m;
+                table[d].freq++;
+            }
+        }
+        begin = ends[m];
+    }
+
+    size_t nsegs = (dict_size + seg_len - 1) / seg_len;
+    size_t epoch_len = corpus.length() / nsegs;
+    if (epoch_len < seg_len)
+    {
+        epoch_len = seg_len;
+    }
+
+    std::vector<Segment> segs;
+    for (size_t epoch = 0; epoch + seg_len <= corpus.length(); epoch += epoch_len)
+    {
+        size_t end = std::min(epoch + epoch_len, corpus.length());
+        uint64_t score = 0;
+        Segment best = {0, 0};
+        // window [s, p) of dmer positions, p - s <= seg_len - DMER + 1
+        size_t window = seg_len - DMER + 1;
+        size_t s = epoch;
+        for (size_t p = epoch; p < end; p++)
+        {
+            if (dmer_at[p] != none)
+            {
+                Dmer &d = table[dmer_at[p]];
+                if (d.active++ == 0)
+                {
+                    score += d.freq;
+                }
+            }
+            if (p - s + 1 > window)
+            {
+                if (dmer_at[s] != none)
+                {
+                    Dmer &d = table[dmer_at[s]];
+                    if (--d.active == 0)
+                    {
+                        score -= d.freq;
+                    }
+                }
+                s++;
+            }
+            if (p - s + 1 == window && score > best.score && s + seg_len <= corpus.length())
+            {
+                best.begin = s;
+                best.score = score;
+            }
+        }
+        for (; s < end; s++)
+        {
+            if (dmer_at[s] != none)
+            {
+                table[dmer_at[s]].active--;
+            }
+        }
+
+        if (best.score > 0)
+        {
+            segs.push_back(best);
+            for (size_t p = best.begin; p < best.begin + window; p++)
+            {
+                if (dmer_at[p] != none)
+                {
+                    table[dmer_at[p]].freq = 0;
+                }
+            }
+        }
+    }
+
+    std::stable_sort(segs.begin(), segs.end(), segment_less);
+    std::string dict;
+    for (size_t i = 0; i < segs.size(); i++)
+    {
+        dict.append(corpus, segs[i].begin, seg_len);
+    }
+    if (dict.length() > dict_size)
+    {
+        dict.erase(0, dict.length() - dict_size);
+    }
+    return dict;
+}
+
+// raw deflate of one message the way WSDeflateDictionary does it
+static size_t deflate_size(const std::string &msg, const std::string &dict, int level)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return msg.length();
+    }
+    if (!dict.empty())
+    {
+        deflateSetDictionary(&strm, (const Bytef *)dict.data(), (uInt)dict.length());
+    }
+    std::vector<unsigned char> out(deflateBound(&strm, msg.length()) + 16);
+    strm.next_in = (Bytef *)msg.data();
+    strm.avail_in = (uInt)msg.length();
+    strm.next_out = &out[0];
+    strm.avail_out = (uInt)out.size();
+    deflate(&strm, Z_FINISH);
+    size_t n = out.size() - strm.avail_out;
+    deflateEnd(&strm);
+    // stored when it does not pay, plus the flags byte
+    return std::min(n, msg.length()) + 1;
+}
+
+int main(int argc, char **argv)
+{
+    bool frames = false;
+    size_t dict_size = 16 * 1024;
+    size_t seg_len = 256;
+    int level = 6;
+    const char *output = "ws.dict";
+    int opt;
+    while ((opt = getopt(argc, argv, "f:s:k:l:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (strcmp(optarg, "lines") == 0)
+            {
+                frames = false;
+            }
+            else if (strcmp(optarg, "frames") == 0)
+            {
+                frames = true;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            dict_size = (size_t)atoi(optarg);
+            if (dict_size < 256 || dict_size > MAX_DICT_SIZE)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            seg_len = (size_t)atoi(optarg);
+            if (seg_len < 16 || seg_len > 4096)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            level = atoi(optarg);
+            if (level < 1 || level > 9)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+    }
+
+    std::vector<std::string> msgs;
+    for (int i = optind; i < argc; i++)
+    {
+        std::string data;
+        if (!read_file(argv[i], data))
+        {
+            fprintf(stderr, "can't read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (frames)
+        {
+            split_frames(data, msgs);
+        }
+        else
+        {
+            split_lines(data, msgs);
+        }
+    }
+
+    // every tenth message is kept for the report
+    std::vector<std::string> train_msgs, test_msgs;
+    for (size_t i = 0; i < msgs.size(); i++)
+    {
+        if (msgs.size() >= 10 && i % 10 == 9)
+        {
+            test_msgs.push_back(msgs[i]);
+        }
+        else
+        {
+            train_msgs.push_back(msgs[i]);
+        }
+    }
+    if (test_msgs.empty())
+    {
+        test_msgs = train_msgs;
+    }
+
+    std::string dict = train(train_msgs, dict_size, seg_len);
+    if (dict.empty())
+    {
+        fprintf(stderr, "no dictionary: the corpus has %lu messages and nothing repeats\n",
+                (unsigned long)msgs.size());
+        return EXIT_FAILURE;
+    }
+
+    FILE *fp = fopen(output, "wb");
+    if (fp == NULL || fwrite(dict.data(), 1, dict.length(), fp) != dict.length())
+    {
+        fprintf(stderr, "can't write %s\n", output);
+        return EXIT_FAILURE;
+    }
+    fclose(fp);
+
+    size_t raw = 0, plain = 0, with_dict = 0;
+    for (size_t i = 0; i < test_msgs.size(); i++)
+    {
+        raw += test_msgs[i].length();
+        plain += deflate_size(test_msgs[i], "", level);
+        with_dict += deflate_size(test_msgs[i], dict, level);
+    }
+
+    // the name WSDeflateDictionary::get_protocol() gives this file
+    uint32_t id = (uint32_t)adler32(adler32(0L, Z_NULL, 0), (const Bytef *)dict.data(), (uInt)dict.length());
+    printf("messages: %lu, %lu kept out for the report\n", (unsigned long)msgs.size(),
+           (unsigned long)test_msgs.size());
+    printf("dictionary: %s, %lu bytes, protocol wsfiles.deflate-dict.%08x\n", output,
+           (unsigned long)dict.length(), id);
+    printf("report: %lu bytes, deflate %lu(%.2fx), with dictionary %lu(%.2fx)\n",
+           (unsigned long)raw, (unsigned long)plain, (double)raw / plain,
+           (unsigned long)with_dict, (double)raw / with_dict);
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* ping-pong driver for the echo servers: each connection sends one
+* binary message, waits for the echo and sends the next, so the rate
+* measured is the round trip through the server, e.g. its inline and
+* pool modes:
+*
+*   ./wsfiles_main_uv.1.02 -m inline &      ./tools/ws_echo_bench -c 50
+*   ./wsfiles_main_uv.1.02 -m pool -w 4 &   ./tools/ws_echo_bench -c 50
+*
+* usage: ws_echo_bench [-c conns] [-t seconds] [-s size] [-a address] [port]
+*   -c conns    connections, one message in flight on each(default 50)
+*   -t seconds  how long to run(default 5)
+*   -s size     payload size of a message(default 512)
+*   -a address  ipv4 address of the server(default 127.0.0.1)
+*   port        port of the server(default 9000)
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <vector>
+#include "ws_bench.h"
+
+struct EchoConnection
+{
+    int fd;
+    // bytes of the echo still to come
+    int64_t pending;
+};
+
+static const char *handshake =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c conns] [-t seconds] [-s size] [-a address] [port]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// a masked binary frame of size bytes, as a client sends it
+static void make_frame(std::vector<char> &frame, int64_t size)
+{
+    static const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+    frame.clear();
+    frame.push_back((char)0x82);
+    if (size < 126)
+    {
+        frame.push_back((char)(0x80 | size));
+    }
+    else if (size < 65536)
+    {
+        frame.push_back((char)(0x80 | 126));
+        frame.push_back((char)(size >> 8));
+        frame.push_back((char)size);
+    }
+    else
+    {
+        frame.push_back((char)(0x80 | 127));
+        for (int i = 7; i >= 0; i--)
+        {
+            frame.push_back((char)(size >> (i * 8)));
+        }
+    }
+    frame.insert(frame.end(), (const char *)key, (const char *)key + 4);
+    for (int64_t i = 0; i < size; i++)
+    {
+        frame.push_back((char)((i & 0x7f) ^ key[i & 3]));
+    }
+}
+
+// size of the unmasked frame the server echoes
+static int64_t echo_size(int64_t size)
+{
+    return size + (size < 126 ? 2 : (size < 65536 ? 4 : 10));
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static int open_connection(const struct sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // the server sends nothing before the handshake is answered
+    char response[1024];
+    size_t got = 0;
+    if (!write_all(fd, handshake, strlen(handshake)))
+    {
+        perror("handshake");
+        exit(EXIT_FAILURE);
+    }
+    while (got < 4 || memcmp(response + got - 4, "\r\n\r\n", 4) != 0)
+    {
+        if (got == sizeof(response) || read(fd, response + got, 1) != 1)
+        {
+            fprintf(stderr, "handshake failed\n");
+            exit(EXIT_FAILURE);
+        }
+        got++;
+    }
+    if (strncmp(response, "HTTP/1.1 101", 12) != 0)
+    {
+        fprintf(stderr, "handshake refused: %.*s\n", (int)got, response);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    int conns = 50;
+    int seconds = 5;
+    int64_t size = 512;
+    const char *address = "127.0.0.1";
+    int port = 9000;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:s:a:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            conns = atoi(optarg);
+            if (conns < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            if (seconds < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            size = atoll(optarg);
+            if (size < 0)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'a':
+            address = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+    {
+        port = atoi(argv[optind]);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    {
+        usage(argv[0]);
+    }
+
+    std::vector<char> frame;
+    make_frame(frame, size);
+    int64_t echo = echo_size(size);
+
+    int epfd = epoll_create1(0);
+    std::vector<EchoConnection> connections(conns);
+    for (int i = 0; i < conns; i++)
+    {
+        connections[i].fd = open_connection(addr);
+        connections[i].pending = echo;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &connections[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, connections[i].fd, &ev);
+    }
+
+    int64_t messages = 0;
+    int64_t start = bench_now_ns();
+    int64_t end = start + (int64_t)seconds * 1000000000;
+    for (int i = 0; i < conns; i++)
+    {
+        write_all(connections[i].fd, &frame[0], frame.size());
+    }
+
+    static char scratch[256 * 1024];
+    struct epoll_event events[256];
+    while (bench_now_ns() < end)
+    {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            EchoConnection *conn = (EchoConnection *)events[i].data.ptr;
+            ssize_t got = read(conn->fd, scratch, sizeof(scratch));
+            if (got <= 0)
+            {
+                fprintf(stderr, "connection closed by the server\n");
+                return EXIT_FAILURE;
+            }
+            // the echoes are not parsed, only counted
+            conn->pending -= got;
+            while (conn->pending <= 0)
+            {
+                conn->pending += echo;
+                messages++;
+                if (!write_all(conn->fd, &frame[0], frame.size()))
+                {
+                    perror("write");
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    int64_t ns = bench_now_ns() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "echo %d conns %lld B", conns, (long long)size);
+    bench_report(name, messages, messages * size, ns);
+    if (messages > 0)
+    {
+        printf("%-28s %12.1f us\n", "round trip", (double)ns / 1000 * conns / messages);
+    }
+    return 0;
+}
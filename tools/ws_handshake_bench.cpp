@@ -0,0 +1,199 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* measure the websocket opening handshake: the Sec-WebSocket-Accept hash
+* alone(SHA1HashAcceptInput, src/sha1.h), parsing the request and packing
+* the response(WebSocketPacket), and a whole endpoint answering it. each
+* is run with every SHA-1 backend the cpu has.
+*
+* usage: ws_handshake_bench [-n count]
+*   -n count  handshakes per measurement(default 200000)
+*
+* the backends are run in a child process each, with WSFILES_CPU_MASK
+* hiding what the backend must not use(src/ws_cpu.h), as SHA1ProcessBlocks
+* picks its backend once per process.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include "sha1.h"
+#include "ws_cpu.h"
+#include "ws_packet.h"
+#include "ws_endpoint.h"
+#include "ws_bench.h"
+
+// the sample handshake of RFC6455 1.3
+static const char *handshake =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: server.example.com\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Origin: http://example.com\r\n"
+    "Sec-WebSocket-Protocol: chat, superchat\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+static const char *accept_input = "dGhlIHNhbXBsZSBub25jZQ==258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char *accept_key = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n count]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+static void on_response(char *buf, int64_t size, void *wd)
+{
+    *(int64_t *)wd += size;
+}
+
+static void run_accept(const char *backend, int64_t count)
+{
+    unsigned char hash[SHA1::kSHA1Length];
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < count; i++)
+    {
+        SHA1::SHA1HashAcceptInput((const unsigned char *)accept_input, hash);
+        bench_sink += hash[i % SHA1::kSHA1Length];
+    }
+    int64_t ns = bench_now_ns() - start;
+
+    std::string name = std::string(backend) + " accept key";
+    bench_report(name.c_str(), count, 0, ns);
+}
+
+static void run_packet(const char *backend, int64_t count)
+{
+    size_t size = strlen(handshake);
+    ByteBuffer input;
+    std::string response;
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < count; i++)
+    {
+        WebSocketPacket packet;
+        input.append(handshake, (int)size);
+        if (packet.recv_handshake(input) != 0 || packet.get_hs_length() == 0)
+        {
+            fprintf(stderr, "%s: handshake not parsed\n", backend);
+            exit(EXIT_FAILURE);
+        }
+        input.erase(input.length());
+        response.clear();
+        packet.pack_handshake_rsp(response);
+    }
+    int64_t ns = bench_now_ns() - start;
+    if (response.find(accept_key) == std::string::npos)
+    {
+        fprintf(stderr, "%s: wrong accept key in\n%s", backend, response.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::string name = std::string(backend) + " parse+response";
+    bench_report(name.c_str(), count, 0, ns);
+}
+
+static void run_endpoint(const char *backend, int64_t count)
+{
+    int32_t size = (int32_t)strlen(handshake);
+    int64_t written = 0;
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < count; i++)
+    {
+        WebSocketEndpoint *endpoint = new WebSocketEndpoint();
+        endpoint->process(handshake, size, on_response, &written);
+        delete endpoint;
+    }
+    int64_t ns = bench_now_ns() - start;
+    if (written == 0)
+    {
+        fprintf(stderr, "%s: the endpoint did not answer\n", backend);
+        exit(EXIT_FAILURE);
+    }
+
+    std::string name = std::string(backend) + " endpoint";
+    bench_report(name.c_str(), count, 0, ns);
+}
+
+// the benchmarks with the cpu features outside mask hidden
+static void run_backend(const char *backend, uint32_t mask, uint32_t need, int64_t count)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        char value[16];
+        snprintf(value, sizeof(value), "%x", mask);
+        setenv("WSFILES_CPU_MASK", value, 1);
+        if (need != 0 && !ws_cpu_has(need))
+        {
+            printf("%-28s not supported\n", backend);
+            _exit(0);
+        }
+        run_accept(backend, count);
+        run_packet(backend, count);
+        run_endpoint(backend, count);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64_t count = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            count = atoll(optarg);
+            if (count < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    run_backend("portable", 0, 0, count);
+    run_backend("ssse3", WS_CPU_SSE2 | WS_CPU_SSSE3 | WS_CPU_SSE41 | WS_CPU_AVX2, WS_CPU_SSSE3,
+                count);
+    run_backend("sha-ni", 0xffffffff, WS_CPU_SHA | WS_CPU_SSE41 | WS_CPU_SSSE3, count);
+    return 0;
+}
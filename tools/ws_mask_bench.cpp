@@ -0,0 +1,190 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* measure websocket payload masking(src/ws_mask.h): the byte loop the
+* frame parser used to run against the 64 bit word loop and the sse2 and
+* avx2 kernels ws_mask_bytes picks at runtime.
+*
+* usage: ws_mask_bench [-n megabytes] [size...]
+*   -n megabytes  bytes masked per size and kernel(default 256)
+*   size          payload sizes(default 16 125 1024 16384 1048576)
+*
+* the simd kernels are run in a child process each, with
+* WSFILES_CPU_MASK hiding what the kernel must not use(src/ws_cpu.h), as
+* ws_mask_bytes picks its kernel once per process. every kernel is checked
+* against the byte loop first.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "ws_cpu.h"
+#include "ws_mask.h"
+#include "ws_bench.h"
+
+typedef uint32_t (*mask_func)(char *dst, const char *src, uint64_t size,
+                              const uint8_t key[4], uint32_t phase);
+
+static const uint8_t bench_key[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+// what WebSocketPacket::fetch_payload did before ws_mask_bytes
+static uint32_t mask_bytes_loop(char *dst, const char *src, uint64_t size,
+                                const uint8_t key[4], uint32_t phase)
+{
+    for (uint64_t i = 0; i < size; i++)
+    {
+        dst[i] = src[i] ^ key[(phase + i) % 4];
+    }
+    return (uint32_t)((phase + size) & 3);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n megabytes] [size...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// mask the same buffer until total bytes went through func
+static void run(const char *kernel, mask_func func, size_t size, int64_t total)
+{
+    std::vector<char> src(size + 1), dst(size + 1), expect(size + 1);
+    for (size_t i = 0; i < size; i++)
+    {
+        src[i] = (char)(i * 131 + 7);
+    }
+
+    // an odd phase and address catch a kernel that gets the tail wrong
+    mask_bytes_loop(&expect[0], &src[1], size - 1, bench_key, 3);
+    func(&dst[0], &src[1], size - 1, bench_key, 3);
+    if (memcmp(&dst[0], &expect[0], size - 1) != 0)
+    {
+        fprintf(stderr, "%s: wrong output for %zu bytes\n", kernel, size - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    int64_t rounds = total / (int64_t)size;
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+    uint32_t phase = 0;
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < rounds; i++)
+    {
+        phase = func(&dst[0], &src[0], size, bench_key, phase);
+    }
+    int64_t ns = bench_now_ns() - start;
+    bench_sink += (uint8_t)dst[size / 2] + phase;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %zu", kernel, size);
+    bench_report(name, rounds, rounds * (int64_t)size, ns);
+}
+
+// ws_mask_bytes with the cpu features outside mask hidden
+static void run_dispatched(const char *kernel, uint32_t mask, uint32_t need,
+                           const std::vector<size_t> &sizes, int64_t total)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        char value[16];
+        snprintf(value, sizeof(value), "%x", mask);
+        setenv("WSFILES_CPU_MASK", value, 1);
+        if (!ws_cpu_has(need))
+        {
+            printf("%-28s not supported\n", kernel);
+            _exit(0);
+        }
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            run(kernel, ws_mask_bytes, sizes[i], total);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64_t total = 256 << 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            total = (int64_t)atoi(optarg) << 20;
+            if (total <= 0)
+            {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    std::vector<size_t> sizes;
+    for (int i = optind; i < argc; i++)
+    {
+        long size = atol(argv[i]);
+        if (size < 2)
+        {
+            usage(argv[0]);
+        }
+        sizes.push_back((size_t)size);
+    }
+    if (sizes.empty())
+    {
+        size_t defaults[] = {16, 125, 1024, 16384, 1048576};
+        sizes.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        run("byte loop", mask_bytes_loop, sizes[i], total);
+    }
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        run("word loop", ws_mask_bytes_generic, sizes[i], total);
+    }
+    // the parent never calls ws_mask_bytes, so each child picks afresh
+    run_dispatched("sse2", WS_CPU_SSE2, WS_CPU_SSE2, sizes, total);
+    run_dispatched("avx2", WS_CPU_SSE2 | WS_CPU_AVX2, WS_CPU_AVX2, sizes, total);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+* The MIT License (MIT)
+* Copyright(c) 2020 BeikeSong
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+* publish driver for the pub/sub hub(src/ws_pubsub.h): deliveries per
+* second to 1k, 10k and 100k subscribers of one topic. each subscriber is
+* an endpoint past its handshake whose shared writer queues the frame on a
+* WSSendQueue, as the servers do, and the queues are drained after every
+* publish as a flush would, without the socket write.
+*
+* usage: ws_pubsub_bench [-n deliveries] [-m size] [-s shards] [subscribers...]
+*   -n deliveries  frames delivered per measurement(default 10000000)
+*   -m size        message size(default 64)
+*   -s shards      shards the subscribers are spread over(default 1).
+*                  publishes go out from shard 0, the others get theirs
+*                  through their queue and are dispatched in turn by the
+*                  same thread
+*   subscribers    subscriber counts(default 1000 10000 100000)
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "ws_endpoint.h"
+#include "ws_pubsub.h"
+#include "ws_send_queue.h"
+#include "ws_shared_frame.h"
+#include "ws_bench.h"
+
+struct BenchSubscriber
+{
+    WebSocketEndpoint *endpoint;
+    WSSendQueue *sendq;
+    WSSubscription *sub;
+    int shard;
+};
+
+static const char *handshake =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+static const char *topic = "bench";
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n deliveries] [-m size] [-s shards] [subscribers...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// the handshake response is not needed
+static void on_write_discard(char *buf, int64_t size, void *wd)
+{
+}
+
+static void on_write_shared(WSSharedFrame *frame, void *wd)
+{
+    ((BenchSubscriber *)wd)->sendq->push_shared(frame);
+}
+
+// what a flush does to the send queue once the frames are written
+static int64_t drain(BenchSubscriber *subscriber)
+{
+    WSSendBuf pieces[16];
+    int64_t bytes = 0;
+    int32_t n;
+    while ((n = subscriber->sendq->peek(pieces, 16)) > 0)
+    {
+        int64_t size = 0;
+        for (int32_t i = 0; i < n; i++)
+        {
+            size += pieces[i].size;
+        }
+        subscriber->sendq->consume(size);
+        bytes += size;
+    }
+    return bytes;
+}
+
+static void run(int count, int shards, int64_t total, int64_t size)
+{
+    WSPubSub hub(shards);
+    std::vector<BenchSubscriber> subscribers(count);
+    int32_t hs_size = (int32_t)strlen(handshake);
+    for (int i = 0; i < count; i++)
+    {
+        BenchSubscriber *subscriber = &subscribers[i];
+        subscriber->endpoint = new WebSocketEndpoint();
+        subscriber->endpoint->process(handshake, hs_size, on_write_discard, subscriber);
+        subscriber->endpoint->set_shared_writer(on_write_shared, subscriber);
+        subscriber->sendq = new WSSendQueue();
+        subscriber->shard = i % shards;
+        subscriber->sub = hub.subscribe(subscriber->shard, topic, strlen(topic), subscriber->endpoint);
+    }
+
+    std::vector<char> message(size, 'x');
+    int64_t publishes = total / count;
+    if (publishes < 1)
+    {
+        publishes = 1;
+    }
+    int64_t delivered = 0;
+    int64_t bytes = 0;
+    int64_t start = bench_now_ns();
+    for (int64_t i = 0; i < publishes; i++)
+    {
+        int64_t reached = hub.publish(topic, strlen(topic), WebSocketPacket::WSOpcode_Binary,
+                                      &message[0], size, 0);
+        if (reached < 0)
+        {
+            fprintf(stderr, "publish failed\n");
+            exit(EXIT_FAILURE);
+        }
+        delivered += reached;
+        for (int shard = 1; shard < shards; shard++)
+        {
+            delivered += hub.dispatch(shard);
+        }
+        for (int j = 0; j < count; j++)
+        {
+            bytes += drain(&subscribers[j]);
+        }
+    }
+    int64_t ns = bench_now_ns() - start;
+    if (delivered != publishes * count)
+    {
+        fprintf(stderr, "%lld deliveries, expected %lld\n", (long long)delivered,
+                (long long)(publishes * count));
+        exit(EXIT_FAILURE);
+    }
+    bench_sink += bytes;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d subscribers %d shards", count, shards);
+    bench_report(name, delivered, bytes, ns);
+    printf("%-28s %12.1f us\n", "publish", (double)ns / 1000 / publishes);
+
+    for (int i = 0; i < count; i++)
+    {
+        hub.unsubscribe(subscribers[i].sub);
+        delete subscribers[i].sendq;
+        delete subscribers[i].endpoint;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64_t total = 10000000;
+    int64_t size = 64;
+    int shards = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            total = atoll(optarg);
+            if (total < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'm':
+            size = atoll(optarg);
+            if (size < 0 || size > (16 << 20))
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            shards = atoi(optarg);
+            if (shards < 1 || shards > 64)
+            {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    std::vector<int> counts;
+    for (int i = optind; i < argc; i++)
+    {
+        int count = atoi(argv[i]);
+        if (count < 1)
+        {
+            usage(argv[0]);
+        }
+        counts.push_back(count);
+    }
+    if (counts.empty())
+    {
+        int defaults[] = {1000, 10000, 100000};
+        counts.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        run(counts[i], shards, total, size);
+    }
+    return 0;
+}